@@ -0,0 +1,95 @@
+#include <new>
+#include "abuffer.h"
+
+ABuffer::ABuffer(Arena &arena, int width, int height, int capacity)
+    : width_(width), npixels_(width * height), capacity_(std::max(0, capacity)), used_(0), dropped_(0), truncated_(0)
+{
+  heads_ = arena.alloc_uninitialized<std::atomic<int> >(npixels_);
+  for (int i = 0; i < npixels_; i++)
+  {
+    new (&heads_[i]) std::atomic<int>(-1);
+  }
+  pool_ = arena.alloc_uninitialized<OITFragment>(capacity_);
+}
+
+void ABuffer::clear_rows(int y0, int y1)
+{
+  for (int i = y0 * width_; i < y1 * width_; i++)
+  {
+    heads_[i].store(-1, std::memory_order_relaxed);
+  }
+}
+
+void ABuffer::resolve(TGAImage &image, int y0, int y1)
+{
+  int width = image.get_width();
+  // the pixel's fragments, and where they are in the pool (for ties)
+  OITFragment layers[max_layers];
+  int order[max_layers];
+  long truncated = 0;
+  for (int y = y0; y < y1; y++)
+  {
+    for (int x = 0; x < width; x++)
+    {
+      int idx = x + y * width;
+      int n = 0;
+      for (int f = heads_[idx].load(std::memory_order_relaxed); f >= 0; f = pool_[f].next)
+      {
+        if (n < max_layers)
+        {
+          layers[n] = pool_[f];
+          order[n++] = f;
+          continue;
+        }
+        // too many, the farthest one goes (greater depth is closer)
+        truncated++;
+        int farthest = 0;
+        for (int i = 1; i < n; i++)
+        {
+          if (layers[i].depth < layers[farthest].depth)
+            farthest = i;
+        }
+        if (pool_[f].depth > layers[farthest].depth)
+        {
+          layers[farthest] = pool_[f];
+          order[farthest] = f;
+        }
+      }
+      if (n == 0)
+      {
+        continue;
+      }
+      // back to front, insertion sort since there are only a few. Of two at the same
+      // depth the one drawn first ends up in front, like with a zbuffer.
+      for (int i = 1; i < n; i++)
+      {
+        OITFragment fragment = layers[i];
+        int f = order[i], j = i - 1;
+        while (j >= 0 && (layers[j].depth > fragment.depth || (layers[j].depth == fragment.depth && order[j] < f)))
+        {
+          layers[j + 1] = layers[j];
+          order[j + 1] = order[j];
+          j--;
+        }
+        layers[j + 1] = fragment;
+        order[j + 1] = f;
+      }
+      TGAColor c = image.get(x, y);
+      float color[3] = {(float)c.raw[0], (float)c.raw[1], (float)c.raw[2]};
+      for (int i = 0; i < n; i++)
+      {
+        float alpha = layers[i].color[3] / 255.0f;
+        for (int k = 0; k < 3; k++)
+        {
+          color[k] += (layers[i].color[k] - color[k]) * alpha;
+        }
+      }
+      for (int k = 0; k < 3; k++)
+      {
+        c.raw[k] = (unsigned char)(color[k] + 0.5f);
+      }
+      image.set(x, y, c);
+    }
+  }
+  truncated_ += truncated;
+}
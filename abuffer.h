@@ -0,0 +1,86 @@
+#ifndef __ABUFFER_H__
+#define __ABUFFER_H__
+
+#include <algorithm>
+#include <atomic>
+#include "arena.h"
+#include "tgaimage.h"
+
+// A fragment of a transparent surface, kept until the resolve pass
+struct OITFragment
+{
+  float depth;
+  unsigned char color[4]; // b, g, r, alpha
+  int next;               // the pixel's next fragment, -1 at the end
+};
+
+/*
+
+A-buffer for order independent transparency. Transparent surfaces don't write the
+image or the zbuffer: every fragment that passes the depth test against the opaque
+surfaces is pushed onto a linked list for its pixel, and resolve() sorts each
+pixel's fragments back to front and blends them over what the opaque surfaces left
+in the image. Nothing has to be sorted by triangle, and every triangle's fragments
+end up in the right order.
+
+The fragments come from a pool allocated once up front (in the frame's arena), and
+taking one is a single atomic add, so any number of threads can rasterize into the
+same A-buffer. Once the pool is full, further fragments are dropped and counted
+rather than anything being allocated; so are the farthest fragments of a pixel with
+more than max_layers of them.
+
+*/
+class ABuffer
+{
+  std::atomic<int> *heads_; // first fragment of every pixel, -1 for none
+  OITFragment *pool_;
+  int width_, npixels_, capacity_;
+  std::atomic<int> used_; // can go past capacity_ by a fragment per thread, those were dropped
+  std::atomic<long> dropped_;
+  std::atomic<long> truncated_;
+
+public:
+  static const int max_layers = 32;
+
+  // Room for `capacity` fragments over a width x height image, all out of `arena`
+  ABuffer(Arena &arena, int width, int height, int capacity);
+
+  // Adds a fragment to pixel idx, or drops it if the pool is full
+  inline void append(int idx, float depth, const TGAColor &color, unsigned char alpha)
+  {
+    // once it's full nothing's added to used_, or enough dropped fragments would
+    // wrap it around to a negative index
+    int f = used_.load(std::memory_order_relaxed);
+    if (f < capacity_)
+    {
+      f = used_.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (f >= capacity_)
+    {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    OITFragment &fragment = pool_[f];
+    fragment.depth = depth;
+    for (int k = 0; k < 3; k++)
+    {
+      fragment.color[k] = color.raw[k];
+    }
+    fragment.color[3] = alpha;
+    fragment.next = heads_[idx].exchange(f, std::memory_order_relaxed);
+  }
+
+  // Blends the fragments of rows [y0, y1) over `image`, once they've all been added
+  void resolve(TGAImage &image, int y0, int y1);
+  // Forgets the fragments of rows [y0, y1), for drawing them again. Their room in
+  // the pool isn't given back, only a new ABuffer does that.
+  void clear_rows(int y0, int y1);
+
+  int capacity() { return capacity_; }
+  int used() { return std::min(used_.load(), capacity_); }
+  long dropped() { return dropped_; }   // the pool was full
+  long truncated() { return truncated_; } // over max_layers, after resolve()
+  size_t memory_size() { return (size_t)npixels_ * sizeof(int) + (size_t)capacity_ * sizeof(OITFragment); }
+};
+
+#endif //__ABUFFER_H__
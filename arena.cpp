@@ -0,0 +1,80 @@
+#include <algorithm>
+#include <cstdint>
+#include "arena.h"
+
+Arena::Arena(size_t initial) : blocks_(), used_(0), total_(0)
+{
+  // room for a few blocks, so growing doesn't reallocate the list in the middle of a frame
+  blocks_.reserve(8);
+  Block block = {new char[initial], initial};
+  blocks_.push_back(block);
+}
+
+Arena::~Arena()
+{
+  for (size_t i = 0; i < blocks_.size(); i++)
+  {
+    delete[] blocks_[i].data;
+  }
+}
+
+void Arena::grow(size_t bytes)
+{
+  // at least double, so a frame that keeps asking only adds a few blocks
+  size_t size = std::max(bytes, 2 * blocks_.back().size);
+  Block block = {new char[size], size};
+  blocks_.push_back(block);
+  used_ = 0;
+}
+
+void *Arena::alloc(size_t bytes, size_t align)
+{
+  Block &block = blocks_.back();
+  uintptr_t base = (uintptr_t)block.data;
+  size_t offset = ((base + used_ + align - 1) & ~(uintptr_t)(align - 1)) - base;
+  if (offset + bytes > block.size)
+  {
+    grow(bytes + align);
+    return alloc(bytes, align);
+  }
+  used_ = offset + bytes;
+  total_ += bytes;
+  return block.data + offset;
+}
+
+void Arena::reset()
+{
+  if (blocks_.size() > 1)
+  {
+    // this frame didn't fit, next time it will
+    size_t size = 0;
+    for (size_t i = 0; i < blocks_.size(); i++)
+    {
+      size += blocks_[i].size;
+      delete[] blocks_[i].data;
+    }
+    blocks_.clear();
+    Block block = {new char[size], size};
+    blocks_.push_back(block);
+  }
+  used_ = 0;
+  total_ = 0;
+}
+
+void Arena::rewind(const Mark &mark)
+{
+  // blocks added after the mark only hold what was allocated after it, so if there
+  // are any the newest one is reused from the start instead
+  used_ = blocks_.size() - 1 == mark.block ? mark.used : 0;
+  total_ = mark.total;
+}
+
+size_t Arena::capacity()
+{
+  size_t size = 0;
+  for (size_t i = 0; i < blocks_.size(); i++)
+  {
+    size += blocks_[i].size;
+  }
+  return size;
+}
@@ -0,0 +1,54 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <cstddef>
+#include <vector>
+
+// Bump allocator for everything that only lives for one frame (zbuffer, culled face
+// lists, transformed triangles...). alloc() just moves a pointer, nothing is freed
+// on its own, and reset() forgets everything at once.
+//
+// If a frame needs more than the current block, more blocks are allocated for the
+// rest of it and reset() replaces them all with one block as big as that frame
+// needed, so a steady stream of similar frames stops allocating after the first.
+// Not thread safe, use one per thread.
+class Arena
+{
+  struct Block
+  {
+    char *data;
+    size_t size;
+  };
+  std::vector<Block> blocks_; // the last one is being allocated from
+  size_t used_;               // in the last block
+  size_t total_;              // allocated since the last reset(), in all blocks
+
+  void grow(size_t bytes);
+
+public:
+  Arena(size_t initial = 1 << 20);
+  ~Arena();
+
+  void *alloc(size_t bytes, size_t align = 16);
+  // n Ts, not constructed, for plain data that's written before it's read
+  template <class T>
+  T *alloc_uninitialized(size_t n)
+  {
+    return (T *)alloc(n * sizeof(T), alignof(T));
+  }
+  void reset();
+
+  // Where the arena is now. rewind() drops everything allocated since, so a loop
+  // can reuse the same memory on every iteration (e.g. once per instance).
+  struct Mark
+  {
+    size_t block, used, total;
+  };
+  Mark mark() { return Mark{blocks_.size() - 1, used_, total_}; }
+  void rewind(const Mark &mark);
+
+  size_t used() { return total_; }
+  size_t capacity();
+};
+
+#endif //__ARENA_H__
@@ -0,0 +1,63 @@
+#include <sys/stat.h>
+#include "assets.h"
+
+MeshAsset *load_mesh(const std::string &path, int bvh_threads, bool lods)
+{
+  Model *model = new Model(path.c_str());
+  if (model->nfaces() == 0)
+  {
+    delete model;
+    return NULL;
+  }
+  LODChain *chain = NULL;
+  if (lods)
+  {
+    chain = new LODChain(*model);
+    if (bvh_threads >= 0)
+    {
+      chain->build_bvhs(bvh_threads);
+    }
+  }
+  return new MeshAsset(model, bvh_threads >= 0 ? new BVH(*model, bvh_threads) : NULL, chain);
+}
+
+TGAImage *load_texture(const std::string &path)
+{
+  TGAImage *texture = new TGAImage();
+  if (!texture->read_tga_file(path.c_str()))
+  {
+    delete texture;
+    return NULL;
+  }
+  return texture;
+}
+
+long long file_mtime(const std::string &path)
+{
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0)
+  {
+    return -1;
+  }
+  // nanoseconds where the platform has them, so a rewrite in the same second still counts
+#if defined(__APPLE__)
+  return (long long)st.st_mtimespec.tv_sec * 1000000000LL + st.st_mtimespec.tv_nsec;
+#else
+  return (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+#endif
+}
+
+size_t asset_size(MeshAsset &mesh)
+{
+  return mesh.model->memory_size() + (mesh.bvh ? mesh.bvh->memory_size() : 0) + (mesh.lods ? mesh.lods->memory_size() : 0);
+}
+
+size_t asset_size(CompressedTexture &texture)
+{
+  return texture.memory_size();
+}
+
+size_t asset_size(TGAImage &texture)
+{
+  return sizeof(TGAImage) + (size_t)texture.get_width() * texture.get_height() * texture.get_bytespp();
+}
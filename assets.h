@@ -0,0 +1,216 @@
+#ifndef __ASSETS_H__
+#define __ASSETS_H__
+
+#include <functional>
+#include <future>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include "bvh.h"
+#include "model.h"
+#include "simplify.h"
+#include "texture.h"
+#include "tgaimage.h"
+
+// A model, (optionally) the BVH built over it and (optionally) its LOD chain
+struct MeshAsset
+{
+  Model *model;
+  BVH *bvh;
+  LODChain *lods; // level 0 is `model`
+
+  MeshAsset(Model *m, BVH *b, LODChain *l = NULL) : model(m), bvh(b), lods(l) {}
+  ~MeshAsset()
+  {
+    delete lods;
+    delete bvh;
+    delete model;
+  }
+};
+
+// NULL if the file can't be read or has no faces. bvh_threads < 0 means no BVH.
+// With `lods` it also gets an LODChain, with a BVH for every level if it has one.
+MeshAsset *load_mesh(const std::string &path, int bvh_threads, bool lods = false);
+// NULL if the file can't be read
+TGAImage *load_texture(const std::string &path);
+// Modification time of the file, -1 if it doesn't exist
+long long file_mtime(const std::string &path);
+
+// What an asset counts for against the cache's budget, in bytes
+size_t asset_size(MeshAsset &mesh);
+size_t asset_size(TGAImage &texture);
+size_t asset_size(CompressedTexture &texture);
+
+struct CacheStats
+{
+  long hits, misses, evictions;
+  size_t bytes; // loaded and still in the cache
+  int entries;
+};
+
+/*
+
+Assets shared by every render that asks for the same path. get() hands out a
+shared_ptr, so an asset stays alive as long as someone's using it, even if it's
+been evicted or the file has changed since.
+
+- Keyed by path and mtime: if the file has changed since it was loaded, the next
+  get() loads it again (and the old copy goes away with its last user).
+- Only one thread loads a given path, any others asking for it at the same time
+  wait for that load instead of reading the file again.
+- When the loaded assets add up to more than the byte budget, the least recently
+  used ones that nobody is holding on to are dropped. Assets in use are never
+  dropped, so the budget can be exceeded while they're all in use.
+- Failed loads aren't cached, the next get() tries again.
+
+*/
+template <class T>
+class AssetCache
+{
+public:
+  typedef std::function<T *(const std::string &)> Loader;
+
+  AssetCache(Loader loader, size_t budget) : loader_(loader), budget_(budget), bytes_(0), next_id_(0)
+  {
+    stats_.hits = stats_.misses = stats_.evictions = 0;
+  }
+
+  // get() on a thread of its own, so something else can be loaded in the meantime
+  std::future<std::shared_ptr<T> > get_async(const std::string &path)
+  {
+    return std::async(std::launch::async, [this, path]()
+                      { return get(path); });
+  }
+
+  // NULL if the asset can't be loaded
+  std::shared_ptr<T> get(const std::string &path)
+  {
+    long long mtime = file_mtime(path);
+    std::unique_lock<std::mutex> lock(mutex_);
+    // whatever was released since the last call can go now
+    trim();
+    typename std::map<std::string, Entry>::iterator it = entries_.find(path);
+    if (it != entries_.end() && it->second.mtime == mtime)
+    {
+      stats_.hits++;
+      Entry &entry = it->second;
+      lru_.splice(lru_.begin(), lru_, entry.lru);
+      if (entry.loaded)
+      {
+        return entry.value;
+      }
+      // someone else is loading it
+      std::shared_future<std::shared_ptr<T> > pending = entry.pending;
+      lock.unlock();
+      return pending.get();
+    }
+
+    stats_.misses++;
+    if (it != entries_.end())
+    {
+      // the file has changed, forget the old one (its users still have it)
+      erase(it);
+    }
+    std::promise<std::shared_ptr<T> > promise;
+    Entry &entry = entries_[path];
+    entry.mtime = mtime;
+    entry.id = next_id_++;
+    entry.loaded = false;
+    entry.bytes = 0;
+    entry.pending = promise.get_future().share();
+    lru_.push_front(path);
+    entry.lru = lru_.begin();
+    long id = entry.id;
+    lock.unlock();
+
+    std::shared_ptr<T> value(loader_(path));
+
+    lock.lock();
+    it = entries_.find(path);
+    // it could have been reloaded again in the meantime, then that one stays
+    if (it != entries_.end() && it->second.id == id)
+    {
+      if (value)
+      {
+        it->second.loaded = true;
+        it->second.value = value;
+        it->second.pending = std::shared_future<std::shared_ptr<T> >();
+        it->second.bytes = asset_size(*value);
+        bytes_ += it->second.bytes;
+        trim();
+      }
+      else
+      {
+        erase(it);
+      }
+    }
+    lock.unlock();
+    promise.set_value(value);
+    return value;
+  }
+
+  void set_budget(size_t budget)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    budget_ = budget;
+    trim();
+  }
+
+  CacheStats stats()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    CacheStats s = stats_;
+    s.bytes = bytes_;
+    s.entries = (int)entries_.size();
+    return s;
+  }
+
+private:
+  struct Entry
+  {
+    long long mtime;
+    long id; // which load this is, in case the path was reloaded while loading
+    bool loaded;
+    size_t bytes;
+    std::shared_ptr<T> value;
+    std::shared_future<std::shared_ptr<T> > pending; // until it's loaded
+    std::list<std::string>::iterator lru;
+  };
+
+  Loader loader_;
+  std::mutex mutex_;
+  std::map<std::string, Entry> entries_;
+  std::list<std::string> lru_; // most recently used first
+  size_t budget_, bytes_;
+  long next_id_;
+  CacheStats stats_;
+
+  void erase(typename std::map<std::string, Entry>::iterator it)
+  {
+    bytes_ -= it->second.bytes;
+    lru_.erase(it->second.lru);
+    entries_.erase(it);
+  }
+
+  // with mutex_ held
+  void trim()
+  {
+    std::list<std::string>::iterator l = lru_.end();
+    while (bytes_ > budget_ && l != lru_.begin())
+    {
+      --l;
+      typename std::map<std::string, Entry>::iterator it = entries_.find(*l);
+      // only the cache has it
+      if (it->second.loaded && it->second.value.use_count() == 1)
+      {
+        ++l; // erase() invalidates the one we're on
+        erase(it);
+        stats_.evictions++;
+      }
+    }
+  }
+};
+
+#endif //__ASSETS_H__
@@ -0,0 +1,170 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "bake.h"
+
+namespace
+{
+  const float ray_offset = 1e-3f; // off the surface, so a ray doesn't hit where it starts
+
+  float next_random(unsigned &seed)
+  {
+    seed = seed * 1664525u + 1013904223u;
+    return (seed >> 8) / 16777216.0f;
+  }
+
+  // Area weighted average of the normals of the faces around every position, pointing
+  // out of the model. Zero for positions no face uses.
+  std::vector<Vec3f> vertex_normals(Model &model)
+  {
+    std::vector<Vec3f> normals(model.nverts(), Vec3f(0, 0, 0));
+    for (int f = 0; f < model.nfaces(); f++)
+    {
+      FaceIndices idx = model.tri_indices(f);
+      Vec3f v0 = model.vert(idx[0]);
+      // the faces are wound counter clockwise seen from outside
+      Vec3f n = (model.vert(idx[1]) - v0) ^ (model.vert(idx[2]) - v0);
+      for (size_t k = 0; k < idx.size(); k++)
+      {
+        normals[idx[k]] = normals[idx[k]] + n;
+      }
+    }
+    for (size_t i = 0; i < normals.size(); i++)
+    {
+      if (normals[i].norm() > 0)
+      {
+        normals[i].normalize();
+      }
+    }
+    return normals;
+  }
+
+  // Two unit vectors that make an orthonormal basis with n
+  void tangents(const Vec3f &n, Vec3f &t, Vec3f &b)
+  {
+    t = std::abs(n.x) > 0.9f ? Vec3f(0, 1, 0) ^ n : Vec3f(1, 0, 0) ^ n;
+    t.normalize();
+    b = n ^ t;
+  }
+}
+
+namespace
+{
+  // One bake, shared by the pool's tasks. A task keeps it alive, so one that only
+  // starts after every chunk is done finds nothing left and the bake has already
+  // returned without waiting for it.
+  struct BakeJob
+  {
+    static const int chunk = 64; // vertices
+
+    Model &model;
+    const BVH &bvh;
+    BakeSettings settings;
+    std::vector<Vec3f> normals;
+    std::vector<float> ao, irradiance;
+    Vec3f to_light;
+    int rays, nchunks;
+    std::atomic<int> next;
+    std::atomic<long> nrays;
+    std::mutex mutex;
+    std::condition_variable done_cv;
+    int done; // chunks, guarded by mutex
+
+    BakeJob(Model &m, const BVH &b, const BakeSettings &s)
+        : model(m), bvh(b), settings(s), normals(vertex_normals(m)), ao(m.nverts(), 1.0f), irradiance(s.irradiance ? m.nverts() : 0, 0.0f),
+          to_light(s.light_dir * -1.0f), rays(std::max(1, s.rays)), nchunks((m.nverts() + chunk - 1) / chunk), next(0), nrays(0), done(0)
+    {
+      to_light.normalize();
+    }
+
+    // Takes chunks until there are none left
+    void run()
+    {
+      int finished = 0;
+      long traced = 0;
+      for (int c = next.fetch_add(1); c < nchunks; c = next.fetch_add(1))
+      {
+        traced += bake_chunk(c);
+        finished++;
+      }
+      if (finished == 0)
+      {
+        return;
+      }
+      nrays += traced;
+      std::lock_guard<std::mutex> lock(mutex);
+      done += finished;
+      if (done == nchunks)
+      {
+        done_cv.notify_all();
+      }
+    }
+
+    // Returns the rays traced
+    long bake_chunk(int c)
+    {
+      long traced = 0;
+      int first = c * chunk, last = std::min(model.nverts(), first + chunk);
+      for (int i = first; i < last; i++)
+      {
+        const Vec3f &n = normals[i];
+        if (n.norm() == 0)
+        {
+          continue;
+        }
+        Vec3f p = model.vert(i) + n * ray_offset;
+        Vec3f t, b;
+        tangents(n, t, b);
+        unsigned seed = 2654435761u * (unsigned)(i + 1);
+        int open = 0;
+        for (int r = 0; r < rays; r++)
+        {
+          // cosine weighted: uniform on the disc, projected up onto the hemisphere,
+          // stratified along the radius
+          float u1 = (r + next_random(seed)) / rays, u2 = next_random(seed);
+          float radius = std::sqrt(u1), phi = 6.2831853f * u2;
+          Vec3f dir = t * (radius * std::cos(phi)) + b * (radius * std::sin(phi)) + n * std::sqrt(std::max(0.0f, 1 - u1));
+          open += !bvh.occluded(p, dir, settings.max_distance);
+        }
+        ao[i] = open / (float)rays;
+        traced += rays;
+        if (settings.irradiance)
+        {
+          float lit = n * to_light;
+          if (lit > 0 && !bvh.occluded(p, to_light, 1e30f))
+          {
+            irradiance[i] = lit;
+          }
+          traced++;
+        }
+      }
+      return traced;
+    }
+  };
+}
+
+void bake_lighting(Model &model, const BVH &bvh, const BakeSettings &settings, ThreadPool &pool, BakeStats &stats)
+{
+  auto start = std::chrono::steady_clock::now();
+  std::shared_ptr<BakeJob> job = std::make_shared<BakeJob>(model, bvh, settings);
+  // this thread takes chunks too, so it's as many threads as the pool has
+  for (int t = 1; t < pool.size(); t++)
+  {
+    pool.submit([job]()
+                { job->run(); });
+  }
+  job->run();
+  {
+    std::unique_lock<std::mutex> lock(job->mutex);
+    job->done_cv.wait(lock, [&job]()
+                      { return job->done == job->nchunks; });
+  }
+  model.set_baked(job->ao, job->irradiance);
+  stats.rays = job->nrays;
+  stats.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
@@ -0,0 +1,47 @@
+#ifndef __BAKE_H__
+#define __BAKE_H__
+
+#include "bvh.h"
+#include "geometry.h"
+#include "model.h"
+#include "threadpool.h"
+
+/*
+
+Baked lighting: ambient occlusion (and optionally the light from one directional light,
+shadowed) worked out once per vertex with rays against the model's BVH, and stored in
+the Model (and its .mesh file). SHADE_BAKED interpolates it across the faces like
+Gouraud shading, so it costs one varying per pixel however many rays went into it.
+
+The occlusion of a vertex is the fraction of cosine weighted rays over its hemisphere
+that get further than max_distance without hitting the model. Every vertex gets its own
+random sequence, so the result doesn't depend on how the work is split between threads.
+The vertices are baked in chunks on a ThreadPool, the same one everything else runs on,
+so baking doesn't add threads of its own.
+
+*/
+
+struct BakeSettings
+{
+  int rays;           // hemisphere rays per vertex
+  float max_distance; // anything further away doesn't occlude (the model is 2 units across)
+  bool irradiance;    // also bake the light from light_dir
+  Vec3f light_dir;    // the way the light goes, like RenderSettings::light_dir
+
+  BakeSettings() : rays(64), max_distance(0.5f), irradiance(false), light_dir(0, 0, -1) {}
+};
+
+struct BakeStats
+{
+  double ms;
+  long rays;
+
+  BakeStats() : ms(0), rays(0) {}
+};
+
+// Bakes `model` (whose BVH is `bvh`) on `pool` and stores the result in it. The calling
+// thread takes chunks too and returns once they're all done, so it can be one of the
+// pool's workers.
+void bake_lighting(Model &model, const BVH &bvh, const BakeSettings &settings, ThreadPool &pool, BakeStats &stats);
+
+#endif //__BAKE_H__
@@ -0,0 +1,341 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include "assets.h"
+#include "batch.h"
+
+struct BatchCaches
+{
+  AssetCache<MeshAsset> meshes;
+  AssetCache<MeshAsset> lod_meshes; // the same with an LODChain
+  AssetCache<TGAImage> textures;
+  AssetCache<CompressedTexture> compressed_textures;
+
+  BatchCaches(size_t budget)
+      // one BVH (and encoder) thread, the other workers are busy with other jobs
+      : meshes([](const std::string &path)
+               { return load_mesh(path, 1); },
+               budget),
+        lod_meshes([](const std::string &path)
+                   { return load_mesh(path, 1, true); },
+                   budget),
+        textures(load_texture, budget),
+        compressed_textures([](const std::string &path)
+                            { return CompressedTexture::load(path, 1); },
+                            budget) {}
+};
+
+namespace
+{
+  // jobs up to this many pixels are rendered whole, bigger ones in bands about this size
+  const int tile_pixels = 512 * 512;
+
+  // One job while it's being rendered. The last band to finish writes the image
+  // and deletes the job.
+  struct JobState
+  {
+    BatchJob job;
+    BatchRenderer::Callback done;
+    ThreadPool &pool;
+    BatchCaches &assets;
+    // held until the job's done, so they can't be evicted under it
+    std::shared_ptr<MeshAsset> mesh;
+    std::shared_ptr<TGAImage> texture;
+    std::shared_ptr<CompressedTexture> compressed_texture;
+    RenderSettings settings;
+    TGAImage image;
+    Arena arena; // the frame's zbuffer and shadow map
+    Frame *frame;
+    int nbands, band_height;
+    std::atomic<int> bands_left;
+    std::chrono::steady_clock::time_point start;
+
+    JobState(const BatchJob &j, BatchRenderer::Callback d, ThreadPool &p, BatchCaches &assets)
+        : job(j), done(d), pool(p), assets(assets), settings(j.settings), image(), arena(0), frame(NULL), nbands(1), band_height(j.height), bands_left(0) {}
+
+    ~JobState() { delete frame; }
+
+    void report(bool ok, const char *error, TGAImage *result = NULL)
+    {
+      std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+      BatchResult r = {ok, error, nbands, elapsed.count(), result};
+      done(r);
+    }
+
+    void band_range(int band, int &y0, int &y1)
+    {
+      y0 = band * band_height;
+      y1 = std::min(job.height, y0 + band_height);
+    }
+
+    // Every band of `pass` as its own task, then `next` once they're all done
+    void run_bands(void (JobState::*pass)(int), void (JobState::*next)())
+    {
+      bands_left = nbands;
+      for (int b = 1; b < nbands; b++)
+      {
+        pool.submit([this, b, pass, next]()
+                    { run_band(pass, next, b); });
+      }
+      // the first one here, no point queueing it
+      run_band(pass, next, 0);
+    }
+
+    void run_band(void (JobState::*pass)(int), void (JobState::*next)(), int band)
+    {
+      (this->*pass)(band);
+      if (--bands_left == 0)
+      {
+        (this->*next)();
+      }
+    }
+
+    void start_job()
+    {
+      start = std::chrono::steady_clock::now();
+      // the texture loads on another thread while this one loads the model, and if
+      // another job is loading the same file, this waits for it
+      std::future<std::shared_ptr<TGAImage> > pending_texture;
+      std::future<std::shared_ptr<CompressedTexture> > pending_compressed;
+      if (settings.compress_texture)
+        pending_compressed = assets.compressed_textures.get_async(job.texture);
+      else
+        pending_texture = assets.textures.get_async(job.texture);
+      mesh = job.lod ? assets.lod_meshes.get(job.model) : assets.meshes.get(job.model);
+      if (pending_compressed.valid())
+      {
+        compressed_texture = pending_compressed.get();
+        settings.compressed_texture = compressed_texture.get();
+      }
+      else
+        texture = pending_texture.get();
+      if (!mesh)
+      {
+        report(false, "can't load model");
+        delete this;
+        return;
+      }
+      if (!texture && !compressed_texture)
+      {
+        report(false, "can't load texture");
+        delete this;
+        return;
+      }
+      image = TGAImage(job.width, job.height, TGAImage::RGB);
+      frame = new Frame(mesh->model, mesh->bvh, texture.get(), settings, image, arena);
+      if (mesh->lods)
+        frame->set_lods(mesh->lods);
+      long pixels = (long)job.width * job.height;
+      if (pixels > tile_pixels)
+      {
+        nbands = (int)((pixels + tile_pixels - 1) / tile_pixels);
+        band_height = (job.height + nbands - 1) / nbands;
+        nbands = (job.height + band_height - 1) / band_height;
+      }
+      if (frame->has_shadows())
+        run_bands(&JobState::shadow_band, &JobState::start_render);
+      else
+        start_render();
+    }
+
+    void shadow_band(int band)
+    {
+      int y0, y1;
+      band_range(band, y0, y1);
+      frame->shadow_pass(y0, y1);
+    }
+
+    void start_render()
+    {
+      run_bands(&JobState::render_band, &JobState::finish);
+    }
+
+    void render_band(int band)
+    {
+      int y0, y1;
+      band_range(band, y0, y1);
+      // bands of different jobs take turns on a worker, each starts from an empty arena
+      static thread_local Arena scratch;
+      frame->render(y0, y1, scratch);
+      scratch.reset();
+    }
+
+    void finish()
+    {
+      delete frame;
+      frame = NULL;
+      image.flip_vertically();
+      if (job.output == "-")
+        report(true, NULL, &image);
+      else if (image.write_tga_file(job.output.c_str()))
+        report(true, NULL);
+      else
+        report(false, "can't write output");
+      delete this;
+    }
+  };
+
+  void print_cache(const char *name, CacheStats stats, std::ostream &out)
+  {
+    out << "{\"cache\": \"" << name << "\", \"hits\": " << stats.hits << ", \"misses\": " << stats.misses
+        << ", \"evictions\": " << stats.evictions << ", \"entries\": " << stats.entries << ", \"bytes\": " << stats.bytes << "}" << std::endl;
+  }
+
+  bool parse_option(const std::string &option, RenderSettings &settings)
+  {
+    size_t eq = option.find('=');
+    std::string key = option.substr(0, eq);
+    std::string value = eq == std::string::npos ? "" : option.substr(eq + 1);
+    if (key == "zoom" && !value.empty())
+      settings.zoom = atof(value.c_str());
+    else if (key == "shading" && !value.empty())
+      settings.shading = shading_from_name(value.c_str());
+    else if (key == "light")
+      return sscanf(value.c_str(), "%f,%f,%f", &settings.light_dir.x, &settings.light_dir.y, &settings.light_dir.z) == 3;
+    else if (key == "depth")
+      return depth_format_from_name(value.c_str(), settings.depth_format);
+    else if (key == "opacity" && !value.empty())
+      settings.opacity = std::max(0.0f, std::min(1.0f, (float)atof(value.c_str())));
+    else if (key == "bc1" && eq == std::string::npos)
+      settings.compress_texture = true;
+    else if (key == "z-prepass" && eq == std::string::npos)
+      settings.z_prepass = true;
+    else if (key == "shadows" && eq == std::string::npos)
+      settings.shadows = true;
+    else
+      return false;
+    return true;
+  }
+}
+
+std::string json_string(const std::string &s)
+{
+  std::string quoted = "\"";
+  for (size_t i = 0; i < s.size(); i++)
+  {
+    unsigned char c = s[i];
+    if (c == '"' || c == '\\')
+    {
+      quoted += '\\';
+      quoted += c;
+    }
+    else if (c < 0x20)
+    {
+      char escaped[8];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      quoted += escaped;
+    }
+    else
+      quoted += c;
+  }
+  return quoted + "\"";
+}
+
+bool parse_job(const std::string &line, BatchJob &job)
+{
+  std::istringstream iss(line);
+  bool ok = (bool)(iss >> job.model >> job.texture >> job.width >> job.height >> job.output) && job.width > 0 && job.height > 0;
+  std::string option;
+  while (ok && iss >> option)
+  {
+    if (option == "lod")
+      job.lod = true;
+    else
+      ok = parse_option(option, job.settings);
+  }
+  return ok;
+}
+
+bool read_manifest(const char *filename, std::vector<BatchJob> &jobs)
+{
+  std::ifstream in(filename);
+  if (!in.is_open())
+  {
+    std::cerr << "can't open file " << filename << "\n";
+    return false;
+  }
+  std::string line;
+  int line_number = 0;
+  while (std::getline(in, line))
+  {
+    line_number++;
+    std::istringstream iss(line);
+    std::string first;
+    if (!(iss >> first) || first[0] == '#')
+    {
+      continue;
+    }
+    BatchJob job;
+    if (!parse_job(line, job))
+    {
+      std::cerr << filename << ":" << line_number << ": bad job: " << line << "\n";
+      return false;
+    }
+    jobs.push_back(job);
+  }
+  return true;
+}
+
+BatchRenderer::BatchRenderer(int threads, size_t cache_budget) : caches_(new BatchCaches(cache_budget)), pool_(threads) {}
+
+BatchRenderer::~BatchRenderer()
+{
+  // the jobs still need the caches
+  pool_.wait();
+  delete caches_;
+}
+
+void BatchRenderer::submit(const BatchJob &job, Callback done)
+{
+  JobState *state = new JobState(job, done, pool_, *caches_);
+  pool_.submit([state]()
+               { state->start_job(); });
+}
+
+void BatchRenderer::wait()
+{
+  pool_.wait();
+}
+
+void BatchRenderer::print_cache_stats(std::ostream &out)
+{
+  print_cache("meshes", caches_->meshes.stats(), out);
+  print_cache("lod meshes", caches_->lod_meshes.stats(), out);
+  print_cache("textures", caches_->textures.stats(), out);
+  print_cache("compressed textures", caches_->compressed_textures.stats(), out);
+}
+
+int run_batch(const std::vector<BatchJob> &jobs, int threads, size_t cache_budget, std::ostream &out)
+{
+  BatchRenderer renderer(threads, cache_budget);
+  std::mutex mutex;
+  int failed = 0;
+  auto report = [&](size_t i, const BatchResult &result)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    out << "{\"job\": " << i << ", \"output\": " << json_string(jobs[i].output) << ", \"ok\": " << (result.ok ? "true" : "false");
+    if (result.error)
+    {
+      out << ", \"error\": " << json_string(result.error);
+    }
+    out << ", \"bands\": " << result.bands << ", \"ms\": " << result.ms << "}" << std::endl;
+    if (!result.ok)
+    {
+      failed++;
+    }
+  };
+  for (size_t i = 0; i < jobs.size(); i++)
+  {
+    renderer.submit(jobs[i], [&report, i](const BatchResult &result)
+                    { report(i, result); });
+  }
+  renderer.wait();
+
+  renderer.print_cache_stats(out);
+  return failed;
+}
@@ -0,0 +1,110 @@
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "render.h"
+#include "threadpool.h"
+
+/*
+
+Batch mode: renders every job of a manifest on one work-stealing thread pool.
+
+The manifest has one job per line, blank lines and lines starting with '#' are skipped:
+
+  model texture width height output [zoom=f] [shading=flat|gouraud|phong|baked|texture]
+                                    [light=x,y,z] [depth=float|unorm24|unorm16]
+                                    [z-prepass] [shadows] [bc1] [opacity=a] [lod]
+
+e.g.
+
+  ./head.obj african_head_diffuse.tga 800 800 out/head.tga shading=phong
+
+An output of `-` isn't written anywhere, the render server (server.h) sends the
+image back instead.
+
+`bc1` samples a block compressed copy of the texture (see texture.h), which is cached
+on disk next to it.
+
+`lod` draws the model with the level of its LOD chain (see simplify.h) that suits its
+size on screen. The chain is built once per model and cached separately from the
+model without it.
+
+`shading=baked` uses the lighting baked into a .mesh model (main --bake ... --write-mesh,
+see bake.h). Nothing is baked here, a model without a bake comes out unlit.
+
+Models (with their BVH) and textures come from an AssetCache per kind, each
+allowed cache_budget bytes, so every file is only read once while it stays in the
+cache. Small jobs are rendered whole by one worker, and jobs bigger than tile_pixels
+are split into bands of rows that any worker can pick up. Each job is written out as
+soon as its last band is done, and reported on `out` as one JSON object per line, in
+whatever order they finish. The caches' hit/miss/eviction counts come last.
+
+*/
+
+struct BatchJob
+{
+  std::string model;
+  std::string texture;
+  int width, height;
+  std::string output;
+  RenderSettings settings;
+  bool lod; // pick a simplified level by screen size
+
+  BatchJob() : width(0), height(0), lod(false) {}
+};
+
+// How a job went, see BatchRenderer::submit()
+struct BatchResult
+{
+  bool ok;
+  const char *error; // what went wrong, NULL if it's ok
+  int bands;
+  double ms;       // since a worker picked it up
+  TGAImage *image; // for output "-" only: the image, flipped and ready to write
+};
+
+struct BatchCaches; // an AssetCache per kind, see batch.cpp
+
+// The workers and caches behind run_batch(), kept around so the render server
+// (server.h) can keep feeding jobs to the same ones.
+class BatchRenderer
+{
+public:
+  typedef std::function<void(const BatchResult &)> Callback;
+
+  // 0 threads means one per core
+  BatchRenderer(int threads, size_t cache_budget);
+  // waits for every job that's been submitted
+  ~BatchRenderer();
+
+  // Renders a copy of `job` and calls `done` on the worker that finishes it. A job
+  // whose output is "-" isn't written anywhere, its image is only valid in `done`.
+  void submit(const BatchJob &job, Callback done);
+  // Blocks until every job submitted so far is done
+  void wait();
+  int threads() { return pool_.size(); }
+  // One JSON object per cache
+  void print_cache_stats(std::ostream &out);
+
+private:
+  BatchCaches *caches_;
+  ThreadPool pool_;
+};
+
+// Parses one manifest line (that isn't blank or a comment), false if it's bad
+bool parse_job(const std::string &line, BatchJob &job);
+
+// Appends the jobs in `filename` to `jobs`. Prints the bad line and returns false
+// if something can't be parsed.
+bool read_manifest(const char *filename, std::vector<BatchJob> &jobs);
+
+// Returns the number of jobs that failed
+int run_batch(const std::vector<BatchJob> &jobs, int threads, size_t cache_budget, std::ostream &out);
+
+// `s` as a quoted JSON string, for the outputs and errors in the reports
+std::string json_string(const std::string &s);
+
+#endif //__BATCH_H__
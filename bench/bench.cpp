@@ -0,0 +1,930 @@
+// Benchmarks for every stage of the pipeline: draw_line, triangle(), vertex
+// transforms, whole frames, Model loading and TGA reading/writing, on synthetic
+// meshes with a given triangle count, triangle size (in pixels) and resolution.
+//
+// Every result is printed as one JSON object per line, so runs can be saved and
+// compared to catch regressions (`make bench` writes them to bench_output.txt).
+// `make regress` checks a fixed set of scenes against golden images and a timing
+// baseline, see regress() below.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "arena.h"
+#include "bake.h"
+#include "bvh.h"
+#include "geometry.h"
+#include "incremental.h"
+#include "model.h"
+#include "rasterizer.h"
+#include "render.h"
+#include "shaders.h"
+#include "texture.h"
+#include "tgaimage.h"
+
+// One line of output
+class Result
+{
+    std::ostringstream s_;
+    bool first_;
+
+public:
+    Result(const char *bench) : first_(true)
+    {
+        s_ << "{";
+        add("bench", bench);
+    }
+    Result &add(const char *key, const char *value)
+    {
+        s_ << (first_ ? "" : ", ") << "\"" << key << "\": \"" << value << "\"";
+        first_ = false;
+        return *this;
+    }
+    Result &add(const char *key, double value)
+    {
+        s_ << (first_ ? "" : ", ") << "\"" << key << "\": " << value;
+        first_ = false;
+        return *this;
+    }
+    ~Result()
+    {
+        std::cout << s_.str() << "}" << std::endl;
+    }
+};
+
+// Every new/new[] in the program goes through here, so a benchmark can tell how
+// many heap allocations the code it times makes
+std::atomic<long> allocations(0);
+
+void *operator new(size_t size)
+{
+    allocations++;
+    void *p = malloc(size);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+// GCC inlines these into callers, then sees free() on a pointer from operator new
+// and warns, though our operator new is malloc()
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+
+double now()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Best of `reps` runs of f, in seconds, calling setup (untimed) before each one.
+// The minimum is the least noisy estimate of what the code itself costs.
+template <class S, class F>
+double best_time(int reps, S setup, F f)
+{
+    double best = std::numeric_limits<double>::max();
+    for (int i = 0; i < reps; i++)
+    {
+        setup();
+        double start = now();
+        f();
+        best = std::min(best, now() - start);
+    }
+    return best;
+}
+
+template <class F>
+double best_time(int reps, F f)
+{
+    return best_time(reps, []() {}, f);
+}
+
+float frand(unsigned &seed)
+{
+    seed = seed * 1664525u + 1013904223u;
+    return (seed >> 8) / 16777216.0f;
+}
+
+// Model units covered by one pixel with the default camera (the model's [-1, 1]
+// fills the middle 3/4 of the image)
+float units_per_pixel(int res)
+{
+    return 2.0f / (res * 3.0f / 4.0f);
+}
+
+// `ntris` independent triangles, roughly `size` pixels across at resolution `res`,
+// scattered over the screen, all facing the camera.
+Model *synthetic_mesh(int ntris, float size, int res, unsigned seed)
+{
+    std::vector<Vec3f> verts;
+    std::vector<Vec2f> uvs;
+    std::vector<Vec3f> norms(1, Vec3f(0, 0, 1));
+    std::vector<Triangle> tris(ntris);
+    float r = size * units_per_pixel(res) / 2.0f;
+    for (int i = 0; i < ntris; i++)
+    {
+        Vec3f c(frand(seed) * 2.0f - 1.0f, frand(seed) * 2.0f - 1.0f, frand(seed) - 0.5f);
+        float angle = frand(seed) * 6.2831853f;
+        for (int j = 0; j < 3; j++)
+        {
+            // counter clockwise, so the face points at the camera
+            float a = angle + j * 2.0943951f;
+            verts.push_back(Vec3f(c.x + r * std::cos(a), c.y + r * std::sin(a), c.z));
+            uvs.push_back(Vec2f(frand(seed), frand(seed)));
+            tris[i].pos_indices.push_back(3 * i + j);
+            tris[i].tex_indices.push_back(3 * i + j);
+            tris[i].norm_indices.push_back(0);
+        }
+    }
+    return new Model(verts, uvs, norms, tris);
+}
+
+// A flat grid of quads x quads squares, each quad_pixels across at resolution `res`,
+// in the middle of the screen at z = 0 (where the camera doesn't scale anything) so
+// its corners land right on pixels. Every uv is the same, so it's one color all over.
+Model *flat_grid(int quads, int quad_pixels, int res)
+{
+    std::vector<Vec3f> verts;
+    std::vector<Vec2f> uvs(1, Vec2f(0.5f, 0.5f));
+    std::vector<Vec3f> norms(1, Vec3f(0, 0, 1));
+    std::vector<Triangle> tris;
+    float step = quad_pixels * units_per_pixel(res), start = -quads * step / 2;
+    for (int j = 0; j <= quads; j++)
+        for (int i = 0; i <= quads; i++)
+            verts.push_back(Vec3f(start + i * step, start + j * step, 0));
+    for (int j = 0; j < quads; j++)
+    {
+        for (int i = 0; i < quads; i++)
+        {
+            int a = j * (quads + 1) + i, b = a + 1, c = b + quads + 1, d = a + quads + 1;
+            // two counter clockwise triangles sharing the a-c diagonal
+            int corners[2][3] = {{a, b, c}, {a, c, d}};
+            for (int t = 0; t < 2; t++)
+            {
+                Triangle tri;
+                tri.pos_indices.assign(corners[t], corners[t] + 3);
+                tri.tex_indices.assign(3, 0);
+                tri.norm_indices.assign(3, 0);
+                tris.push_back(tri);
+            }
+        }
+    }
+    return new Model(verts, uvs, norms, tris);
+}
+
+Mat4 camera_transform(int res)
+{
+    // the same camera as main, so depths land in its near/far range
+    return camera_transform(res, res, 1.0f);
+}
+
+TGAImage checker_texture(int size)
+{
+    TGAImage texture(size, size, TGAImage::RGB);
+    for (int y = 0; y < size; y++)
+        for (int x = 0; x < size; x++)
+            texture.set(x, y, ((x / 16 + y / 16) % 2) ? TGAColor(200, 120, 80, 255) : TGAColor(40, 60, 90, 255));
+    return texture;
+}
+
+void reset_zbuffer(std::vector<float> &zbuffer)
+{
+    std::fill(zbuffer.begin(), zbuffer.end(), 0.0f);
+}
+
+// Counts the pixels that pass the depth test, to turn times into pixel rates
+struct CountShader
+{
+    static const int nvaryings = 0;
+    long pixels;
+    CountShader() : pixels(0) {}
+    inline bool fragment(const float *, TGAColor &color)
+    {
+        pixels++;
+        return true;
+    }
+};
+
+// Flat color, no varyings: the cost of the rasterizer loop itself
+struct SolidShader
+{
+    static const int nvaryings = 0;
+    inline bool fragment(const float *, TGAColor &color)
+    {
+        color = TGAColor(255, 255, 255, 255);
+        return true;
+    }
+};
+
+void bench_lines(int res, int length, int reps)
+{
+    TGAImage image(res, res, TGAImage::RGB);
+    unsigned seed = 1;
+    const int nlines = 20000;
+    std::vector<int> coords(4 * nlines);
+    long pixels = 0;
+    for (int i = 0; i < nlines; i++)
+    {
+        int x0 = (int)(frand(seed) * (res - length)), y0 = (int)(frand(seed) * (res - length));
+        int dx = (int)(frand(seed) * length), dy = (int)(frand(seed) * length);
+        coords[4 * i] = x0;
+        coords[4 * i + 1] = y0;
+        coords[4 * i + 2] = x0 + dx;
+        coords[4 * i + 3] = y0 + dy;
+        pixels += std::max(dx, dy) + 1;
+    }
+    TGAColor white(255, 255, 255, 255);
+    double t = best_time(reps, [&]()
+                         {
+        for (int i = 0; i < nlines; i++)
+            draw_line(coords[4 * i], coords[4 * i + 1], coords[4 * i + 2], coords[4 * i + 3], image, white); });
+    Result("draw_line").add("res", res).add("length", length).add("lines", nlines)
+        .add("ns_per_line", t * 1e9 / nlines).add("mpixels_per_s", pixels / t / 1e6);
+}
+
+void bench_triangles(int ntris, float size, int res, TGAImage &texture, int reps)
+{
+    Model *mesh = synthetic_mesh(ntris, size, res, 7);
+    Mat4 transform = camera_transform(res);
+    TGAImage image(res, res, TGAImage::RGB);
+    std::vector<float> zbuffer(res * res);
+    std::vector<int> faces(ntris);
+    for (int i = 0; i < ntris; i++)
+        faces[i] = i;
+
+    // screen coords up front, so the micro benchmark only measures triangle()
+    std::vector<Vec3f> screen(3 * ntris);
+    std::vector<float> rhw(3 * ntris);
+    for (int i = 0; i < ntris; i++)
+        for (int j = 0; j < 3; j++)
+            screen[3 * i + j] = transform.project(mesh->vert(mesh->tri_indices(i)[j]), rhw[3 * i + j]);
+
+    CountShader counter;
+    float no_varyings[3][1];
+    reset_zbuffer(zbuffer);
+    for (int i = 0; i < ntris; i++)
+        triangle<false>(&screen[3 * i], &rhw[3 * i], no_varyings, counter, zbuffer.data(), image, 0, res);
+
+    SolidShader solid;
+    auto clear = [&]()
+    { reset_zbuffer(zbuffer); };
+    double t_raster = best_time(reps, clear, [&]()
+                                {
+        for (int i = 0; i < ntris; i++)
+            triangle<false>(&screen[3 * i], &rhw[3 * i], no_varyings, solid, zbuffer.data(), image, 0, res); });
+    Result("triangle").add("shader", "solid").add("tris", ntris).add("size", size).add("res", res)
+        .add("pixels", (double)counter.pixels)
+        .add("ns_per_tri", t_raster * 1e9 / ntris).add("mpixels_per_s", counter.pixels / t_raster / 1e6);
+
+    // macro: the whole draw() with vertex fetch, transform and texturing
+    TextureShader textured(mesh, &texture, transform, Vec3f(0, 0, -1));
+    double t_draw = best_time(reps, clear, [&]()
+                              { draw(textured, faces, zbuffer.data(), image); });
+    Result("draw").add("shader", "texture").add("tris", ntris).add("size", size).add("res", res)
+        .add("pixels", (double)counter.pixels)
+        .add("ns_per_tri", t_draw * 1e9 / ntris).add("mpixels_per_s", counter.pixels / t_draw / 1e6);
+    delete mesh;
+}
+
+void bench_transform(int nverts, int reps)
+{
+    unsigned seed = 3;
+    std::vector<Vec3f> verts(nverts);
+    for (int i = 0; i < nverts; i++)
+        verts[i] = Vec3f(frand(seed) * 2 - 1, frand(seed) * 2 - 1, frand(seed) * 2 - 1);
+    Matrix Projection = Matrix::identity(4);
+    Projection[3][2] = -1.f / 3.0f;
+    Matrix Viewport = viewport(100, 100, 600, 600);
+    std::vector<Vec3f> out(nverts);
+
+    // the original per-vertex path, through heap allocated Matrix temporaries
+    int nmatrix = std::min(nverts, 100000);
+    double t_matrix = best_time(reps, [&]()
+                                {
+        for (int i = 0; i < nmatrix; i++)
+            out[i] = matrix_to_vector(Viewport * Projection * vector_to_matrix(verts[i])); });
+    Result("transform").add("path", "Matrix").add("verts", nmatrix)
+        .add("ns_per_vert", t_matrix * 1e9 / nmatrix);
+
+    Mat4 m(Viewport * Projection);
+    double t_mat4 = best_time(reps, [&]()
+                              {
+        for (int i = 0; i < nverts; i++)
+            out[i] = m.project(verts[i]); });
+    Result("transform").add("path", "Mat4").add("verts", nverts)
+        .add("ns_per_vert", t_mat4 * 1e9 / nverts);
+}
+
+long file_size(const char *filename)
+{
+    FILE *f = fopen(filename, "rb");
+    if (!f)
+        return 0;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fclose(f);
+    return size;
+}
+
+void bench_model_load(int ntris, int reps)
+{
+    const char *obj = "bench_tmp.obj";
+    const char *mesh = "bench_tmp.mesh";
+    Model *m = synthetic_mesh(ntris, 4, 1024, 11);
+    m->write_obj(obj);
+    m->write_binary(mesh);
+    delete m;
+
+    const char *files[2] = {obj, mesh};
+    const char *formats[2] = {"obj", "mesh"};
+    for (int i = 0; i < 2; i++)
+    {
+        double t = best_time(reps, [&]()
+                             { Model loaded(files[i]); });
+        long bytes = file_size(files[i]);
+        Result("model_load").add("format", formats[i]).add("tris", ntris).add("bytes", (double)bytes)
+            .add("ms", t * 1e3).add("mb_per_s", bytes / t / 1e6).add("ns_per_tri", t * 1e9 / ntris);
+    }
+    std::remove(obj);
+    std::remove(mesh);
+}
+
+void bench_tga(int res, int reps)
+{
+    // a rendered frame, so the RLE encoder sees realistic runs
+    TGAImage texture = checker_texture(256);
+    Model *scene = synthetic_mesh(2000, 20, res, 5);
+    std::vector<int> faces(scene->nfaces());
+    for (int i = 0; i < scene->nfaces(); i++)
+        faces[i] = i;
+    TGAImage image(res, res, TGAImage::RGB);
+    std::vector<float> zbuffer(res * res);
+    reset_zbuffer(zbuffer);
+    TextureShader shader(scene, &texture, camera_transform(res), Vec3f(0, 0, -1));
+    draw(shader, faces, zbuffer.data(), image);
+    delete scene;
+
+    const char *filename = "bench_tmp.tga";
+    double raw_bytes = (double)res * res * image.get_bytespp();
+    for (int rle = 0; rle < 2; rle++)
+    {
+        double t_write = best_time(reps, [&]()
+                                   { image.write_tga_file(filename, rle); });
+        long bytes = file_size(filename);
+        TGAImage loaded;
+        double t_read = best_time(reps, [&]()
+                                  { loaded.read_tga_file(filename); });
+        Result("write_tga_file").add("res", res).add("rle", rle ? "true" : "false").add("file_bytes", (double)bytes)
+            .add("ms", t_write * 1e3).add("mb_per_s", raw_bytes / t_write / 1e6);
+        Result("read_tga_file").add("res", res).add("rle", rle ? "true" : "false").add("file_bytes", (double)bytes)
+            .add("ms", t_read * 1e3).add("mb_per_s", raw_bytes / t_read / 1e6);
+    }
+    std::remove(filename);
+}
+
+void bench_frame(int ntris, float size, int res, TGAImage &texture, int reps)
+{
+    // Whole frames through Frame, the way main and batch mode render. With the
+    // arena kept between frames the steady state shouldn't allocate at all.
+    Model *mesh = synthetic_mesh(ntris, size, res, 11);
+    BVH bvh(*mesh, 1);
+    TGAImage image(res, res, TGAImage::RGB);
+    Arena arena;
+    CompressedTexture compressed(texture);
+    // for "baked", which should cost about what gouraud does however many rays went in
+    BakeSettings bake;
+    bake.rays = 16;
+    bake.irradiance = true;
+    BakeStats bake_stats;
+    ThreadPool pool;
+    bake_lighting(*mesh, bvh, bake, pool, bake_stats);
+    Result("bake").add("tris", ntris).add("size", size).add("rays", (double)bake_stats.rays).add("ms", bake_stats.ms);
+    // the same mesh in 16 bits, for "texture+quantized"
+    Model *quantized = synthetic_mesh(ntris, size, res, 11);
+    QuantizeStats quantize_stats;
+    quantized->quantize(quantize_stats);
+    BVH quantized_bvh(*quantized, 1);
+    Result("quantize").add("tris", ntris).add("bytes_before", (double)quantize_stats.bytes_before)
+        .add("bytes_after", (double)quantize_stats.bytes_after).add("max_position_error", quantize_stats.max_position_error)
+        .add("max_uv_error", quantize_stats.max_uv_error);
+    const char *names[8] = {"texture", "phong+z-prepass", "shadows", "texture+unorm24", "texture+unorm16", "texture+bc1", "baked",
+                            "texture+quantized"};
+    for (int v = 0; v < 8; v++)
+    {
+        RenderSettings settings;
+        if (v == 1)
+        {
+            settings.shading = SHADE_PHONG;
+            settings.z_prepass = true;
+        }
+        settings.shadows = v == 2;
+        if (v == 3)
+            settings.depth_format = DEPTH_UNORM24;
+        if (v == 4)
+            settings.depth_format = DEPTH_UNORM16;
+        if (v == 5)
+            settings.compressed_texture = &compressed;
+        if (v == 6)
+            settings.shading = SHADE_BAKED;
+        Model *m = v == 7 ? quantized : mesh;
+        BVH *b = v == 7 ? &quantized_bvh : &bvh;
+        auto frame = [&]()
+        {
+            Frame f(m, b, &texture, settings, image, arena);
+            f.shadow_pass(0, res);
+            f.render(0, res, arena);
+            arena.reset();
+        };
+        // the first frame sizes the arena
+        frame();
+        const int frames = 5;
+        long before = allocations;
+        for (int i = 0; i < frames; i++)
+            frame();
+        double allocs_per_frame = (allocations - before) / (double)frames;
+        double t = best_time(reps, frame);
+        Result("frame").add("shading", names[v]).add("tris", ntris).add("size", size).add("res", res)
+            .add("ms", t * 1e3).add("allocs_per_frame", allocs_per_frame).add("arena_bytes", (double)arena.capacity());
+    }
+    delete quantized;
+    delete mesh;
+}
+
+void bench_instances(int ninstances, int res, TGAImage &texture, int reps)
+{
+    // Copies of one small mesh spread over a grid, through Frame's instanced passes.
+    // The arena shouldn't grow with the number of copies.
+    Model *mesh = synthetic_mesh(500, 10, res, 13);
+    BVH bvh(*mesh, 1);
+    TGAImage image(res, res, TGAImage::RGB);
+    Arena arena;
+    int side = (int)std::ceil(std::sqrt((float)ninstances));
+    std::vector<Mat4> instances;
+    for (int i = 0; i < ninstances; i++)
+    {
+        Vec3f position((i % side + 0.5f) * 2.0f / side - 1.0f, (i / side + 0.5f) * 2.0f / side - 1.0f, 0);
+        instances.push_back(instance_transform(position, i * 7.0f, 1.0f / side));
+    }
+    RenderSettings settings;
+    auto frame = [&]()
+    {
+        Frame f(mesh, &bvh, &texture, settings, image, arena, instances.data(), ninstances);
+        f.render(0, res, arena);
+        arena.reset();
+    };
+    frame();
+    long before = allocations;
+    frame();
+    double allocs_per_frame = (double)(allocations - before);
+    double t = best_time(reps, frame);
+    Result("instances").add("instances", ninstances).add("tris", ninstances * mesh->nfaces()).add("res", res)
+        .add("ms", t * 1e3).add("allocs_per_frame", allocs_per_frame).add("arena_bytes", (double)arena.capacity());
+    delete mesh;
+}
+
+void bench_incremental(int ninstances, int res, TGAImage &texture, int reps)
+{
+    // An IncrementalFrame of copies on a grid: a whole frame, then small edits that
+    // only redraw the bands they touch. Each result is checked against a whole frame.
+    Model *mesh = synthetic_mesh(500, 10, res, 13);
+    BVH bvh(*mesh, 1);
+    int side = (int)std::ceil(std::sqrt((float)ninstances));
+    std::vector<Mat4> instances;
+    for (int i = 0; i < ninstances; i++)
+    {
+        Vec3f position((i % side + 0.5f) * 2.0f / side - 1.0f, (i / side + 0.5f) * 2.0f / side - 1.0f, 0);
+        instances.push_back(instance_transform(position, i * 7.0f, 1.0f / side));
+    }
+    RenderSettings settings;
+    Arena scratch;
+    IncrementalFrame incremental(mesh, &bvh, &texture, settings, res, res, instances);
+    int bands = 0;
+    double t_full = best_time(reps, [&]()
+                              { incremental.set_light(settings.light_dir); bands = incremental.update(scratch); });
+    Result("incremental").add("edit", "full").add("instances", ninstances).add("res", res).add("ms", t_full * 1e3)
+        .add("bands", bands).add("of", incremental.nbands());
+
+    auto matches = [&](IncrementalFrame &frame)
+    {
+        TGAImage image(res, res, TGAImage::RGB);
+        Arena arena;
+        Frame f(mesh, &bvh, &texture, settings, image, arena, instances.data(), ninstances);
+        f.render(0, res, arena);
+        return !memcmp(image.buffer(), frame.image().buffer(), (size_t)res * res * 3);
+    };
+
+    // one copy nudged back and forth
+    int moved = ninstances / 2;
+    Mat4 home = instances[moved];
+    int step = 0;
+    double t_move = best_time(reps, [&]()
+                              {
+                                  instances[moved] = home;
+                                  if (++step % 2)
+                                      instances[moved].m[0][3] += 0.5f / side;
+                                  incremental.move_instance(moved, instances[moved]);
+                                  bands = incremental.update(scratch); });
+    Result("incremental").add("edit", "move").add("instances", ninstances).add("res", res).add("ms", t_move * 1e3)
+        .add("bands", bands).add("of", incremental.nbands()).add("matches", matches(incremental) ? 1 : 0);
+
+    // a 16x16 texel patch flipped, every face's uvs are random so this reaches a few
+    int x0 = texture.get_width() / 3, y0 = texture.get_height() / 3;
+    double t_texture = best_time(reps, [&]()
+                                 {
+                                     for (int y = y0; y < y0 + 16; y++)
+                                         for (int x = x0; x < x0 + 16; x++)
+                                         {
+                                             TGAColor c = texture.get(x, y);
+                                             texture.set(x, y, TGAColor(255 - c.r, 255 - c.g, 255 - c.b, 255));
+                                         }
+                                     incremental.texture_changed(x0, y0, x0 + 16, y0 + 16);
+                                     bands = incremental.update(scratch); });
+    Result("incremental").add("edit", "texture").add("instances", ninstances).add("res", res).add("ms", t_texture * 1e3)
+        .add("bands", bands).add("of", incremental.nbands()).add("matches", matches(incremental) ? 1 : 0);
+
+    // the same move see-through, where the redrawn bands' A-buffer fragments have to go too
+    settings.opacity = 0.5f;
+    IncrementalFrame transparent(mesh, &bvh, &texture, settings, res, res, instances);
+    transparent.update(scratch);
+    double t_transparent = best_time(reps, [&]()
+                                     {
+                                         instances[moved] = home;
+                                         if (++step % 2)
+                                             instances[moved].m[0][3] += 0.5f / side;
+                                         transparent.move_instance(moved, instances[moved]);
+                                         bands = transparent.update(scratch); });
+    Result("incremental").add("edit", "move").add("opacity", settings.opacity).add("instances", ninstances).add("res", res)
+        .add("ms", t_transparent * 1e3).add("bands", bands).add("of", transparent.nbands()).add("matches", matches(transparent) ? 1 : 0);
+    delete mesh;
+}
+
+// --regress: a fixed set of scenes, each checked against its golden image and timed
+// against a stored baseline. Exits with 1 if an image changed, a scene got slower or
+// a frame touched the heap (everything a frame needs comes out of its arena, which
+// is kept from one frame to the next).
+//
+// The goldens (bench/golden/<scene>.tga) are committed, so any change to the output
+// shows up. An image passes if it's byte for byte the golden, or within
+// pixel_tolerance per channel on at most changed_fraction of its pixels (e.g. a
+// different compiler rounding a few floats the other way).
+//
+// Timings only mean something on the machine they were taken on, so the baseline
+// (bench/golden/timings.txt) isn't committed: `make regress-update` before a change,
+// `make regress` after. Every scene is timed `reps` times and summarized by its
+// median and median absolute deviation. A scene is slower if its median is more than
+// `slowdown` above the baseline's and the difference is also well outside the noise
+// of both runs, so one busy moment doesn't fail the gate.
+
+const int regress_res = 256;
+const int pixel_tolerance = 2;
+const double changed_fraction = 0.001;
+
+// A scene of the regression set
+struct Scene
+{
+    std::string name;
+    Model *mesh; // shared between scenes
+    RenderSettings settings;
+    std::vector<Mat4> instances;
+    bool uniform; // everything drawn should come out the same color
+};
+
+struct Timing
+{
+    double median, mad; // ms
+
+    Timing() : median(0), mad(0) {}
+};
+
+double median(std::vector<double> v)
+{
+    std::sort(v.begin(), v.end());
+    size_t n = v.size();
+    return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+Timing summarize(const std::vector<double> &samples)
+{
+    Timing t;
+    t.median = median(samples);
+    std::vector<double> deviations;
+    for (size_t i = 0; i < samples.size(); i++)
+        deviations.push_back(std::abs(samples[i] - t.median));
+    t.mad = median(deviations);
+    return t;
+}
+
+// name median mad, one scene per line
+std::map<std::string, Timing> read_timings(const std::string &filename)
+{
+    std::map<std::string, Timing> timings;
+    std::ifstream in(filename.c_str());
+    std::string name;
+    Timing t;
+    while (in >> name >> t.median >> t.mad)
+        timings[name] = t;
+    return timings;
+}
+
+// "same", "close" or "changed", with how far off the worst channel is and how many pixels differ
+const char *compare_images(TGAImage &image, TGAImage &golden, int &max_diff, long &diff_pixels)
+{
+    max_diff = 0;
+    diff_pixels = 0;
+    if (golden.get_width() != image.get_width() || golden.get_height() != image.get_height() ||
+        golden.get_bytespp() != image.get_bytespp())
+    {
+        max_diff = 255;
+        diff_pixels = (long)image.get_width() * image.get_height();
+        return "changed";
+    }
+    long npixels = (long)image.get_width() * image.get_height();
+    int bytespp = image.get_bytespp();
+    for (long i = 0; i < npixels; i++)
+    {
+        int diff = 0;
+        for (int k = 0; k < bytespp; k++)
+            diff = std::max(diff, std::abs(image.buffer()[i * bytespp + k] - golden.buffer()[i * bytespp + k]));
+        max_diff = std::max(max_diff, diff);
+        diff_pixels += diff > 0;
+    }
+    if (diff_pixels == 0)
+        return "same";
+    return max_diff <= pixel_tolerance && diff_pixels <= changed_fraction * npixels ? "close" : "changed";
+}
+
+// How many pixels that aren't black differ from the first one that isn't
+long uneven_pixels(TGAImage &image)
+{
+    long npixels = (long)image.get_width() * image.get_height(), uneven = 0;
+    int bytespp = image.get_bytespp();
+    const unsigned char *first = NULL;
+    for (long i = 0; i < npixels; i++)
+    {
+        const unsigned char *p = image.buffer() + i * bytespp;
+        bool black = true;
+        for (int k = 0; k < bytespp; k++)
+            black = black && !p[k];
+        if (black)
+            continue;
+        if (!first)
+            first = p;
+        uneven += memcmp(p, first, bytespp) != 0;
+    }
+    return uneven;
+}
+
+std::vector<Scene> regress_scenes(Model *head, Model *quantized_head, Model *small_tris, Model *big_tris, Model *copy, Model *grid)
+{
+    std::vector<Scene> scenes;
+    const char *shadings[4] = {"texture", "flat", "gouraud", "phong"};
+    for (int i = 0; i < 4; i++)
+    {
+        Scene scene = {std::string("head-") + shadings[i], head};
+        scene.settings.shading = shading_from_name(shadings[i]);
+        scenes.push_back(scene);
+    }
+    Scene scene = {"head-phong-z-prepass", head};
+    scene.settings.shading = SHADE_PHONG;
+    scene.settings.z_prepass = true;
+    scenes.push_back(scene);
+    scene = {"head-shadows", head};
+    scene.settings.shadows = true;
+    scenes.push_back(scene);
+    // the light's straight along the shadow camera's usual up
+    scene = {"head-shadows-overhead", head};
+    scene.settings.shadows = true;
+    scene.settings.light_dir = Vec3f(0, -1, 0);
+    scenes.push_back(scene);
+    scene = {"head-unorm16", head};
+    scene.settings.depth_format = DEPTH_UNORM16;
+    scenes.push_back(scene);
+    scene = {"head-opacity", head};
+    scene.settings.opacity = 0.5f;
+    scenes.push_back(scene);
+    // a pixel on an edge two triangles share is blended once, not twice
+    scene = {"grid-opacity", grid};
+    scene.settings.opacity = 0.5f;
+    scene.uniform = true;
+    scenes.push_back(scene);
+    scenes.push_back({"head-quantized", quantized_head});
+    // the stress meshes: lots of tiny triangles, a few big ones, many copies
+    scenes.push_back({"stress-small-tris", small_tris});
+    scenes.push_back({"stress-big-tris", big_tris});
+    scene = {"stress-instances", copy};
+    int side = 8;
+    for (int i = 0; i < side * side; i++)
+    {
+        Vec3f position((i % side + 0.5f) * 2.0f / side - 1.0f, (i / side + 0.5f) * 2.0f / side - 1.0f, 0);
+        // turned a little, but all still facing the camera
+        scene.instances.push_back(instance_transform(position, i * 0.5f, 1.0f / side));
+    }
+    scenes.push_back(scene);
+    return scenes;
+}
+
+int regress(const std::string &dir, bool update, int reps, double slowdown, TGAImage &texture)
+{
+    Model head("head.obj"), quantized_head("head.obj");
+    if (head.nfaces() == 0)
+    {
+        std::cerr << "can't load head.obj, run from the top of the repository" << std::endl;
+        return 1;
+    }
+    QuantizeStats quantize_stats;
+    quantized_head.quantize(quantize_stats);
+    Model *small_tris = synthetic_mesh(20000, 2, regress_res, 21);
+    Model *big_tris = synthetic_mesh(200, 50, regress_res, 22);
+    Model *copy = synthetic_mesh(500, 40, regress_res, 23);
+    Model *grid = flat_grid(4, 16, regress_res);
+    Model *meshes[6] = {&head, &quantized_head, small_tris, big_tris, copy, grid};
+    BVH *bvhs[6];
+    for (int m = 0; m < 6; m++)
+        bvhs[m] = new BVH(*meshes[m], 1);
+
+    std::string timings_file = dir + "/timings.txt";
+    std::map<std::string, Timing> baseline = read_timings(timings_file);
+    std::ostringstream timings;
+    int failed = 0;
+    TGAImage image(regress_res, regress_res, TGAImage::RGB);
+    Arena arena;
+    std::vector<Scene> scenes = regress_scenes(&head, &quantized_head, small_tris, big_tris, copy, grid);
+    for (size_t i = 0; i < scenes.size(); i++)
+    {
+        Scene &scene = scenes[i];
+        BVH *bvh = bvhs[std::find(meshes, meshes + 6, scene.mesh) - meshes];
+        std::vector<double> samples;
+        samples.reserve(reps);
+        long before = 0;
+        // the first frame sizes the arena and warms the caches, it isn't counted
+        for (int r = -1; r < reps; r++)
+        {
+            if (r == 0)
+                before = allocations;
+            memset(image.buffer(), 0, (size_t)regress_res * regress_res * image.get_bytespp());
+            double start = now();
+            Frame f(scene.mesh, bvh, &texture, scene.settings, image, arena, scene.instances.empty() ? NULL : scene.instances.data(),
+                    (int)scene.instances.size());
+            f.shadow_pass(0, regress_res);
+            f.render(0, regress_res, arena);
+            arena.reset();
+            if (r >= 0)
+                samples.push_back((now() - start) * 1e3);
+        }
+        double allocs_per_frame = (allocations - before) / (double)reps;
+        Timing t = summarize(samples);
+        // the right way up, like main writes them
+        image.flip_vertically();
+        timings << scene.name << " " << t.median << " " << t.mad << "\n";
+
+        std::string golden_file = dir + "/" + scene.name + ".tga";
+        Result result("regress");
+        result.add("scene", scene.name.c_str()).add("res", regress_res).add("ms", t.median).add("noise_ms", t.mad)
+            .add("allocs_per_frame", allocs_per_frame);
+        long uneven = scene.uniform ? uneven_pixels(image) : 0;
+        if (scene.uniform)
+            result.add("uneven_pixels", (double)uneven);
+        if (update)
+        {
+            if (!image.write_tga_file(golden_file.c_str()))
+            {
+                std::cerr << "can't write " << golden_file << std::endl;
+                failed++;
+            }
+            continue;
+        }
+
+        TGAImage golden;
+        const char *verdict = "new";
+        int max_diff = 0;
+        long diff_pixels = 0;
+        if (golden.read_tga_file(golden_file.c_str()))
+            verdict = compare_images(image, golden, max_diff, diff_pixels);
+        result.add("image", verdict).add("max_diff", max_diff).add("diff_pixels", (double)diff_pixels);
+        bool bad = !strcmp(verdict, "changed") || !strcmp(verdict, "new") || allocs_per_frame != 0 || uneven > 0;
+
+        std::map<std::string, Timing>::iterator b = baseline.find(scene.name);
+        if (b != baseline.end())
+        {
+            // 1.4826 * MAD estimates the standard deviation, the difference has to be
+            // 3 of them for both runs on top of the allowed slowdown
+            const Timing &base = b->second;
+            double noise = 3 * 1.4826 * (base.mad + t.mad);
+            double change = t.median / base.median - 1;
+            const char *speed = "same";
+            if (t.median > base.median * (1 + slowdown) && t.median - base.median > noise)
+                speed = "slower";
+            else if (t.median < base.median * (1 - slowdown) && base.median - t.median > noise)
+                speed = "faster";
+            result.add("baseline_ms", base.median).add("change", change).add("speed", speed);
+            bad = bad || !strcmp(speed, "slower");
+        }
+        result.add("ok", bad ? "false" : "true");
+        failed += bad;
+    }
+    if (update)
+    {
+        std::ofstream out(timings_file.c_str());
+        out << timings.str();
+        if (!out)
+        {
+            std::cerr << "can't write " << timings_file << std::endl;
+            failed++;
+        }
+    }
+    else if (baseline.empty())
+    {
+        std::cerr << "no timings in " << timings_file << ", only the images were checked (make regress-update for a baseline)" << std::endl;
+    }
+    Result("regress_summary").add("scenes", (double)scenes.size()).add("failed", failed).add("updated", update ? "true" : "false");
+
+    for (int m = 0; m < 6; m++)
+        delete bvhs[m];
+    delete small_tris;
+    delete big_tris;
+    delete copy;
+    delete grid;
+    return failed ? 1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+    // a single value narrows the sweep down to it
+    std::vector<int> tri_counts = {1000, 20000};
+    std::vector<float> tri_sizes = {2, 10, 50};
+    std::vector<int> resolutions = {512, 2048};
+    int reps = 3;
+    const char *regress_dir = NULL;
+    bool update = false;
+    double slowdown = 0.1;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--tris") && i + 1 < argc)
+            tri_counts = {atoi(argv[++i])};
+        else if (!strcmp(argv[i], "--size") && i + 1 < argc)
+            tri_sizes = {(float)atof(argv[++i])};
+        else if (!strcmp(argv[i], "--res") && i + 1 < argc)
+            resolutions = {atoi(argv[++i])};
+        else if (!strcmp(argv[i], "--reps") && i + 1 < argc)
+            reps = std::max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--regress") && i + 1 < argc)
+            regress_dir = argv[++i];
+        else if (!strcmp(argv[i], "--update"))
+            update = true;
+        else if (!strcmp(argv[i], "--slowdown") && i + 1 < argc)
+            slowdown = atof(argv[++i]);
+        else
+        {
+            std::cerr << "usage: " << argv[0] << " [--tris n] [--size pixels] [--res n] [--reps n] [--regress golden_dir [--update] [--slowdown f]]" << std::endl;
+            return 1;
+        }
+    }
+
+    TGAImage texture = checker_texture(1024);
+    if (regress_dir)
+    {
+        // more reps than a sweep, the medians have to be steady enough to compare
+        return regress(regress_dir, update, std::max(reps, 15), slowdown, texture);
+    }
+    for (size_t r = 0; r < resolutions.size(); r++)
+    {
+        bench_lines(resolutions[r], 100, reps);
+        for (size_t n = 0; n < tri_counts.size(); n++)
+            for (size_t s = 0; s < tri_sizes.size(); s++)
+                bench_triangles(tri_counts[n], tri_sizes[s], resolutions[r], texture, reps);
+        for (size_t n = 0; n < tri_counts.size(); n++)
+            bench_frame(tri_counts[n], tri_sizes[tri_sizes.size() / 2], resolutions[r], texture, reps);
+        for (int n = 1; n <= 1024; n *= 32)
+            bench_instances(n, resolutions[r], texture, reps);
+        bench_incremental(64, resolutions[r], texture, reps);
+        bench_tga(resolutions[r], reps);
+    }
+    bench_transform(1000000, reps);
+    for (size_t n = 0; n < tri_counts.size(); n++)
+        bench_model_load(tri_counts[n], std::min(reps, 3));
+    return 0;
+}
@@ -0,0 +1,496 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <future>
+#include <thread>
+#include "bvh.h"
+
+AABB::AABB() : bmin(FLT_MAX, FLT_MAX, FLT_MAX), bmax(-FLT_MAX, -FLT_MAX, -FLT_MAX) {}
+
+void AABB::grow(const Vec3f &p)
+{
+  for (int i = 0; i < 3; i++)
+  {
+    bmin.raw[i] = std::min(bmin.raw[i], p.raw[i]);
+    bmax.raw[i] = std::max(bmax.raw[i], p.raw[i]);
+  }
+}
+
+void AABB::grow(const AABB &b)
+{
+  grow(b.bmin);
+  grow(b.bmax);
+}
+
+float AABB::area() const
+{
+  Vec3f e = bmax - bmin;
+  if (e.x < 0)
+  {
+    return 0.0f;
+  }
+  return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+}
+
+Frustum Frustum::from_screen_matrix(Matrix m, int width, int height)
+{
+  float rows[4][4];
+  for (int i = 0; i < 4; i++)
+    for (int j = 0; j < 4; j++)
+      rows[i][j] = m[i][j];
+  return from_screen_rect(rows, 0, 0, width, height);
+}
+
+Frustum Frustum::from_screen_rect(const float m[4][4], int x0, int y0, int x1, int y1)
+{
+  // A point p ends up at screen x = (m[0] . p) / (m[3] . p), so with w = m[3] . p > 0
+  // x0 <= x <= x1  <=>  m[0] . p - x0 * w >= 0  and  x1 * w - m[0] . p >= 0
+  // (same idea as Gribb & Hartmann's plane extraction, just in screen space)
+  Frustum f;
+  f.nplanes = 6;
+  for (int i = 0; i < 4; i++)
+  {
+    f.planes[0][i] = m[0][i] - x0 * m[3][i];
+    f.planes[1][i] = x1 * m[3][i] - m[0][i];
+    f.planes[2][i] = m[1][i] - y0 * m[3][i];
+    f.planes[3][i] = y1 * m[3][i] - m[1][i];
+    // 0 <= screen z <= 1, between the near and far planes (and in front of the camera)
+    f.planes[4][i] = m[3][i] - m[2][i];
+    f.planes[5][i] = m[2][i];
+  }
+  return f;
+}
+
+namespace
+{
+  const int max_leaf_size = 4;
+  const int sah_bins = 16;
+  // Traversal keeps at most one pending node per level, so a tree this deep fits the
+  // fixed size stacks below. build() makes a leaf of anything deeper, however skewed
+  // the splits come out.
+  const int max_depth = 128;
+  const int parallel_min_prims = 4096; // smaller subtrees aren't worth a thread
+
+  struct BuildPrim
+  {
+    AABB box;
+    Vec3f centroid;
+    int face;
+  };
+
+  // Recursively builds the subtree over prims[begin, end) into `out` (depth first),
+  // with its root at `depth`. Right subtrees near the root are built into their own
+  // arrays on other threads and spliced in afterwards.
+  void build(std::vector<BuildPrim> &prims, int begin, int end, std::vector<BVHNode> &out, int depth, int parallel_depth)
+  {
+    AABB box, centroids;
+    for (int i = begin; i < end; i++)
+    {
+      box.grow(prims[i].box);
+      centroids.grow(prims[i].centroid);
+    }
+
+    int node_index = (int)out.size();
+    BVHNode node;
+    node.bmin = box.bmin;
+    node.bmax = box.bmax;
+    node.right_or_first = begin;
+    node.count = end - begin;
+    out.push_back(node);
+
+    int count = end - begin;
+    if (count <= 1 || depth >= max_depth - 1)
+    {
+      return;
+    }
+
+    // binned SAH: for every axis, drop the centroids into bins and sweep the
+    // bin boundaries as candidate split planes
+    float best_cost = FLT_MAX;
+    int best_axis = -1;
+    int best_split = 0;
+    for (int axis = 0; axis < 3; axis++)
+    {
+      float lo = centroids.bmin.raw[axis];
+      float extent = centroids.bmax.raw[axis] - lo;
+      if (extent <= 0)
+      {
+        continue;
+      }
+      AABB bins[sah_bins];
+      int bin_counts[sah_bins] = {0};
+      float scale = sah_bins / extent;
+      for (int i = begin; i < end; i++)
+      {
+        int b = std::min(sah_bins - 1, (int)((prims[i].centroid.raw[axis] - lo) * scale));
+        bins[b].grow(prims[i].box);
+        bin_counts[b]++;
+      }
+      // right-to-left sweep to get the area/count of everything right of each split
+      float right_area[sah_bins];
+      int right_count[sah_bins];
+      AABB acc;
+      int n = 0;
+      for (int b = sah_bins - 1; b > 0; b--)
+      {
+        acc.grow(bins[b]);
+        n += bin_counts[b];
+        right_area[b] = acc.area();
+        right_count[b] = n;
+      }
+      acc = AABB();
+      n = 0;
+      for (int b = 0; b < sah_bins - 1; b++)
+      {
+        acc.grow(bins[b]);
+        n += bin_counts[b];
+        float cost = n * acc.area() + right_count[b + 1] * right_area[b + 1];
+        if (n > 0 && right_count[b + 1] > 0 && cost < best_cost)
+        {
+          best_cost = cost;
+          best_axis = axis;
+          best_split = b + 1;
+        }
+      }
+    }
+
+    // Stay a leaf if splitting doesn't beat testing every triangle. Big leaves
+    // are always split since they hurt culling granularity.
+    bool split_pays = best_axis >= 0 && best_cost < count * box.area();
+    if (count <= max_leaf_size && !split_pays)
+    {
+      return;
+    }
+
+    int mid;
+    if (best_axis >= 0)
+    {
+      float lo = centroids.bmin.raw[best_axis];
+      float scale = sah_bins / (centroids.bmax.raw[best_axis] - lo);
+      BuildPrim *split = std::partition(&prims[begin], &prims[0] + end, [&](const BuildPrim &p)
+                                        { return std::min(sah_bins - 1, (int)((p.centroid.raw[best_axis] - lo) * scale)) < best_split; });
+      mid = (int)(split - &prims[0]);
+    }
+    else
+    {
+      // all the centroids are in the same spot, just cut the list in half
+      mid = begin + count / 2;
+    }
+
+    out[node_index].count = 0;
+    if (parallel_depth > 0 && count > parallel_min_prims)
+    {
+      std::vector<BVHNode> right;
+      std::future<void> right_done = std::async(std::launch::async, [&]()
+                                                { build(prims, mid, end, right, depth + 1, parallel_depth - 1); });
+      build(prims, begin, mid, out, depth + 1, parallel_depth - 1);
+      right_done.wait();
+      int offset = (int)out.size();
+      out[node_index].right_or_first = offset;
+      for (size_t i = 0; i < right.size(); i++)
+      {
+        if (right[i].count == 0)
+        {
+          right[i].right_or_first += offset;
+        }
+        out.push_back(right[i]);
+      }
+    }
+    else
+    {
+      build(prims, begin, mid, out, depth + 1, 0);
+      out[node_index].right_or_first = (int)out.size();
+      build(prims, mid, end, out, depth + 1, 0);
+    }
+  }
+
+  // p-vertex test: the box is outside the plane if its corner furthest along the
+  // plane normal is outside, and fully inside if the nearest corner is inside.
+  // Returns -1 for outside, 1 for inside, 0 for straddling.
+  int classify(const BVHNode &node, const float *plane)
+  {
+    float far_d = plane[3], near_d = plane[3];
+    for (int i = 0; i < 3; i++)
+    {
+      float lo = plane[i] * node.bmin.raw[i];
+      float hi = plane[i] * node.bmax.raw[i];
+      far_d += std::max(lo, hi);
+      near_d += std::min(lo, hi);
+    }
+    if (far_d < 0)
+    {
+      return -1;
+    }
+    return near_d >= 0 ? 1 : 0;
+  }
+
+  bool ray_box(const BVHNode &node, const Vec3f &orig, const Vec3f &inv_dir, float t_max)
+  {
+    float t0 = 0, t1 = t_max;
+    for (int i = 0; i < 3; i++)
+    {
+      // parallel to the slab: 0 * inf would make a NaN of the distances, and the ray
+      // is either inside the slab all along or never
+      if (std::isinf(inv_dir.raw[i]))
+      {
+        if (orig.raw[i] < node.bmin.raw[i] || orig.raw[i] > node.bmax.raw[i])
+        {
+          return false;
+        }
+        continue;
+      }
+      float a = (node.bmin.raw[i] - orig.raw[i]) * inv_dir.raw[i];
+      float b = (node.bmax.raw[i] - orig.raw[i]) * inv_dir.raw[i];
+      t0 = std::max(t0, std::min(a, b));
+      t1 = std::min(t1, std::max(a, b));
+    }
+    return t0 <= t1;
+  }
+
+  // Moller-Trumbore. Fills in the distance along the ray and the barycentric u, v.
+  inline bool ray_triangle(const Vec3f *verts, const Vec3f &orig, const Vec3f &dir, float &t, float &u, float &v)
+  {
+    const Vec3f &v0 = verts[0];
+    Vec3f e1 = verts[1] - v0;
+    Vec3f e2 = verts[2] - v0;
+    Vec3f pvec = dir ^ e2;
+    float det = e1 * pvec;
+    if (std::abs(det) < 1e-12f)
+    {
+      return false;
+    }
+    float inv_det = 1.0f / det;
+    Vec3f tvec = orig - v0;
+    u = (tvec * pvec) * inv_det;
+    if (u < 0 || u > 1)
+    {
+      return false;
+    }
+    Vec3f qvec = tvec ^ e1;
+    v = (dir * qvec) * inv_det;
+    if (v < 0 || u + v > 1)
+    {
+      return false;
+    }
+    t = (e2 * qvec) * inv_det;
+    return true;
+  }
+}
+
+BVH::BVH(Model &model, int threads) : nodes_(), indices_(), tri_verts_()
+{
+  int nfaces = model.nfaces();
+  if (nfaces == 0)
+  {
+    return;
+  }
+  std::vector<BuildPrim> prims(nfaces);
+  for (int i = 0; i < nfaces; i++)
+  {
+    FaceIndices face = model.tri_indices(i);
+    for (size_t j = 0; j < face.size(); j++)
+    {
+      prims[i].box.grow(model.vert(face[j]));
+    }
+    prims[i].centroid = (prims[i].box.bmin + prims[i].box.bmax) * 0.5f;
+    prims[i].face = i;
+  }
+
+  if (threads <= 0)
+  {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  // one level of parallel splitting doubles the number of workers
+  int parallel_depth = 0;
+  while ((1 << parallel_depth) < threads && parallel_depth < 8)
+  {
+    parallel_depth++;
+  }
+  nodes_.reserve(2 * nfaces);
+  build(prims, 0, nfaces, nodes_, 0, parallel_depth);
+
+  indices_.resize(nfaces);
+  tri_verts_.resize(3 * nfaces);
+  for (int i = 0; i < nfaces; i++)
+  {
+    indices_[i] = prims[i].face;
+    FaceIndices face = model.tri_indices(prims[i].face);
+    for (int j = 0; j < 3; j++)
+    {
+      tri_verts_[3 * i + j] = model.vert(face[j]);
+    }
+  }
+}
+
+size_t BVH::memory_size() const
+{
+  return sizeof(BVH) + nodes_.capacity() * sizeof(BVHNode) + indices_.capacity() * sizeof(int) + tri_verts_.capacity() * sizeof(Vec3f);
+}
+
+AABB BVH::bounds() const
+{
+  AABB box;
+  if (!nodes_.empty())
+  {
+    box.bmin = nodes_[0].bmin;
+    box.bmax = nodes_[0].bmax;
+  }
+  return box;
+}
+
+void BVH::cull(const Frustum &frustum, std::vector<int> &out) const
+{
+  size_t n = out.size();
+  out.resize(n + indices_.size());
+  out.resize(n + cull(frustum, out.data() + n));
+}
+
+int BVH::cull(const Frustum &frustum, int *out) const
+{
+  int n = 0;
+  if (nodes_.empty())
+  {
+    return n;
+  }
+  // (node, bitmask of planes the node still straddles)
+  int stack[max_depth][2];
+  int sp = 0;
+  stack[sp][0] = 0;
+  stack[sp][1] = (1 << frustum.nplanes) - 1;
+  sp++;
+  while (sp > 0)
+  {
+    sp--;
+    int index = stack[sp][0];
+    int mask = stack[sp][1];
+    const BVHNode &node = nodes_[index];
+    bool outside = false;
+    for (int p = 0; p < frustum.nplanes && !outside; p++)
+    {
+      if (!(mask & (1 << p)))
+      {
+        continue;
+      }
+      int c = classify(node, frustum.planes[p]);
+      if (c < 0)
+      {
+        outside = true;
+      }
+      else if (c > 0)
+      {
+        // the children are inside this plane too
+        mask &= ~(1 << p);
+      }
+    }
+    if (outside)
+    {
+      continue;
+    }
+    if (node.count > 0 || mask == 0)
+    {
+      // leaf, or a subtree that's entirely visible: its triangles are the
+      // contiguous range of indices_ covered by the subtree
+      int first, last;
+      if (node.count > 0)
+      {
+        first = node.right_or_first;
+        last = first + node.count;
+      }
+      else
+      {
+        // walk to the leftmost and rightmost leaves
+        int l = index, r = index;
+        while (nodes_[l].count == 0)
+          l++;
+        while (nodes_[r].count == 0)
+          r = nodes_[r].right_or_first;
+        first = nodes_[l].right_or_first;
+        last = nodes_[r].right_or_first + nodes_[r].count;
+      }
+      std::copy(indices_.begin() + first, indices_.begin() + last, out + n);
+      n += last - first;
+      continue;
+    }
+    stack[sp][0] = node.right_or_first;
+    stack[sp][1] = mask;
+    sp++;
+    stack[sp][0] = index + 1;
+    stack[sp][1] = mask;
+    sp++;
+  }
+  return n;
+}
+
+int BVH::raycast(const Vec3f &orig, const Vec3f &dir, float &t, Vec3f &bary) const
+{
+  int hit = -1;
+  t = FLT_MAX;
+  if (nodes_.empty())
+  {
+    return hit;
+  }
+  Vec3f inv_dir(1.0f / dir.x, 1.0f / dir.y, 1.0f / dir.z);
+  int stack[max_depth];
+  int sp = 0;
+  stack[sp++] = 0;
+  while (sp > 0)
+  {
+    const BVHNode &node = nodes_[stack[--sp]];
+    if (!ray_box(node, orig, inv_dir, t))
+    {
+      continue;
+    }
+    if (node.count == 0)
+    {
+      stack[sp++] = node.right_or_first;
+      stack[sp++] = (int)(&node - &nodes_[0]) + 1;
+      continue;
+    }
+    for (int i = node.right_or_first; i < node.right_or_first + node.count; i++)
+    {
+      float hit_t, u, v;
+      if (ray_triangle(&tri_verts_[3 * i], orig, dir, hit_t, u, v) && hit_t > 0 && hit_t < t)
+      {
+        t = hit_t;
+        bary = Vec3f(1 - u - v, u, v);
+        hit = indices_[i];
+      }
+    }
+  }
+  return hit;
+}
+
+bool BVH::occluded(const Vec3f &orig, const Vec3f &dir, float t_max) const
+{
+  if (nodes_.empty())
+  {
+    return false;
+  }
+  Vec3f inv_dir(1.0f / dir.x, 1.0f / dir.y, 1.0f / dir.z);
+  int stack[max_depth];
+  int sp = 0;
+  stack[sp++] = 0;
+  while (sp > 0)
+  {
+    const BVHNode &node = nodes_[stack[--sp]];
+    if (!ray_box(node, orig, inv_dir, t_max))
+    {
+      continue;
+    }
+    if (node.count == 0)
+    {
+      stack[sp++] = node.right_or_first;
+      stack[sp++] = (int)(&node - &nodes_[0]) + 1;
+      continue;
+    }
+    for (int i = node.right_or_first; i < node.right_or_first + node.count; i++)
+    {
+      float t, u, v;
+      if (ray_triangle(&tri_verts_[3 * i], orig, dir, t, u, v) && t > 0 && t < t_max)
+      {
+        return true;
+      }
+    }
+  }
+  return false;
+}
@@ -0,0 +1,75 @@
+#ifndef __BVH_H__
+#define __BVH_H__
+
+#include <vector>
+#include "geometry.h"
+#include "model.h"
+
+// Axis aligned bounding box
+struct AABB
+{
+  Vec3f bmin, bmax;
+  AABB();
+  void grow(const Vec3f &p);
+  void grow(const AABB &b);
+  float area() const;
+};
+
+// A set of planes (a, b, c, d) whose inside is a*x + b*y + c*z + d >= 0
+struct Frustum
+{
+  float planes[6][4];
+  int nplanes;
+
+  // Builds the planes for everything that lands inside [0, width] x [0, height]
+  // (in front of the camera) after being transformed by the 4x4 matrix m,
+  // i.e. Viewport * Projection * ModelView.
+  static Frustum from_screen_matrix(Matrix m, int width, int height);
+  // Same, for the part of the screen in [x0, x1] x [y0, y1] (e.g. one tile), with
+  // the matrix as plain rows so it doesn't have to go through a Matrix
+  static Frustum from_screen_rect(const float m[4][4], int x0, int y0, int x1, int y1);
+};
+
+// Flattened BVH node. Nodes are stored depth first, so an internal node's left
+// child is always the next node in the array and only the right child needs an index.
+// Two nodes fit in one cache line.
+struct BVHNode
+{
+  Vec3f bmin;
+  int right_or_first; // internal: index of right child, leaf: first entry in BVH::indices()
+  Vec3f bmax;
+  int count; // 0 for internal nodes
+};
+
+class BVH
+{
+private:
+  std::vector<BVHNode> nodes_;
+  std::vector<int> indices_;     // face indices into the Model, in leaf order
+  std::vector<Vec3f> tri_verts_; // 3 vertices per entry in indices_, for ray tests
+
+public:
+  // Builds with a binned SAH split. The top few levels of the tree are built on
+  // separate threads (threads <= 0 means use all hardware threads).
+  BVH(Model &model, int threads = 0);
+  int nnodes() const { return (int)nodes_.size(); }
+  const std::vector<BVHNode> &nodes() const { return nodes_; }
+  const std::vector<int> &indices() const { return indices_; }
+  AABB bounds() const;
+  size_t memory_size() const;
+
+  // Appends the face index of every triangle whose node is (at least partially)
+  // inside the frustum. Subtrees entirely inside are emitted without further tests.
+  void cull(const Frustum &frustum, std::vector<int> &out) const;
+  // Same, into `out`, which needs room for every face. Returns how many were written.
+  int cull(const Frustum &frustum, int *out) const;
+
+  // Closest hit along orig + t * dir. Returns the face index or -1, and fills in
+  // the distance and the barycentric coordinates of the hit.
+  int raycast(const Vec3f &orig, const Vec3f &dir, float &t, Vec3f &bary) const;
+  // Whether anything is hit along orig + t * dir for t in (0, t_max). Stops at the
+  // first hit it finds rather than looking for the closest one.
+  bool occluded(const Vec3f &orig, const Vec3f &dir, float t_max) const;
+};
+
+#endif //__BVH_H__
@@ -0,0 +1,172 @@
+#include <algorithm>
+#include <cstring>
+#include "incremental.h"
+
+IncrementalFrame::IncrementalFrame(Model *model, BVH *bvh, TGAImage *texture, const RenderSettings &settings, int width, int height,
+                                   const std::vector<Mat4> &instances, int band_rows)
+    : model_(model), bvh_(bvh), texture_(texture), settings_(settings), image_(width, height, TGAImage::RGB), instances_(instances),
+      band_rows_(std::max(1, band_rows)), bands_((height + band_rows_ - 1) / band_rows_), uv_min_(model->nfaces()),
+      uv_max_(model->nfaces()), culled_(model->nfaces()), rebuild_(true)
+{
+  for (int f = 0; f < model->nfaces(); f++)
+  {
+    FaceIndices idx = model->uv_indices(f);
+    uv_min_[f] = uv_max_[f] = model->uv(idx[0]);
+    for (size_t k = 1; k < idx.size(); k++)
+    {
+      Vec2f uv = model->uv(idx[k]);
+      uv_min_[f].x = std::min(uv_min_[f].x, uv.x);
+      uv_min_[f].y = std::min(uv_min_[f].y, uv.y);
+      uv_max_[f].x = std::max(uv_max_[f].x, uv.x);
+      uv_max_[f].y = std::max(uv_max_[f].y, uv.y);
+    }
+  }
+  mark_all();
+}
+
+Mat4 IncrementalFrame::transform(int i)
+{
+  Mat4 camera = camera_transform(image_.get_width(), image_.get_height(), settings_.zoom);
+  return instances_.empty() ? camera : camera * instances_[i];
+}
+
+int IncrementalFrame::cull(int i, int b)
+{
+  int y0 = b * band_rows_, y1 = std::min(image_.get_height(), y0 + band_rows_);
+  Frustum frustum = Frustum::from_screen_rect(transform(i).m, 0, y0, image_.get_width(), y1);
+  return bvh_->cull(frustum, culled_.data());
+}
+
+void IncrementalFrame::bin(int b)
+{
+  Band &band = bands_[b];
+  band.instances.clear();
+  band.offsets.clear();
+  band.faces.clear();
+  for (int i = 0; i < ninstances(); i++)
+  {
+    int n = cull(i, b);
+    if (n > 0)
+    {
+      band.instances.push_back(i);
+      band.offsets.push_back((int)band.faces.size());
+      band.faces.insert(band.faces.end(), culled_.begin(), culled_.begin() + n);
+    }
+  }
+  band.offsets.push_back((int)band.faces.size());
+}
+
+void IncrementalFrame::mark_all()
+{
+  for (size_t b = 0; b < bands_.size(); b++)
+  {
+    bands_[b].dirty = true;
+  }
+}
+
+int IncrementalFrame::dirty_bands()
+{
+  int n = 0;
+  for (size_t b = 0; b < bands_.size(); b++)
+  {
+    n += bands_[b].dirty;
+  }
+  return n;
+}
+
+void IncrementalFrame::move_instance(int i, const Mat4 &transform)
+{
+  if (settings_.shadows)
+  {
+    // it moves in the shadow map too, which is fitted around every copy
+    instances_[i] = transform;
+    rebuild_ = true;
+    mark_all();
+    return;
+  }
+  // where it was...
+  for (size_t b = 0; b < bands_.size(); b++)
+  {
+    const std::vector<int> &on_band = bands_[b].instances;
+    bands_[b].dirty = bands_[b].dirty || std::binary_search(on_band.begin(), on_band.end(), i);
+  }
+  // ...and where it is now
+  instances_[i] = transform;
+  for (size_t b = 0; b < bands_.size(); b++)
+  {
+    bands_[b].dirty = bands_[b].dirty || cull(i, (int)b) > 0;
+  }
+}
+
+void IncrementalFrame::texture_changed(int x0, int y0, int x1, int y1)
+{
+  if (settings_.shadows)
+  {
+    rebuild_ = true;
+    mark_all();
+    return;
+  }
+  // the uvs that sample those texels, see ModelShader::sample()
+  float w = (float)texture_->get_width(), h = (float)texture_->get_height();
+  Vec2f lo(x0 / w, 1.0f - y1 / h), hi(x1 / w, 1.0f - y0 / h);
+  for (size_t b = 0; b < bands_.size(); b++)
+  {
+    Band &band = bands_[b];
+    for (size_t k = 0; k < band.faces.size() && !band.dirty; k++)
+    {
+      int f = band.faces[k];
+      band.dirty = uv_min_[f].x <= hi.x && uv_max_[f].x >= lo.x && uv_min_[f].y <= hi.y && uv_max_[f].y >= lo.y;
+    }
+  }
+}
+
+void IncrementalFrame::set_light(const Vec3f &light_dir)
+{
+  settings_.light_dir = light_dir;
+  rebuild_ = true;
+  mark_all();
+}
+
+int IncrementalFrame::update(Arena &scratch)
+{
+  int width = image_.get_width(), height = image_.get_height();
+  // A redrawn band's fragments are cleared, but their room in the A-buffer's pool
+  // isn't given back, so it would fill up after a few edits. A new Frame has an empty one.
+  if (settings_.opacity < 1 && dirty_bands() > 0)
+  {
+    rebuild_ = true;
+  }
+  if (rebuild_)
+  {
+    // the Frame works out the light and shadow map in its constructor
+    frame_.reset();
+    arena_.reset();
+    frame_.reset(new Frame(model_, bvh_, texture_, settings_, image_, arena_, instances_.empty() ? NULL : instances_.data(),
+                           (int)instances_.size()));
+    frame_->shadow_pass(0, height);
+    rebuild_ = false;
+  }
+  int depth_size = depth_format_size(settings_.depth_format);
+  int redrawn = 0;
+  for (int b = 0; b < nbands(); b++)
+  {
+    if (!bands_[b].dirty)
+    {
+      continue;
+    }
+    int y0 = b * band_rows_, y1 = std::min(height, y0 + band_rows_);
+    size_t row_pixels = (size_t)width * (y1 - y0), first = (size_t)width * y0;
+    memset(image_.buffer() + first * image_.get_bytespp(), 0, row_pixels * image_.get_bytespp());
+    memset((unsigned char *)frame_->zbuffer + first * depth_size, 0, row_pixels * depth_size);
+    if (frame_->abuffer)
+    {
+      frame_->abuffer->clear_rows(y0, y1);
+    }
+    frame_->render(y0, y1, scratch);
+    scratch.reset();
+    bin(b);
+    bands_[b].dirty = false;
+    redrawn++;
+  }
+  return redrawn;
+}
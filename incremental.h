@@ -0,0 +1,87 @@
+#ifndef __INCREMENTAL_H__
+#define __INCREMENTAL_H__
+
+#include <memory>
+#include <vector>
+#include "arena.h"
+#include "bvh.h"
+#include "model.h"
+#include "render.h"
+#include "tgaimage.h"
+
+/*
+
+Incremental re-rendering, for a preview that redraws after every small edit.
+
+The image and zbuffer are kept from one update() to the next, split into bands of
+band_rows rows (the unit the Frame passes already work in). Every band keeps the faces
+that can land on it, per copy of the model, as the BVH culls them, and an edit only
+marks the bands it can change as dirty:
+
+  move_instance()    the bands the copy was on, and the ones it's on now
+  texture_changed()  the bands with a face whose uvs reach the changed texels
+  set_light()        everything, the light is directional so every lit pixel changes
+
+update() clears and redraws just the dirty bands, so a small edit costs about as much
+as the rows it touches instead of a whole frame. The face lists come from BVH nodes,
+so they're conservative: a band can be redrawn for a face that only comes close to it,
+never skipped for one that's on it.
+
+With shadows anything can shadow anything, so every edit redraws the whole frame.
+A see-through model (opacity < 1) gets a new Frame on every update() that redraws
+anything, since the A-buffer's pool can't be handed back a band at a time; only the
+dirty bands are drawn again though.
+
+*/
+class IncrementalFrame
+{
+  // The faces of band b: copy instances[k] has faces[offsets[k]] up to faces[offsets[k + 1]]
+  struct Band
+  {
+    std::vector<int> instances;
+    std::vector<int> offsets;
+    std::vector<int> faces;
+    bool dirty;
+  };
+
+  Model *model_;
+  BVH *bvh_;
+  TGAImage *texture_;
+  RenderSettings settings_;
+  TGAImage image_;
+  std::vector<Mat4> instances_; // empty for the model as it is
+  int band_rows_;
+  std::vector<Band> bands_;
+  std::vector<Vec2f> uv_min_, uv_max_; // uv bounds of every face
+  Arena arena_;
+  std::unique_ptr<Frame> frame_;
+  std::vector<int> culled_;
+  bool rebuild_; // a new Frame, with everything dirty
+
+  int ninstances() { return instances_.empty() ? 1 : (int)instances_.size(); }
+  // where copy i lands, like Frame::instance()
+  Mat4 transform(int i);
+  // the faces of copy i that the BVH finds in band b, in culled_
+  int cull(int i, int b);
+  void bin(int b);
+  void mark_all();
+
+public:
+  // Needs the model's BVH. With no instances the model is drawn as it is.
+  IncrementalFrame(Model *model, BVH *bvh, TGAImage *texture, const RenderSettings &settings, int width, int height,
+                   const std::vector<Mat4> &instances = std::vector<Mat4>(), int band_rows = 16);
+
+  TGAImage &image() { return image_; }
+  int nbands() { return (int)bands_.size(); }
+  int dirty_bands();
+
+  void move_instance(int i, const Mat4 &transform);
+  // Texels [x0, x1) x [y0, y1) of the texture have been changed (in place, by the caller)
+  void texture_changed(int x0, int y0, int x1, int y1);
+  void set_light(const Vec3f &light_dir);
+
+  // Redraws the dirty bands (everything the first time) and returns how many there were
+  int update(Arena &scratch);
+};
+
+#endif //__INCREMENTAL_H__
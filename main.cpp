@@ -1,7 +1,24 @@
 #include <algorithm>
 #include "tgaimage.h"
 #include <iostream>
+#include <ctime>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <memory>
+#include <future>
 #include "model.h"
+#include "bvh.h"
+#include "simplify.h"
+#include "render.h"
+#include "bake.h"
+#include "batch.h"
+#include "server.h"
+#include "stats.h"
+#include "stream.h"
+#include "sortlast.h"
+#include "strips.h"
+#include "threadpool.h"
 
 const TGAColor white = TGAColor(255, 255, 255, 255);
 const TGAColor red = TGAColor(255, 0, 0, 255);
@@ -10,331 +27,190 @@ int image_width = 800;
 int image_height = 800;
 
 Model *model = NULL;
-
-Matrix vector_to_matrix(Vec3f v)
+BVH *bvh = NULL; // built over `model` in main(), used to skip off-screen triangles
+LODChain *lod_chain = NULL; // with --lod, `model` is its level 0 and Frame picks the level
+RenderSettings settings;
+
+const Vec3f camera(0, 0, camera_z);
+// everything flat_model() needs for one frame, kept from one frame to the next
+Arena frame_arena;
+const char *texture_path = "african_head_diffuse.tga";
+std::unique_ptr<CompressedTexture> compressed_texture; // with --bc1
+std::unique_ptr<ThreadPool> pool; // see workers()
+
+// The one pool everything that runs in parallel shares (baking, shadow and instanced bands), with
+// --threads workers. Started the first time something needs it.
+ThreadPool &workers(int threads)
 {
-    Matrix m(4, 1);
-    m[0][0] = v.x;
-    m[1][0] = v.y;
-    m[2][0] = v.z;
-    m[3][0] = 1.0f;
-    return m;
+    if (!pool)
+        pool.reset(new ThreadPool(threads));
+    return *pool;
 }
 
-Vec3f matrix_to_vector(Matrix m)
+// Loads the texture, or just compressed_texture with --bc1. Doesn't touch anything
+// else, so it can run on its own thread while the model loads.
+bool read_texture(TGAImage &texture)
 {
-    // Assumes 4x1 matrix representing (x, y, z, w)
-    // Return vector that is x/y/z divided by w
-    return Vec3f(m[0][0] / m[3][0], m[1][0] / m[3][0], m[2][0] / m[3][0]);
-}
-
-void draw_line(int x0, int y0, int x1, int y1, TGAImage &image, TGAColor color)
-{
-    // The line is "steep" if it changes more in y than in x
-    // This can be used to make sure that lines are drawn without holes
-    // and also with as few iterations as needed.
-    bool is_steep = std::abs(x0 - x1) < std::abs(y0 - y1);
-
-    if (is_steep)
+    STATS_SCOPE(STAGE_TEXTURE);
+    if (settings.compress_texture)
     {
-        // if the line is steep, we're going to reflect it over y=x so we can treat it
-        // like a non-steep line and always iterate over "x". Then we'll have to untranspose it
-        // with x=y when actually writing to the image.
-        // We can also use the fact that the slope is less than 1 to our advantage.
-        std::swap(x0, y0);
-        std::swap(x1, y1);
+        // straight from the .bc1 cache file when it's up to date, `texture` stays empty
+        compressed_texture.reset(CompressedTexture::load(texture_path));
+        if (!compressed_texture)
+            return false;
+        std::cerr << "BC1 texture: " << compressed_texture->memory_size() << " bytes, "
+                  << (size_t)compressed_texture->get_width() * compressed_texture->get_height() * 3 << " as RGB" << std::endl;
+        return true;
     }
+    return texture.read_tga_file(texture_path);
+}
 
-    // Make it always left-to-right
-    if (x0 > x1)
+void flat_model(TGAImage &image, TGAImage &texture, int threads)
+{
+    Frame frame(model, bvh, &texture, settings, image, frame_arena);
+    int height = image.get_height();
+    if (lod_chain)
     {
-        std::swap(x0, x1);
-        std::swap(y0, y1);
+        frame.set_lods(lod_chain);
+        int level = frame.lod_level(0);
+        std::cerr << "LOD " << level << " of " << lod_chain->nlevels() << ": " << lod_chain->level(level)->nfaces() << " faces" << std::endl;
     }
 
-    int dx = x1 - x0;
-    int dy = y1 - y0;
-
-    /*  less efficient approach since you have to do floating point stuff
-    // derror (Delta Error) is how much error accumulates with each iteration of x
-    // error is really just how much y changes as x changes (abs slope), I'm just calling it "error"
-    // to be consistent with the tutorial
-    // float derror = std::abs(dy / (float)dx);
-    */
-    // instead of doing error = dy/dx, let's do new_error = 2 * dy = 2 * dx * old_error
-    int dxderror2 = std::abs(dy) * 2;
-    // error is how much cumulative error has accumulated
-    int error = 0;
-    int y_increment = (y1 > y0) ? 1 : -1;
-
-    int y = y0;
-    // This could be a single loop with an if statement, but branching inside
-    if (is_steep)
+    // The shadow map is rendered in horizontal bands on the pool while this thread
+    // does the camera's z-prepass, which doesn't need it
+    if (frame.has_shadows())
     {
-        for (int x = x0; x <= x1; x++)
+        const int band = 64;
+        ThreadPool &pool = workers(threads);
+        for (int y = 0; y < height; y += band)
         {
-            image.set(y, x, color);
-
-            error += dxderror2;
-            if (error > dx)
-            {
-                // if the cumulative error is over 0.5, we want to move y up/down to the next pixel
-                y += y_increment;
-                error -= dx * 2;
-            }
+            pool.submit([&frame, y, band, height]()
+                        { frame.shadow_pass(y, std::min(height, y + band)); });
         }
     }
-    else
+    if (settings.z_prepass)
     {
-        for (int x = x0; x <= x1; x++)
-        {
-            image.set(x, y, color);
-            error += dxderror2;
-            if (error > dx)
-            {
-                // if the cumulative error is over 0.5, we want to move y up/down to the next pixel
-                y += y_increment;
-                error -= dx * 2;
-            }
-        }
+        frame.depth_pass(0, height, frame_arena);
     }
-}
-
-/*
-void triangle_linesweep(Vec2i p0, Vec2i p1, Vec2i p2, TGAImage &image, TGAColor color)
-{
-    draw_line(p0.x, p0.y, p1.x, p1.y, image, color);
-    draw_line(p1.x, p1.y, p2.x, p2.y, image, color);
-    draw_line(p2.x, p2.y, p0.x, p0.y, image, color);
-
-    // First, sort p0, p1, p2 so that they are in order of increasing y
-    // p0 is the "lowest", p2 is the "highest"
-    if (p0.y > p1.y)
+    if (frame.has_shadows())
     {
-        std::swap(p0, p1);
+        workers(threads).wait();
     }
-    if (p1.y > p2.y)
+    frame.color_pass(0, height, frame_arena);
+    if (frame.abuffer)
     {
-        std::swap(p1, p2);
+        frame.resolve(0, height);
+        ABuffer &abuffer = *frame.abuffer;
+        std::cerr << "A-buffer: " << abuffer.used() << " of " << abuffer.capacity() << " fragments, " << abuffer.memory_size() << " bytes, "
+                  << abuffer.dropped() << " dropped, " << abuffer.truncated() << " over " << ABuffer::max_layers << " a pixel" << std::endl;
     }
-    if (p0.y > p1.y)
+#ifdef RENDER_STATS
+    for (int i = 0; i < image.get_width() * height; i++)
     {
-        std::swap(p1, p2);
-    }
-
-    // Render the bottom half of the triangle
-    for (int y = p0.y; y < p1.y; y++)
-    {
-        // First, figure out where along the (p0, p1) edge we are
-        int dy_01 = (p1.y - p0.y);
-        float p01_t = dy_01 == 0 ? 1.0 : (y - p0.y) / (float)(p1.y - p0.y);
-        float p01_x = (p1.x - p0.x) * p01_t + p0.x;
-
-        // Same for (p0, p2) edge
-        int dy_02 = (p2.y - p0.y);
-        float p02_t = dy_02 == 0 ? 1.0 : (y - p0.y) / (float)(p2.y - p0.y);
-        float p02_x = (p2.x - p0.x) * p02_t + p0.x;
-
-        // Left boundary is the min of these 2 x's, right is the max
-        int left_boundary = std::min(p01_x, p02_x);
-        int right_boundary = std::max(p01_x, p02_x);
-        draw_line(left_boundary, y, right_boundary, y, image, color);
-    }
-
-    // Render the top half
-    for (int y = p1.y; y <= p2.y; y++)
-    {
-        // First, figure out where along the (p1, p2) edge we are
-        int dy_12 = (p2.y - p1.y);
-        float p12_t = dy_12 == 0 ? 1.0 : (y - p1.y) / (float)(p2.y - p1.y);
-        float p12_x = (p2.x - p1.x) * p12_t + p1.x;
-
-        // Same for (p0, p2) edge
-        int dy_02 = (p2.y - p0.y);
-        float p02_t = dy_02 == 0 ? 1.0 : (y - p0.y) / (float)(p2.y - p0.y);
-        float p02_x = (p2.x - p0.x) * p02_t + p0.x;
-
-        // Left boundary is the min of these 2 x's, right is the max
-        int left_boundary = std::min(p12_x, p02_x);
-        int right_boundary = std::max(p12_x, p02_x);
-        draw_line(left_boundary, y, right_boundary, y, image, color);
+        if (frame.depth(i % image.get_width(), i / image.get_width()) > 0)
+            frame_stats.pixels_covered++;
     }
+#endif
+    frame_arena.reset();
 }
-*/
 
-TGAColor bbox_color(125, 125, 100, 255);
-
-void triangle(
-    Vec3f p0, Vec3f p1, Vec3f p2, Vec2f uv0, Vec2f uv1, Vec2f uv2, float *zbuffer, TGAImage &image, TGAImage &texture, TGAColor color, bool show_bounding_box)
+void instanced_model(TGAImage &image, TGAImage &texture, const std::vector<Mat4> &instances, int threads)
 {
-    // outline
-    // draw_line(p0.x, p0.y, p1.x, p1.y, image, color);
-    // draw_line(p1.x, p1.y, p2.x, p2.y, image, color);
-    // draw_line(p2.x, p2.y, p0.x, p0.y, image, color);
-
-    Vec2f bbox_min;
-    Vec2f bbox_max;
-
-    bbox_min.x = std::max(0.f, std::min(p0.x, std::min(p1.x, p2.x)));
-    bbox_min.y = std::max(0.f, std::min(p0.y, std::min(p1.y, p2.y)));
-
-    bbox_max.x = std::min(image.get_width() - 1.f, std::max(p0.x, std::max(p1.x, p2.x)));
-    bbox_max.y = std::min(image.get_height() - 1.f, std::max(p0.y, std::max(p1.y, p2.y)));
-
-    if (show_bounding_box)
-    {
-        // draw bounding box for debugging
-        // left
-        draw_line(bbox_min.x, bbox_min.y, bbox_min.x, bbox_max.y, image, bbox_color);
-        // right
-        draw_line(bbox_max.x, bbox_min.y, bbox_max.x, bbox_max.y, image, bbox_color);
-        // top
-        draw_line(bbox_min.x, bbox_max.y, bbox_max.x, bbox_max.y, image, bbox_color);
-        // bottom
-        draw_line(bbox_min.x, bbox_min.y, bbox_max.x, bbox_min.y, image, bbox_color);
+    // Every copy of the model in one frame. The shadow map and then the camera's
+    // passes are split into bands of rows that the pool's workers pick up, and each
+    // band gets the triangles of every copy that lands on it (see Frame), so bands
+    // never touch each other's pixels.
+    Frame frame(model, bvh, &texture, settings, image, frame_arena, instances.data(), (int)instances.size());
+    int height = image.get_height();
+    if (lod_chain)
+    {
+        // how many copies get each level
+        frame.set_lods(lod_chain);
+        std::vector<int> copies(lod_chain->nlevels(), 0);
+        for (int i = 0; i < frame.ninstances(); i++)
+            copies[frame.lod_level(i)]++;
+        std::cerr << "LOD levels (faces: copies):";
+        for (int l = 0; l < lod_chain->nlevels(); l++)
+            std::cerr << " " << lod_chain->level(l)->nfaces() << ": " << copies[l];
+        std::cerr << std::endl;
     }
-
-    Vec3f P;
-    for (int x = bbox_min.x; x <= bbox_max.x; x++)
+    const int band = 64;
+    ThreadPool &pool = workers(threads);
+    if (frame.has_shadows())
     {
-        P.x = x;
-        for (int y = bbox_min.y; y <= bbox_max.y; y++)
+        for (int y = 0; y < height; y += band)
         {
-            P.y = y;
-            Vec3f u = Vec3f(
-                          p2.x - p0.x,
-                          p1.x - p0.x,
-                          p0.x - P.x) ^
-                      Vec3f(
-                          p2.y - p0.y,
-                          p1.y - p0.y,
-                          p0.y - P.y);
-            if (std::abs(u.z) < 1)
-            {
-                // degenerate triangle
-                continue;
-            }
-            Vec3f barycentric(
-                1.0f - (u.x + u.y) / u.z,
-                u.y / u.z,
-                u.x / u.z);
-            if (barycentric.x < 0 || barycentric.y < 0 || barycentric.z < 0)
-            {
-                // Not inside triangle
-                continue;
-            }
-
-            // Calculate z based on linear combination of the barycentric coordinates
-            P.z = p0.z * barycentric.x + p1.z * barycentric.y + p2.z * barycentric.z;
-
-            float u_new = uv0.x * barycentric.x + uv1.x * barycentric.y + uv2.x * barycentric.z;
-            float v_new = uv0.y * barycentric.x + uv1.y * barycentric.y + uv2.y * barycentric.z;
-            TGAColor color = texture.get((int)(u_new * texture.get_width()), (int)((1.0 - v_new) * texture.get_height()));
-            if (zbuffer[(int)(P.x + P.y * image.get_width())] >= P.z)
-            {
-                continue;
-            }
-            image.set(P.x, P.y, color);
-            zbuffer[(int)(P.x + P.y * image.get_width())] = P.z;
+            pool.submit([&frame, y, band, height]()
+                        { frame.shadow_pass(y, std::min(height, y + band)); });
         }
+        pool.wait();
     }
+    for (int y = 0; y < height; y += band)
+    {
+        pool.submit([&frame, y, band, height]()
+                    {
+                        // one band at a time per worker, so one arena each is enough
+                        static thread_local Arena scratch;
+                        frame.render(y, std::min(height, y + band), scratch);
+                        scratch.reset(); });
+    }
+    pool.wait();
+#ifdef RENDER_STATS
+    for (int i = 0; i < image.get_width() * height; i++)
+    {
+        if (frame.depth(i % image.get_width(), i / image.get_width()) > 0)
+            frame_stats.pixels_covered++;
+    }
+#endif
+    frame_arena.reset();
 }
 
-const int depth = 255;
-
-Matrix viewport(int x, int y, int w, int h)
+int pick(int x, int y, int width, int height)
 {
-    /*
-
-    Viewport matrix:
-    | w/2 0  0  x+w/2 |
-    | 0  h/2 0  y+h/2 |
-    | 0  0  d/2 d/2   |
-    | 0  0  0   1     |
-
-    */
-    Matrix m = Matrix::identity(4);
-    m[0][3] = x + w / 2.0f;
-    m[1][3] = y + h / 2.0f;
-    m[2][3] = depth / 2.0f;
-
-    m[0][0] = w / 2.0f;
-    m[1][1] = h / 2.0f;
-    m[2][2] = depth / 2.0f;
-    return m;
+    // Returns the face under pixel (x, y) of the written image, or -1.
+    // The projection maps (x, y, z) to (x, y) / (1 - z / c), so the camera ray through
+    // a pixel passes through (x_ndc, y_ndc, 0).
+    Matrix Viewport = camera_viewport(width, height, settings.zoom);
+    // the image is flipped before it's written, so y counts from the top
+    float x_ndc = (x - Viewport[0][3]) / Viewport[0][0];
+    float y_ndc = (height - 1 - y - Viewport[1][3]) / Viewport[1][1];
+    Vec3f dir(x_ndc, y_ndc, -camera.z);
+    float t;
+    Vec3f bary;
+    return bvh->raycast(camera, dir, t, bary);
 }
 
-const Vec3f camera(0, 0, 3);
-
-void flat_model(TGAImage &image, TGAImage &texture)
+void reorder_benchmark(TGAImage &texture, const char *model_path, int threads)
 {
-    Matrix Projection = Matrix::identity(4);
-    Projection[3][2] = -1.f / camera.z;
-
-    float *zbuffer = new float[image_width * image_height];
-    for (int i = 0; i < image_width * image_height; i++)
+    // Renders the same mesh in file order and in vertex-cache-optimized order
+    Model original(model_path);
+    Model optimized(model_path);
+    optimized.optimize();
+
+    Model *models[2] = {&original, &optimized};
+    const char *names[2] = {"file order", "optimized"};
+    const int frames = 50;
+    Model *previous = model;
+    BVH *previous_bvh = bvh;
+    bvh = NULL;
+    for (int m = 0; m < 2; m++)
     {
-        zbuffer[i] = std::numeric_limits<int>::min();
-    }
-    model = new Model("./head.obj");
-    std::cout << "model loaded" << std::endl;
-    Vec3f light_dir(0.0, 0.0, -1.0);
-    light_dir.normalize();
-    Matrix Viewport = viewport(image.get_width() / 8.0f, image.get_height() / 8.0f, image.get_width() * 3.0f / 4.0f, image.get_height() * 3.0 / 4.0f);
-    for (int i = 0; i < model->nfaces(); i++)
-    {
-        std::vector<int> pos_indices = model->tri_indices(i);
-        std::vector<int> tex_indices = model->uv_indices(i);
-        Vec3f screen_coords[3]; // vertices of the triangle in screen coordinates
-        Vec3f world_coords[3];  // vertices of the triangle in world coordinates
-        Vec2f uvs[3];
-        for (int j = 0; j < 3; j++)
+        model = models[m];
+        TGAImage image(image_width, image_height, TGAImage::RGB);
+        flat_model(image, texture, threads); // warm up
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < frames; i++)
         {
-            Vec3f world_coord = model->vert(pos_indices[j]);
-            // float z = original_world_coord.z;
-            // float denom = -1.0f / (z - camera.z);
-
-            // Vec3f world_coord(
-            //     original_world_coord.x,
-            //     original_world_coord.y,
-            //     original_world_coord.z);
-
-            // screen_coords[j].x = ((world_coord.x + 1.0) / 2.0 * image.get_width());
-            // screen_coords[j].y = ((world_coord.y + 1.0) / 2.0 * image.get_height());
-            // screen_coords[j].z = world_coord.z;
-            screen_coords[j] = matrix_to_vector(Viewport * Projection * vector_to_matrix(world_coord));
-
-            Vec2f uv = model->uv(tex_indices[j]);
-            uvs[j] = uv;
-
-            world_coords[j] = world_coord;
+            image.clear();
+            flat_model(image, texture, threads);
         }
-
-        std::cout << Viewport << std::endl;
-        std::cout << Projection << std::endl;
-        std::cout << screen_coords[0] << std::endl;
-        std::cout << world_coords << std::endl;
-
-        Vec3f normal = (world_coords[2] - world_coords[0]) ^ (world_coords[1] - world_coords[0]);
-        normal.normalize();
-        float brightness = normal * light_dir;
-        if (brightness < 0)
-            continue;
-
-        // std::cout << color;
-        triangle(
-            screen_coords[0],
-            screen_coords[1],
-            screen_coords[2],
-            uvs[0],
-            uvs[1],
-            uvs[2],
-            zbuffer,
-            image,
-            texture,
-            TGAColor(brightness * 255, brightness * 255, brightness * 255, 255),
-            false);
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        std::cout << names[m] << ": ACMR(16) " << model->acmr(16)
+                  << ", ACMR(32) " << model->acmr(32)
+                  << ", " << elapsed.count() / frames << " ms/frame" << std::endl;
     }
+    model = previous;
+    bvh = previous_bvh;
 }
 
 // void triangle_test(TGAImage &image)
@@ -356,11 +232,10 @@ void flat_model(TGAImage &image, TGAImage &texture)
 
 void wireframe(TGAImage &image)
 {
-    model = new Model("./head.obj");
     // For each face, draw all of its edges
     for (int i = 0; i < model->nfaces(); i++)
     {
-        std::vector<int> pos_indices = model->tri_indices(i);
+        FaceIndices pos_indices = model->tri_indices(i);
         // draw 3 edges, between vert j and vert j+1
         for (int j = 0; j < 3; j++)
         {
@@ -429,21 +304,336 @@ int main(int argc, char **argv)
 {
     // matrix_test();
     // return 0;
+    const char *model_path = "./head.obj";
+    bool optimize_mesh = false;
+    bool quantize = false;
+    bool run_reorder_benchmark = false;
+    bool use_bvh = true;
+    bool use_lod = false;
+    int lod_level = -1;
+    int pick_x = -1, pick_y = -1;
+    const char *obj_out = NULL;
+    const char *mesh_out = NULL;
+    const char *stats_out = NULL;
+    const char *manifest = NULL;
+    const char *serve = NULL;
+    int threads = 0;
+    int cache_mb = 512;
+    const char *overdraw_out = NULL;
+    const char *instances_file = NULL;
+    int chunk_faces = 0; // streaming if > 0
+    int strip_height = 0; // strips of this many rows if > 0
+    int procs = 0; // sort-last on this many processes if > 0
+    int bake_rays = 0; // bake the lighting with this many rays a vertex if > 0
+    bool bake_light = false;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--model") && i + 1 < argc)
+            model_path = argv[++i];
+        else if (!strcmp(argv[i], "--optimize"))
+            optimize_mesh = true;
+        else if (!strcmp(argv[i], "--quantize"))
+            quantize = true;
+        else if (!strcmp(argv[i], "--write-obj") && i + 1 < argc)
+            obj_out = argv[++i];
+        else if (!strcmp(argv[i], "--write-mesh") && i + 1 < argc)
+            mesh_out = argv[++i];
+        else if (!strcmp(argv[i], "--reorder-bench"))
+            run_reorder_benchmark = true;
+        else if (!strcmp(argv[i], "--zoom") && i + 1 < argc)
+            settings.zoom = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--no-bvh"))
+            use_bvh = false;
+        else if (!strcmp(argv[i], "--lod"))
+            use_lod = true;
+        else if (!strcmp(argv[i], "--lod-level") && i + 1 < argc)
+        {
+            use_lod = true;
+            lod_level = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--shading") && i + 1 < argc)
+            settings.shading = shading_from_name(argv[++i]);
+        else if (!strcmp(argv[i], "--depth") && i + 1 < argc)
+        {
+            if (!depth_format_from_name(argv[++i], settings.depth_format))
+            {
+                std::cerr << "unknown depth format " << argv[i] << ", use float, unorm24 or unorm16" << std::endl;
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--bc1"))
+            settings.compress_texture = true;
+        else if (!strcmp(argv[i], "--bake") && i + 1 < argc)
+            bake_rays = std::max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--bake-light"))
+            bake_light = true;
+        else if (!strcmp(argv[i], "--opacity") && i + 1 < argc)
+            settings.opacity = std::max(0.0f, std::min(1.0f, (float)atof(argv[++i])));
+        else if (!strcmp(argv[i], "--oit-fragments") && i + 1 < argc)
+            settings.oit_fragments = std::max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--z-prepass"))
+            settings.z_prepass = true;
+        else if (!strcmp(argv[i], "--shadows"))
+            settings.shadows = true;
+        else if (!strcmp(argv[i], "--light") && i + 3 < argc)
+        {
+            settings.light_dir.x = atof(argv[++i]);
+            settings.light_dir.y = atof(argv[++i]);
+            settings.light_dir.z = atof(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--size") && i + 1 < argc)
+            image_width = image_height = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--pick") && i + 2 < argc)
+        {
+            pick_x = atoi(argv[++i]);
+            pick_y = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--batch") && i + 1 < argc)
+            manifest = argv[++i];
+        else if (!strcmp(argv[i], "--serve") && i + 1 < argc)
+            serve = argv[++i];
+        else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+            threads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--cache-mb") && i + 1 < argc)
+            cache_mb = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--instances") && i + 1 < argc)
+            instances_file = argv[++i];
+        else if (!strcmp(argv[i], "--stream"))
+            chunk_faces = std::max(chunk_faces, 65536);
+        else if (!strcmp(argv[i], "--chunk-faces") && i + 1 < argc)
+            chunk_faces = std::max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--strips") && i + 1 < argc)
+            strip_height = std::max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--procs") && i + 1 < argc)
+            procs = std::max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--stats") && i + 1 < argc)
+            stats_out = argv[++i];
+        else if (!strcmp(argv[i], "--overdraw") && i + 1 < argc)
+            overdraw_out = argv[++i];
+        else
+        {
+            std::cerr << "usage: " << argv[0] << " [--model file.obj|file.mesh] [--optimize] [--quantize] [--write-obj out.obj] [--write-mesh out.mesh] [--reorder-bench] [--zoom f] [--no-bvh] [--pick x y] [--lod] [--lod-level n] [--size n] [--shading texture|flat|gouraud|phong|baked] [--bake rays] [--bake-light] [--depth float|unorm24|unorm16] [--z-prepass] [--shadows] [--opacity a [--oit-fragments n]] [--bc1] [--light x y z] [--instances file.txt [--threads n]] [--stream [--chunk-faces n]] [--strips rows] [--procs n] [--stats out.json] [--overdraw out.tga] [--batch manifest.txt [--threads n] [--cache-mb n]] [--serve socket|- [--threads n] [--cache-mb n]]" << std::endl;
+            return 1;
+        }
+    }
+#ifndef RENDER_STATS
+    if (stats_out || overdraw_out)
+    {
+        std::cerr << "built without stats, rebuild with `make clean && make STATS=1` for --stats/--overdraw" << std::endl;
+        return 1;
+    }
+#endif
+    if (serve)
+    {
+        // requests are manifest lines, on the socket or stdin, see server.h
+        return run_server(strcmp(serve, "-") ? serve : NULL, threads, (size_t)cache_mb << 20);
+    }
+    if (manifest)
+    {
+        // every job says which model, texture and size it wants, see batch.h
+        std::vector<BatchJob> jobs;
+        if (!read_manifest(manifest, jobs))
+            return 1;
+        return run_batch(jobs, threads, (size_t)cache_mb << 20, std::cout) ? 1 : 0;
+    }
+
+    if (chunk_faces > 0)
+    {
+        // the model is never loaded as a whole, see stream.h
+        TGAImage texture;
+        if (!read_texture(texture))
+        {
+            std::cerr << "Failed to load texture" << std::endl;
+            return 1;
+        }
+        settings.compressed_texture = compressed_texture.get();
+        TGAImage image(image_width, image_height, TGAImage::RGB);
+        StreamStats stream_stats;
+        if (!stream_render(model_path, &texture, settings, image, chunk_faces, stream_stats))
+            return 1;
+        std::cerr << "streamed " << stream_stats.faces << " faces in " << stream_stats.chunks << " chunks ("
+                  << stream_stats.passes << " passes), biggest chunk " << stream_stats.peak_chunk_bytes << " bytes, vertex attributes "
+                  << stream_stats.attribute_bytes << " bytes on disk" << std::endl;
+        image.flip_vertically();
+        image.write_tga_file(("out/output_" + std::to_string(std::time(0)) + ".tga").c_str());
+        std::cout << "out/output_" << std::to_string(std::time(0)) << ".tga";
+        return 0;
+    }
+
+    // The texture doesn't depend on the model, so it's read on another thread while
+    // this one parses the model and builds its BVH. Rendering waits for both, which
+    // takes as long as the slower one instead of the two one after the other.
+    auto load_start = std::chrono::steady_clock::now();
     TGAImage texture;
-    bool success = texture.read_tga_file("african_head_diffuse.tga");
-    if (!success)
+    std::future<bool> texture_ready;
+    if (pick_x < 0)
+        texture_ready = std::async(std::launch::async, [&texture]()
+                                   { return read_texture(texture); });
+
+    // owners of whatever `model` and `bvh` end up pointing to
+    std::unique_ptr<Model> loaded;
+    std::unique_ptr<LODChain> lods;
+    std::unique_ptr<BVH> built_bvh;
+    {
+        STATS_SCOPE(STAGE_LOAD);
+        loaded.reset(new Model(model_path));
+    }
+    model = loaded.get();
+    std::cout << "model loaded" << std::endl;
+    if (optimize_mesh)
+    {
+        float before = model->acmr();
+        model->optimize();
+        std::cout << "optimized mesh, ACMR " << before << " -> " << model->acmr() << std::endl;
+    }
+    if (bake_rays > 0 || bake_light || (settings.shading == SHADE_BAKED && !model->has_ao()))
+    {
+        // per vertex, for --shading baked, and kept in the file with --write-mesh
+        BVH bake_bvh(*model);
+        BakeSettings bake;
+        bake.rays = bake_rays > 0 ? bake_rays : bake.rays;
+        bake.irradiance = bake_light;
+        bake.light_dir = settings.light_dir;
+        BakeStats bake_stats;
+        bake_lighting(*model, bake_bvh, bake, workers(threads), bake_stats);
+        std::cerr << "baked " << bake_stats.rays << " rays in " << bake_stats.ms << " ms" << std::endl;
+    }
+    if (obj_out && !model->write_obj(obj_out))
+        return 1;
+    if (mesh_out && !model->write_binary(mesh_out))
+        return 1;
+    if (use_lod)
+    {
+        lods.reset(new LODChain(*model));
+        std::cerr << "LOD chain:";
+        for (int l = 0; l < lods->nlevels(); l++)
+            std::cerr << " " << lods->level(l)->nfaces();
+        std::cerr << " faces" << std::endl;
+        if (lod_level >= 0)
+        {
+            // that level for everything, no chain for the frame to pick from
+            int level = std::min(lod_level, lods->nlevels() - 1);
+            model = lods->level(level);
+            std::cerr << "LOD " << level << " of " << lods->nlevels() << ": " << model->nfaces() << " faces" << std::endl;
+        }
+        else
+            lod_chain = lods.get();
+    }
+    if (quantize)
+    {
+        // last, nothing after this needs the float copy
+        for (int l = 0; l < (lod_chain ? lod_chain->nlevels() : 1); l++)
+        {
+            QuantizeStats quantized;
+            if (!(lod_chain ? lod_chain->level(l) : model)->quantize(quantized))
+                return 1;
+            std::cerr << "quantized mesh: " << quantized.bytes_before << " -> " << quantized.bytes_after << " bytes, "
+                      << (quantized.index16 ? 16 : 32) << " bit indices, max error " << quantized.max_position_error << " (positions) "
+                      << quantized.max_uv_error << " (uvs)" << std::endl;
+        }
+    }
+    if (use_bvh || pick_x >= 0)
+    {
+        auto start = std::chrono::steady_clock::now();
+        built_bvh.reset(new BVH(*model));
+        bvh = built_bvh.get();
+        if (lod_chain)
+            lod_chain->build_bvhs();
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        std::cerr << "BVH: " << bvh->nnodes() << " nodes, built in " << elapsed.count() << " ms" << std::endl;
+    }
+    if (pick_x >= 0)
+    {
+        std::cout << "face under (" << pick_x << ", " << pick_y << "): " << pick(pick_x, pick_y, image_width, image_height) << std::endl;
+        return 0;
+    }
+
+    if (!texture_ready.get())
     {
         std::cerr << "Failed to load texture" << std::endl;
         return 1;
     }
+    settings.compressed_texture = compressed_texture.get();
+    std::chrono::duration<double, std::milli> load_time = std::chrono::steady_clock::now() - load_start;
+    std::cerr << "model, BVH and texture ready after " << load_time.count() << " ms" << std::endl;
+    if (run_reorder_benchmark)
+    {
+        reorder_benchmark(texture, model_path, threads);
+        return 0;
+    }
+    if (strip_height > 0)
+    {
+        // never the whole image in memory, see strips.h
+        if (settings.shadows)
+        {
+            std::cerr << "--strips can't do shadows" << std::endl;
+            return 1;
+        }
+        std::string filename = "out/output_" + std::to_string(std::time(0)) + ".tga";
+        StripStats strip_stats;
+        if (!strip_render(model, &texture, settings, image_width, image_height, strip_height, filename.c_str(), strip_stats))
+            return 1;
+        std::cerr << strip_stats.strips << " strips, " << strip_stats.binned << " binned faces, " << strip_stats.strip_bytes
+                  << " bytes a strip, bins " << strip_stats.bin_bytes << " bytes" << std::endl;
+        std::cout << filename;
+        return 0;
+    }
+    if (procs > 0 && instances_file)
+    {
+        std::cerr << "--procs can't do --instances" << std::endl;
+        return 1;
+    }
+    if (procs > 0 && settings.opacity < 1)
+    {
+        // the frames would have to be merged fragment by fragment
+        std::cerr << "--procs can't do --opacity" << std::endl;
+        return 1;
+    }
     TGAImage image(image_width, image_height, TGAImage::RGB);
+#ifdef RENDER_STATS
+    std::vector<unsigned short> overdraw;
+    if (overdraw_out)
+    {
+        overdraw.resize(image_width * image_height);
+        frame_stats.overdraw = &overdraw[0];
+        frame_stats.width = image_width;
+        frame_stats.height = image_height;
+    }
+#endif
     // lines(image);
     // wireframe(image);
     // triangle_test(image);
-    flat_model(image, texture);
-    image.flip_vertically();
-    // write to a file called out/output_<current_date_time>.tga
-    image.write_tga_file(("out/output_" + std::to_string(std::time(0)) + ".tga").c_str());
+    if (instances_file)
+    {
+        // one "x y z [yaw [scale]]" per line, see read_instances()
+        std::vector<Mat4> instances;
+        if (!read_instances(instances_file, instances))
+            return 1;
+        instanced_model(image, texture, instances, threads);
+    }
+    else if (procs > 0)
+    {
+        // the faces split between processes and their frames depth composited, see sortlast.h
+        SortLastStats sort_last_stats;
+        if (!sort_last_render(model, bvh, &texture, settings, image, procs, sort_last_stats))
+            return 1;
+        std::cerr << sort_last_stats.processes << " processes, slowest frame " << sort_last_stats.render_ms << " ms, composited in "
+                  << sort_last_stats.composite_ms << " ms, " << sort_last_stats.shared_bytes << " bytes shared" << std::endl;
+    }
+    else
+        flat_model(image, texture, threads);
+    {
+        STATS_SCOPE(STAGE_ENCODE);
+        image.flip_vertically();
+        // write to a file called out/output_<current_date_time>.tga
+        image.write_tga_file(("out/output_" + std::to_string(std::time(0)) + ".tga").c_str());
+    }
+#ifdef RENDER_STATS
+    if (stats_out && !frame_stats.write_json(stats_out))
+        return 1;
+    if (overdraw_out && !frame_stats.write_overdraw(overdraw_out))
+        return 1;
+#endif
     std::cout << "out/output_" << std::to_string(std::time(0)) << ".tga";
     return 0;
 }
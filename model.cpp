@@ -3,119 +3,896 @@
 #include <fstream>
 #include <sstream>
 #include <vector>
+#include <cmath>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
 #include "model.h"
 
 // Rewritten following the sample code (not copied):
 // https://github.com/ssloy/tinyrenderer/blob/f6fecb7ad493264ecd15e230411bfb1cca539a12/model.cpp
 
-Model::Model(const char *filename) : verts_(), tris_(), uvs_()
+ObjLine parse_obj_line(const std::string &line, Vec3f &v, Vec2f &uv, Triangle &tri)
 {
+  std::istringstream iss(line); // convert string to stream
+  char trash;
+  // line.compare returns 0 if the substring is an exact match, so this condition is
+  // first 2 characters === "v "
+  if (!line.compare(0, 2, "v "))
+  {
+    // '>>' is whitespace-delimited (can be customized in the getline call, default is space)
+    // So this "throws out" the "v" at the beginning
+    // vertex lines are formatted `v pos_x_float pos_y_float pos_z_float`
+    iss >> trash;
+    for (int i = 0; i < 3; i++)
+    {
+      iss >> v.raw[i];
+    }
+    return OBJ_VERTEX;
+  }
+  if (!line.compare(0, 2, "f "))
+  {
+    // face lines are formatted `f vert_index_0/texture_index_0/normal_index_0 vert_index_1/...`
+    // f contains the indices of the face (should have 3). A face without normals has
+    // just `vert_index/texture_index` corners, and gets no normal indices at all.
+    tri.pos_indices.clear();
+    tri.tex_indices.clear();
+    tri.norm_indices.clear();
+    int norm_idx, tex_idx, pos_idx;
+    bool normals = true;
+    std::string corner;
+    iss >> trash; // throw out "f"
+    while (iss >> corner)
+    {
+      int n = sscanf(corner.c_str(), "%d/%d/%d", &pos_idx, &tex_idx, &norm_idx);
+      if (n < 2)
+      {
+        break;
+      }
+      // in obj files, indices are 1-indexed for some reason
+      tri.pos_indices.push_back(pos_idx - 1);
+      tri.tex_indices.push_back(tex_idx - 1);
+      if (n == 3)
+      {
+        tri.norm_indices.push_back(norm_idx - 1);
+      }
+      normals = normals && n == 3;
+    }
+    if (!normals)
+    {
+      tri.norm_indices.clear();
+    }
+    return OBJ_FACE;
+  }
+  if (!line.compare(0, 4, "vt  "))
+  {
+    // throw out "v"
+    iss >> trash;
+    // throw out "t  "
+    iss >> trash;
+    for (int i = 0; i < 3; i++)
+    {
+      if (i == 2)
+      {
+        iss >> trash;
+      }
+      else
+      {
+        iss >> uv.raw[i];
+      }
+    }
+    return OBJ_UV;
+  }
+  if (!line.compare(0, 3, "vn "))
+  {
+    // normal lines are formatted `vn  x y z` (same as vertices)
+    iss >> trash >> trash;
+    for (int i = 0; i < 3; i++)
+    {
+      iss >> v.raw[i];
+    }
+    return OBJ_NORMAL;
+  }
+  return OBJ_OTHER;
+}
+
+// whether an OBJ face has three corners that point at attributes that exist (all of
+// its normals, or none)
+static bool valid_face(const Triangle &tri, size_t nverts, size_t nuvs, size_t nnorms)
+{
+  if (tri.pos_indices.size() < 3 || (!tri.norm_indices.empty() && tri.norm_indices.size() != tri.pos_indices.size()))
+  {
+    return false;
+  }
+  for (size_t j = 0; j < tri.pos_indices.size(); j++)
+  {
+    if (tri.pos_indices[j] < 0 || (size_t)tri.pos_indices[j] >= nverts || tri.tex_indices[j] < 0 || (size_t)tri.tex_indices[j] >= nuvs)
+    {
+      return false;
+    }
+  }
+  for (size_t j = 0; j < tri.norm_indices.size(); j++)
+  {
+    if (tri.norm_indices[j] < 0 || (size_t)tri.norm_indices[j] >= nnorms)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+Model::Model(const char *filename) : verts_(), tris_(), uvs_(), norms_(), quantized_(false)
+{
+  size_t len = strlen(filename);
+  std::string obj_fallback;
+  if (len > 5 && !strcmp(filename + len - 5, ".mesh"))
+  {
+    if (load_binary(filename))
+    {
+      std::cerr << "#vertices: " << verts_.size() << ", #tris " << tris_.size() << std::endl;
+      return;
+    }
+    // a bad .mesh is usually a cache of an OBJ next to it, so go back to that
+    obj_fallback = std::string(filename, len - 5) + ".obj";
+    filename = obj_fallback.c_str();
+    std::cerr << "falling back to " << filename << std::endl;
+  }
+
   std::ifstream in; // input file stream
   in.open(filename, std::ifstream::in);
   if (in.fail())
   {
-    std::cout << "Failed to open file" << std::endl;
+    std::cerr << "Failed to open file " << filename << std::endl;
     return;
   }
 
   std::string line;
+  Vec3f v;
+  Vec2f uv;
+  Triangle tri;
   while (!in.eof())
   {
     std::getline(in, line);
-    std::istringstream iss(line); // convert string to stream
-    char trash;
-    // line.compare returns 0 if the substring is an exact match, so this condition is
-    // first 2 characters === "v "
-    if (!line.compare(0, 2, "v "))
-    {
-      // '>>' is whitespace-delimited (can be customized in the getline call, default is space)
-      // So this "throws out" the "v" at the beginning
-      // vertex lines are formatted `v pos_x_float pos_y_float pos_z_float`
-      iss >> trash;
-      Vec3f v;
-      for (int i = 0; i < 3; i++)
-      {
-        iss >> v.raw[i];
-      }
+    switch (parse_obj_line(line, v, uv, tri))
+    {
+    case OBJ_VERTEX:
       verts_.push_back(v);
-    }
-    else if (!line.compare(0, 2, "f "))
-    {
-      // face lines are formatted `f vert_index_0/texture_index_0/normal_index_0 vert_index_1/...`
-      // f contains the indices of the face (should have 3)
-      std::vector<int> pos_indices;
-      std::vector<int> tex_indices;
-      int itrash, tex_idx, pos_idx;
-      iss >> trash; // throw out "f"
-      // slashes are written to `trash`, unused indices are written to `itrash`
-      // so the first index is written to idx, and the rest is thrown out
-      while (iss >> pos_idx >> trash >> tex_idx >> trash >> itrash)
-      {
-        // in obj files, indices are 1-indexed for some reason
-        pos_idx--;
-        tex_idx--;
-        pos_indices.push_back(pos_idx);
-        tex_indices.push_back(tex_idx);
-      }
-      Triangle tri;
-      tri.pos_indices = pos_indices;
-      tri.tex_indices = tex_indices;
+      break;
+    case OBJ_UV:
+      uvs_.push_back(uv);
+      break;
+    case OBJ_NORMAL:
+      norms_.push_back(v);
+      break;
+    case OBJ_FACE:
       tris_.push_back(tri);
+      break;
+    default:
+      break;
     }
-    else if (!line.compare(0, 4, "vt  "))
+  }
+  // like load_binary(), nothing past the end of the attributes gets drawn
+  size_t nvalid = 0;
+  for (size_t t = 0; t < tris_.size(); t++)
+  {
+    if (valid_face(tris_[t], verts_.size(), uvs_.size(), norms_.size()))
     {
-      Vec2f uv;
-      // throw out "v"
-      iss >> trash;
-      // throw out "t  "
-      iss >> trash;
-      for (int i = 0; i < 3; i++)
-      {
-        if (i == 2)
-        {
-          iss >> trash;
-        }
-        else
-        {
-          iss >> uv.raw[i];
-        }
-      }
-      uvs_.push_back(uv);
+      tris_[nvalid++] = tris_[t];
     }
   }
+  if (nvalid < tris_.size())
+  {
+    std::cerr << "skipped " << tris_.size() - nvalid << " faces that point past the end of their attributes in " << filename << std::endl;
+    tris_.resize(nvalid);
+  }
   std::cerr << "#vertices: " << verts_.size() << ", #tris " << tris_.size() << std::endl;
 }
 
+Model::Model(const std::vector<Vec3f> &verts, const std::vector<Vec2f> &uvs, const std::vector<Vec3f> &norms, const std::vector<Triangle> &tris)
+    : verts_(verts), tris_(tris), uvs_(uvs), norms_(norms), quantized_(false)
+{
+}
+
 Model::~Model() {}
 
 int Model::nverts()
 {
-  return (int)verts_.size();
+  return quantized_ ? (int)(qverts_.size() / 3) : (int)verts_.size();
 }
 
 int Model::nfaces()
 {
+  if (quantized_)
+  {
+    return (int)((qfaces16_.size() + qfaces32_.size()) / 9);
+  }
   return (int)tris_.size();
 }
 
-std::vector<int> Model::tri_indices(int tri_index)
+size_t Model::memory_size()
+{
+  size_t size = sizeof(Model);
+  size += verts_.capacity() * sizeof(Vec3f) + uvs_.capacity() * sizeof(Vec2f) + norms_.capacity() * sizeof(Vec3f);
+  size += (ao_.capacity() + irradiance_.capacity()) * sizeof(float);
+  size += (qverts_.capacity() + quvs_.capacity() + qfaces16_.capacity()) * sizeof(unsigned short) + qfaces32_.capacity() * sizeof(int);
+  size += tris_.capacity() * sizeof(Triangle);
+  for (size_t i = 0; i < tris_.size(); i++)
+  {
+    size += (tris_[i].pos_indices.capacity() + tris_[i].tex_indices.capacity() + tris_[i].norm_indices.capacity()) * sizeof(int);
+  }
+  return size;
+}
+
+void Model::set_baked(const std::vector<float> &ao, const std::vector<float> &irradiance)
+{
+  ao_ = ao;
+  irradiance_ = irradiance;
+}
+
+// the first three of `indices`, -1 for any that are missing
+static FaceIndices first_three(const std::vector<int> &indices)
+{
+  FaceIndices face;
+  for (int k = 0; k < 3; k++)
+  {
+    face.v[k] = k < (int)indices.size() ? indices[k] : -1;
+  }
+  return face;
+}
+
+FaceIndices Model::qface(int tri_index, int attribute)
+{
+  FaceIndices face;
+  size_t first = 9 * (size_t)tri_index + 3 * attribute;
+  for (int k = 0; k < 3; k++)
+  {
+    if (qfaces16_.empty())
+    {
+      face.v[k] = qfaces32_[first + k];
+    }
+    else
+    {
+      unsigned short i = qfaces16_[first + k];
+      face.v[k] = i == 0xffff ? -1 : i;
+    }
+  }
+  return face;
+}
+
+FaceIndices Model::tri_indices(int tri_index)
 {
-  return tris_[tri_index].pos_indices;
+  return quantized_ ? qface(tri_index, 0) : first_three(tris_[tri_index].pos_indices);
 }
 
 Vec3f Model::vert(int idx)
 {
-  return verts_[idx];
+  if (!quantized_)
+  {
+    return verts_[idx];
+  }
+  const unsigned short *q = &qverts_[3 * (size_t)idx];
+  return Vec3f(qvert_min_.x + q[0] * qvert_step_.x, qvert_min_.y + q[1] * qvert_step_.y, qvert_min_.z + q[2] * qvert_step_.z);
 }
 
 Vec2f Model::uv(int idx)
 {
-  return uvs_[idx];
+  if (!quantized_)
+  {
+    return uvs_[idx];
+  }
+  const unsigned short *q = &quvs_[2 * (size_t)idx];
+  return Vec2f(quv_min_.x + q[0] * quv_step_.x, quv_min_.y + q[1] * quv_step_.y);
+}
+
+Vec3f Model::norm(int idx)
+{
+  return norms_[idx];
+}
+
+FaceIndices Model::uv_indices(int tri_index)
+{
+  return quantized_ ? qface(tri_index, 1) : first_three(tris_[tri_index].tex_indices);
+}
+
+FaceIndices Model::norm_indices(int tri_index)
+{
+  return quantized_ ? qface(tri_index, 2) : first_three(tris_[tri_index].norm_indices);
+}
+
+// Where 16 bit values between lo and hi go: q * step + lo
+static float quantize_step(float lo, float hi)
+{
+  return hi > lo ? (hi - lo) / 65535.0f : 0.0f;
+}
+
+static unsigned short quantize_value(float x, float lo, float step)
+{
+  if (step == 0)
+  {
+    return 0;
+  }
+  return (unsigned short)std::min(65535.0f, std::max(0.0f, std::floor((x - lo) / step + 0.5f)));
+}
+
+bool Model::quantize(QuantizeStats &stats)
+{
+  if (quantized_)
+  {
+    return false;
+  }
+  for (size_t t = 0; t < tris_.size(); t++)
+  {
+    if (tris_[t].pos_indices.size() != 3 || tris_[t].tex_indices.size() != 3)
+    {
+      std::cerr << "only meshes of triangles can be quantized" << std::endl;
+      return false;
+    }
+  }
+  stats.bytes_before = memory_size();
+
+  Vec3f lo(0, 0, 0), hi(0, 0, 0);
+  for (size_t i = 0; i < verts_.size(); i++)
+  {
+    for (int k = 0; k < 3; k++)
+    {
+      lo.raw[k] = i ? std::min(lo.raw[k], verts_[i].raw[k]) : verts_[i].raw[k];
+      hi.raw[k] = i ? std::max(hi.raw[k], verts_[i].raw[k]) : verts_[i].raw[k];
+    }
+  }
+  qvert_min_ = lo;
+  for (int k = 0; k < 3; k++)
+  {
+    qvert_step_.raw[k] = quantize_step(lo.raw[k], hi.raw[k]);
+  }
+  Vec2f uv_lo(0, 0), uv_hi(0, 0);
+  for (size_t i = 0; i < uvs_.size(); i++)
+  {
+    for (int k = 0; k < 2; k++)
+    {
+      uv_lo.raw[k] = i ? std::min(uv_lo.raw[k], uvs_[i].raw[k]) : uvs_[i].raw[k];
+      uv_hi.raw[k] = i ? std::max(uv_hi.raw[k], uvs_[i].raw[k]) : uvs_[i].raw[k];
+    }
+  }
+  quv_min_ = uv_lo;
+  for (int k = 0; k < 2; k++)
+  {
+    quv_step_.raw[k] = quantize_step(uv_lo.raw[k], uv_hi.raw[k]);
+  }
+
+  qverts_.resize(3 * verts_.size());
+  for (size_t i = 0; i < verts_.size(); i++)
+  {
+    for (int k = 0; k < 3; k++)
+    {
+      unsigned short q = quantize_value(verts_[i].raw[k], qvert_min_.raw[k], qvert_step_.raw[k]);
+      qverts_[3 * i + k] = q;
+      stats.max_position_error = std::max(stats.max_position_error, std::abs(qvert_min_.raw[k] + q * qvert_step_.raw[k] - verts_[i].raw[k]));
+    }
+  }
+  quvs_.resize(2 * uvs_.size());
+  for (size_t i = 0; i < uvs_.size(); i++)
+  {
+    for (int k = 0; k < 2; k++)
+    {
+      unsigned short q = quantize_value(uvs_[i].raw[k], quv_min_.raw[k], quv_step_.raw[k]);
+      quvs_[2 * i + k] = q;
+      stats.max_uv_error = std::max(stats.max_uv_error, std::abs(quv_min_.raw[k] + q * quv_step_.raw[k] - uvs_[i].raw[k]));
+    }
+  }
+
+  // 0xffff is kept for "no normal"
+  stats.index16 = std::max(verts_.size(), std::max(uvs_.size(), norms_.size())) < 0xffff;
+  std::vector<int> faces(9 * tris_.size());
+  for (size_t t = 0; t < tris_.size(); t++)
+  {
+    FaceIndices pos = first_three(tris_[t].pos_indices), uv = first_three(tris_[t].tex_indices), norm = first_three(tris_[t].norm_indices);
+    for (int k = 0; k < 3; k++)
+    {
+      faces[9 * t + k] = pos[k];
+      faces[9 * t + 3 + k] = uv[k];
+      faces[9 * t + 6 + k] = norm[k];
+    }
+  }
+  if (stats.index16)
+  {
+    qfaces16_.resize(faces.size());
+    for (size_t i = 0; i < faces.size(); i++)
+    {
+      qfaces16_[i] = faces[i] < 0 ? 0xffff : (unsigned short)faces[i];
+    }
+  }
+  else
+  {
+    qfaces32_.swap(faces);
+  }
+
+  // swapped with empty ones so the memory really goes
+  std::vector<Vec3f>().swap(verts_);
+  std::vector<Vec2f>().swap(uvs_);
+  std::vector<Triangle>().swap(tris_);
+  quantized_ = true;
+  stats.bytes_after = memory_size();
+  return true;
+}
+
+// Vertex scoring from Tom Forsyth's "Linear-Speed Vertex Cache Optimisation"
+// (https://tomforsyth1000.github.io/papers/fast_vert_cache_opt.html).
+// A vertex scores higher the more recently it was used (it's still in the cache)
+// and the fewer triangles it has left (so we finish off lonely vertices instead of
+// leaving them behind to be fetched again much later).
+static float forsyth_vertex_score(int cache_position, int remaining_tris, int cache_size)
+{
+  if (remaining_tris == 0)
+  {
+    return -1.0f;
+  }
+  float score = 0.0f;
+  if (cache_position >= 0)
+  {
+    if (cache_position < 3)
+    {
+      // the vertices of the last triangle get a fixed score so the next triangle
+      // doesn't just "fan" off of the previous one forever
+      score = 0.75f;
+    }
+    else
+    {
+      float scaler = 1.0f / (cache_size - 3);
+      score = std::pow(1.0f - (cache_position - 3) * scaler, 1.5f);
+    }
+  }
+  score += 2.0f * std::pow((float)remaining_tris, -0.5f);
+  return score;
+}
+
+void Model::optimize(int cache_size)
+{
+  if (quantized_)
+  {
+    std::cerr << "a quantized model can't be optimized" << std::endl;
+    return;
+  }
+  int nv = (int)verts_.size();
+  int nt = (int)tris_.size();
+  if (nt == 0)
+  {
+    return;
+  }
+
+  // vertex -> triangles adjacency, stored CSR style (offsets into one flat array)
+  std::vector<int> remaining(nv, 0);
+  for (int t = 0; t < nt; t++)
+  {
+    for (size_t j = 0; j < tris_[t].pos_indices.size(); j++)
+    {
+      remaining[tris_[t].pos_indices[j]]++;
+    }
+  }
+  std::vector<int> offsets(nv + 1, 0);
+  for (int v = 0; v < nv; v++)
+  {
+    offsets[v + 1] = offsets[v] + remaining[v];
+  }
+  std::vector<int> adjacency(offsets[nv]);
+  std::vector<int> fill(offsets.begin(), offsets.end() - 1);
+  for (int t = 0; t < nt; t++)
+  {
+    for (size_t j = 0; j < tris_[t].pos_indices.size(); j++)
+    {
+      adjacency[fill[tris_[t].pos_indices[j]]++] = t;
+    }
+  }
+
+  std::vector<int> cache_position(nv, -1);
+  std::vector<float> vertex_score(nv);
+  for (int v = 0; v < nv; v++)
+  {
+    vertex_score[v] = forsyth_vertex_score(-1, remaining[v], cache_size);
+  }
+  std::vector<float> tri_score(nt, 0.0f);
+  std::vector<bool> emitted(nt, false);
+  for (int t = 0; t < nt; t++)
+  {
+    for (size_t j = 0; j < tris_[t].pos_indices.size(); j++)
+    {
+      tri_score[t] += vertex_score[tris_[t].pos_indices[j]];
+    }
+  }
+
+  std::vector<int> order;
+  order.reserve(nt);
+  // the cache has 3 extra slots so the vertices pushed out by the newest triangle
+  // can still be updated before they're forgotten
+  std::vector<int> cache;
+  std::vector<int> new_cache;
+  int best = -1;
+  int scan = 0; // everything before `scan` has already been emitted
+  while ((int)order.size() < nt)
+  {
+    if (best < 0)
+    {
+      // nothing in the cache touches an unemitted triangle, so fall back to a
+      // linear scan for the best remaining triangle
+      float best_score = -1.0f;
+      while (scan < nt && emitted[scan])
+      {
+        scan++;
+      }
+      for (int t = scan; t < nt; t++)
+      {
+        if (!emitted[t] && tri_score[t] > best_score)
+        {
+          best_score = tri_score[t];
+          best = t;
+        }
+      }
+    }
+
+    emitted[best] = true;
+    order.push_back(best);
+
+    // remove the triangle from its vertices' adjacency lists, and move its vertices
+    // to the front of the cache
+    new_cache.clear();
+    const std::vector<int> &tri = tris_[best].pos_indices;
+    for (size_t j = 0; j < tri.size(); j++)
+    {
+      int v = tri[j];
+      int *begin = &adjacency[offsets[v]];
+      int *end = begin + remaining[v];
+      for (int *it = begin; it != end; it++)
+      {
+        if (*it == best)
+        {
+          *it = *(end - 1);
+          break;
+        }
+      }
+      remaining[v]--;
+      new_cache.push_back(v);
+    }
+    for (size_t i = 0; i < cache.size(); i++)
+    {
+      int v = cache[i];
+      if (std::find(tri.begin(), tri.end(), v) == tri.end())
+      {
+        new_cache.push_back(v);
+      }
+    }
+    std::swap(cache, new_cache);
+
+    // rescore everything that was or is in the cache, and pick the best
+    // triangle touching the cache for the next iteration
+    for (size_t i = 0; i < cache.size(); i++)
+    {
+      int v = cache[i];
+      cache_position[v] = (int)i < cache_size ? (int)i : -1;
+      float score = forsyth_vertex_score(cache_position[v], remaining[v], cache_size);
+      float delta = score - vertex_score[v];
+      vertex_score[v] = score;
+      for (int k = offsets[v]; k < offsets[v] + remaining[v]; k++)
+      {
+        tri_score[adjacency[k]] += delta;
+      }
+    }
+    if ((int)cache.size() > cache_size)
+    {
+      cache.resize(cache_size);
+    }
+    best = -1;
+    float best_score = -1.0f;
+    for (size_t i = 0; i < cache.size(); i++)
+    {
+      int v = cache[i];
+      for (int k = offsets[v]; k < offsets[v] + remaining[v]; k++)
+      {
+        int t = adjacency[k];
+        if (tri_score[t] > best_score)
+        {
+          best_score = tri_score[t];
+          best = t;
+        }
+      }
+    }
+  }
+
+  std::vector<Triangle> tris(nt);
+  for (int i = 0; i < nt; i++)
+  {
+    tris[i] = tris_[order[i]];
+  }
+
+  // renumber every attribute stream in first-use order so the vertex fetches
+  // walk forward through memory as well
+  std::vector<int> pos_remap(verts_.size(), -1);
+  std::vector<int> tex_remap(uvs_.size(), -1);
+  std::vector<int> norm_remap(norms_.size(), -1);
+  std::vector<Vec3f> verts;
+  std::vector<Vec2f> uvs;
+  std::vector<Vec3f> norms;
+  std::vector<float> ao, irradiance; // go with the positions
+  for (int i = 0; i < nt; i++)
+  {
+    Triangle &tri = tris[i];
+    for (size_t j = 0; j < tri.pos_indices.size(); j++)
+    {
+      int &p = tri.pos_indices[j];
+      if (pos_remap[p] < 0)
+      {
+        pos_remap[p] = (int)verts.size();
+        verts.push_back(verts_[p]);
+        if (!ao_.empty())
+          ao.push_back(ao_[p]);
+        if (!irradiance_.empty())
+          irradiance.push_back(irradiance_[p]);
+      }
+      p = pos_remap[p];
+    }
+    for (size_t j = 0; j < tri.tex_indices.size(); j++)
+    {
+      int &t = tri.tex_indices[j];
+      if (tex_remap[t] < 0)
+      {
+        tex_remap[t] = (int)uvs.size();
+        uvs.push_back(uvs_[t]);
+      }
+      t = tex_remap[t];
+    }
+    for (size_t j = 0; j < tri.norm_indices.size() && !norms_.empty(); j++)
+    {
+      int &n = tri.norm_indices[j];
+      if (norm_remap[n] < 0)
+      {
+        norm_remap[n] = (int)norms.size();
+        norms.push_back(norms_[n]);
+      }
+      n = norm_remap[n];
+    }
+  }
+  // unreferenced attributes are dropped
+  verts_.swap(verts);
+  ao_.swap(ao);
+  irradiance_.swap(irradiance);
+  uvs_.swap(uvs);
+  if (!norms_.empty())
+  {
+    norms_.swap(norms);
+  }
+  tris_.swap(tris);
+}
+
+float Model::acmr(int cache_size)
+{
+  int nt = nfaces();
+  if (nt == 0)
+  {
+    return 0.0f;
+  }
+  std::vector<int> fifo(cache_size, -1);
+  int head = 0;
+  int misses = 0;
+  for (int t = 0; t < nt; t++)
+  {
+    FaceIndices face = tri_indices(t);
+    for (size_t j = 0; j < face.size(); j++)
+    {
+      int v = face[j];
+      if (std::find(fifo.begin(), fifo.end(), v) == fifo.end())
+      {
+        fifo[head] = v;
+        head = (head + 1) % cache_size;
+        misses++;
+      }
+    }
+  }
+  return misses / (float)nt;
 }
 
-std::vector<int> Model::uv_indices(int tri_index)
+bool Model::write_obj(const char *filename)
+{
+  if (quantized_)
+  {
+    std::cerr << "a quantized model can't be written out" << std::endl;
+    return false;
+  }
+  std::ofstream out(filename);
+  if (!out.is_open())
+  {
+    std::cerr << "can't open file " << filename << std::endl;
+    return false;
+  }
+  // same layout as head.obj (including the double spaces the parser expects)
+  for (size_t i = 0; i < verts_.size(); i++)
+  {
+    out << "v " << verts_[i].x << " " << verts_[i].y << " " << verts_[i].z << "\n";
+  }
+  for (size_t i = 0; i < uvs_.size(); i++)
+  {
+    out << "vt  " << uvs_[i].x << " " << uvs_[i].y << " 0.000\n";
+  }
+  for (size_t i = 0; i < norms_.size(); i++)
+  {
+    out << "vn  " << norms_[i].x << " " << norms_[i].y << " " << norms_[i].z << "\n";
+  }
+  for (size_t t = 0; t < tris_.size(); t++)
+  {
+    const Triangle &tri = tris_[t];
+    out << "f";
+    for (size_t j = 0; j < tri.pos_indices.size(); j++)
+    {
+      // a face without normals is written without them, the shaders use its face normal
+      out << " " << tri.pos_indices[j] + 1 << "/" << tri.tex_indices[j] + 1;
+      if (j < tri.norm_indices.size())
+      {
+        out << "/" << tri.norm_indices[j] + 1;
+      }
+    }
+    out << "\n";
+  }
+  return out.good();
+}
+
+/*
+
+Binary mesh layout (little endian, everything 4 bytes wide):
+  char[4]  magic "MESH"
+  uint32   version (2)
+  uint32   nverts, nuvs, nnorms, nfaces
+  uint32   nao, nirradiance   (0 or nverts, not in version 1 files)
+  float    verts[nverts][3]
+  float    uvs[nuvs][2]
+  float    norms[nnorms][3]
+  int32    faces[nfaces][9]   (pos0 pos1 pos2 uv0 uv1 uv2 norm0 norm1 norm2, -1 = no normal)
+  float    ao[nao]
+  float    irradiance[nirradiance]
+
+Only triangles can be stored.
+
+*/
+static const char mesh_magic[4] = {'M', 'E', 'S', 'H'};
+static const uint32_t mesh_version = 2;
+
+bool Model::write_binary(const char *filename)
 {
-  return tris_[tri_index].tex_indices;
+  if (quantized_)
+  {
+    std::cerr << "a quantized model can't be written out" << std::endl;
+    return false;
+  }
+  std::ofstream out(filename, std::ios::binary);
+  if (!out.is_open())
+  {
+    std::cerr << "can't open file " << filename << std::endl;
+    return false;
+  }
+  uint32_t header[7] = {mesh_version, (uint32_t)verts_.size(), (uint32_t)uvs_.size(), (uint32_t)norms_.size(), (uint32_t)tris_.size(),
+                        (uint32_t)ao_.size(), (uint32_t)irradiance_.size()};
+  out.write(mesh_magic, sizeof(mesh_magic));
+  out.write((char *)header, sizeof(header));
+  // Vec3f/Vec2f are plain unions of floats, so the arrays can be dumped directly
+  out.write((char *)verts_.data(), verts_.size() * sizeof(Vec3f));
+  out.write((char *)uvs_.data(), uvs_.size() * sizeof(Vec2f));
+  out.write((char *)norms_.data(), norms_.size() * sizeof(Vec3f));
+  for (size_t t = 0; t < tris_.size(); t++)
+  {
+    const Triangle &tri = tris_[t];
+    if (tri.pos_indices.size() != 3)
+    {
+      std::cerr << "binary meshes only support triangles" << std::endl;
+      return false;
+    }
+    int32_t face[9];
+    for (int j = 0; j < 3; j++)
+    {
+      face[j] = tri.pos_indices[j];
+      face[3 + j] = tri.tex_indices[j];
+      face[6 + j] = j < (int)tri.norm_indices.size() ? tri.norm_indices[j] : -1;
+    }
+    out.write((char *)face, sizeof(face));
+  }
+  out.write((char *)ao_.data(), ao_.size() * sizeof(float));
+  out.write((char *)irradiance_.data(), irradiance_.size() * sizeof(float));
+  return out.good();
+}
+
+// whether the corners of a stored face point at attributes that exist
+static bool valid_face(const int32_t face[9], uint32_t nverts, uint32_t nuvs, uint32_t nnorms)
+{
+  for (int j = 0; j < 3; j++)
+  {
+    if (face[j] < 0 || (uint32_t)face[j] >= nverts || face[3 + j] < 0 || (uint32_t)face[3 + j] >= nuvs)
+    {
+      return false;
+    }
+  }
+  // either no normals at all, or three that exist
+  if (face[6] == -1 && face[7] == -1 && face[8] == -1)
+  {
+    return true;
+  }
+  for (int j = 6; j < 9; j++)
+  {
+    if (face[j] < 0 || (uint32_t)face[j] >= nnorms)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Model::load_binary(const char *filename)
+{
+  std::ifstream in(filename, std::ios::binary);
+  if (!in.is_open())
+  {
+    std::cerr << "Failed to open file " << filename << std::endl;
+    return false;
+  }
+  in.seekg(0, std::ios::end);
+  uint64_t file_size = (uint64_t)in.tellg();
+  in.seekg(0, std::ios::beg);
+  char magic[4];
+  // version 1 files have no bake, and stop at nfaces
+  uint32_t header[7] = {0};
+  in.read(magic, sizeof(magic));
+  in.read((char *)header, 5 * sizeof(uint32_t));
+  if (in.good() && header[0] == mesh_version)
+  {
+    in.read((char *)(header + 5), 2 * sizeof(uint32_t));
+  }
+  if (!in.good() || memcmp(magic, mesh_magic, sizeof(magic)) || header[0] < 1 || header[0] > mesh_version ||
+      (header[5] && header[5] != header[1]) || (header[6] && header[6] != header[1]))
+  {
+    std::cerr << "not a binary mesh: " << filename << std::endl;
+    return false;
+  }
+  // the counts have to add up to the file's size before anything gets allocated for them
+  uint64_t expected = (uint64_t)in.tellg() + (uint64_t)header[1] * sizeof(Vec3f) + (uint64_t)header[2] * sizeof(Vec2f) +
+                      (uint64_t)header[3] * sizeof(Vec3f) + (uint64_t)header[4] * 9 * sizeof(int32_t) +
+                      ((uint64_t)header[5] + header[6]) * sizeof(float);
+  if (expected != file_size)
+  {
+    std::cerr << "truncated or corrupt binary mesh: " << filename << std::endl;
+    return false;
+  }
+  verts_.resize(header[1]);
+  uvs_.resize(header[2]);
+  norms_.resize(header[3]);
+  tris_.resize(header[4]);
+  ao_.resize(header[5]);
+  irradiance_.resize(header[6]);
+  in.read((char *)verts_.data(), verts_.size() * sizeof(Vec3f));
+  in.read((char *)uvs_.data(), uvs_.size() * sizeof(Vec2f));
+  in.read((char *)norms_.data(), norms_.size() * sizeof(Vec3f));
+  bool valid = true;
+  for (size_t t = 0; t < tris_.size() && valid; t++)
+  {
+    int32_t face[9];
+    in.read((char *)face, sizeof(face));
+    valid = valid_face(face, header[1], header[2], header[3]);
+    Triangle &tri = tris_[t];
+    tri.pos_indices.assign(face, face + 3);
+    tri.tex_indices.assign(face + 3, face + 6);
+    if (face[6] >= 0)
+    {
+      tri.norm_indices.assign(face + 6, face + 9);
+    }
+  }
+  in.read((char *)ao_.data(), ao_.size() * sizeof(float));
+  in.read((char *)irradiance_.data(), irradiance_.size() * sizeof(float));
+  if (!in.good() || !valid)
+  {
+    std::cerr << (valid ? "an error occured while reading " : "a face points past the end of its attributes in ") << filename << std::endl;
+    verts_.clear();
+    uvs_.clear();
+    norms_.clear();
+    tris_.clear();
+    ao_.clear();
+    irradiance_.clear();
+    return false;
+  }
+  return true;
 }
 
 // std::string Model::print_uvs()
@@ -11,6 +11,40 @@ public:
   ~Triangle();
   std::vector<int> pos_indices;
   std::vector<int> tex_indices;
+  std::vector<int> norm_indices;
+};
+
+// What one line of an OBJ file holds. parse_obj_line() fills in the matching argument
+// (normals go in `v` too) and leaves the others alone.
+enum ObjLine
+{
+  OBJ_OTHER,
+  OBJ_VERTEX,
+  OBJ_UV,
+  OBJ_NORMAL,
+  OBJ_FACE
+};
+ObjLine parse_obj_line(const std::string &line, Vec3f &v, Vec2f &uv, Triangle &tri);
+
+// The corners of a face, as indices into one of the Model's attributes (-1 for a
+// face without normals)
+struct FaceIndices
+{
+  int v[3];
+
+  int operator[](int k) const { return v[k]; }
+  size_t size() const { return 3; }
+};
+
+// What Model::quantize() did
+struct QuantizeStats
+{
+  size_t bytes_before, bytes_after;
+  float max_position_error; // furthest any coordinate moved, in model units
+  float max_uv_error;
+  bool index16; // the indices fit in 16 bits
+
+  QuantizeStats() : bytes_before(0), bytes_after(0), max_position_error(0), max_uv_error(0), index16(false) {}
 };
 
 class Model
@@ -19,16 +53,69 @@ private:
   std::vector<Vec3f> verts_;
   std::vector<Triangle> tris_;
   std::vector<Vec2f> uvs_;
+  std::vector<Vec3f> norms_;
+  std::vector<float> ao_;         // per position, empty until baked (see bake.h)
+  std::vector<float> irradiance_; // same
+
+  // Set by quantize(), which moves positions, uvs and indices into the arrays below
+  // and empties the ones above
+  bool quantized_;
+  std::vector<unsigned short> qverts_; // x y z of every position, qvert_min_ + q * qvert_step_
+  Vec3f qvert_min_, qvert_step_;
+  std::vector<unsigned short> quvs_; // u v, quv_min_ + q * quv_step_
+  Vec2f quv_min_, quv_step_;
+  // pos0 pos1 pos2 uv0 uv1 uv2 norm0 norm1 norm2 of every face, in 16 bits (0xffff
+  // for no normal) if there are few enough of everything, otherwise in 32
+  std::vector<unsigned short> qfaces16_;
+  std::vector<int> qfaces32_;
+
+  bool load_binary(const char *filename);
+  // corners of a quantized face, attribute 0 is positions, 1 uvs, 2 normals
+  FaceIndices qface(int tri_index, int attribute);
 
 public:
   Model(const char *filename);
+  Model(const std::vector<Vec3f> &verts, const std::vector<Vec2f> &uvs, const std::vector<Vec3f> &norms, const std::vector<Triangle> &tris);
   ~Model();
   int nverts();
   int nfaces();
   Vec3f vert(int i);
   Vec2f uv(int i);
-  std::vector<int> uv_indices(int tri_index);
-  std::vector<int> tri_indices(int index);
+  Vec3f norm(int i);
+  FaceIndices uv_indices(int tri_index);
+  FaceIndices tri_indices(int index);
+  FaceIndices norm_indices(int tri_index);
+  // Baked lighting of a position: how much of the sky it sees (1 if there's no bake)
+  // and the light it gets straight from the baked light (shadowed)
+  bool has_ao() { return !ao_.empty(); }
+  float ao(int i) { return ao_.empty() ? 1.0f : ao_[i]; }
+  bool has_irradiance() { return !irradiance_.empty(); }
+  float irradiance(int i) { return irradiance_[i]; }
+  // one value per position, irradiance can be empty
+  void set_baked(const std::vector<float> &ao, const std::vector<float> &irradiance);
+  // Roughly how much memory the mesh takes up, in bytes
+  size_t memory_size();
+
+  // Stores positions and uvs in 16 bits each, relative to their bounding boxes, and
+  // the faces' indices in 16 bits when there are under 65535 of everything, for
+  // about half the memory. vert() and uv() decode them as they're fetched. It's
+  // for rendering: a quantized model can't be optimized or written out. Returns
+  // false (and leaves the model alone) if it has faces that aren't triangles.
+  bool quantize(QuantizeStats &stats);
+  bool quantized() { return quantized_; }
+
+  // Reorders the triangles so that consecutive triangles share vertices
+  // (Forsyth's "linear-speed vertex cache optimisation"), then renumbers
+  // positions/uvs/normals in the order they're first used by the new triangle order.
+  void optimize(int cache_size = 32);
+  // Average cache miss ratio: vertices transformed per triangle with a FIFO
+  // vertex cache of the given size. 0.5 is the best possible, 3 the worst.
+  float acmr(int cache_size = 32);
+
+  bool write_obj(const char *filename);
+  // Binary dump of the mesh and its bake (see model.cpp for the layout). Filenames ending in
+  // ".mesh" passed to the constructor are read back with this format.
+  bool write_binary(const char *filename);
   // std::string print_uvs();
 };
 
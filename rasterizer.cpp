@@ -0,0 +1,213 @@
+#include <algorithm>
+#include <cmath>
+#include "rasterizer.h"
+
+Matrix vector_to_matrix(Vec3f v)
+{
+    Matrix m(4, 1);
+    m[0][0] = v.x;
+    m[1][0] = v.y;
+    m[2][0] = v.z;
+    m[3][0] = 1.0f;
+    return m;
+}
+
+Vec3f matrix_to_vector(Matrix m)
+{
+    // Assumes 4x1 matrix representing (x, y, z, w)
+    // Return vector that is x/y/z divided by w
+    return Vec3f(m[0][0] / m[3][0], m[1][0] / m[3][0], m[2][0] / m[3][0]);
+}
+
+void draw_line(int x0, int y0, int x1, int y1, TGAImage &image, TGAColor color)
+{
+    // The line is "steep" if it changes more in y than in x
+    // This can be used to make sure that lines are drawn without holes
+    // and also with as few iterations as needed.
+    bool is_steep = std::abs(x0 - x1) < std::abs(y0 - y1);
+
+    if (is_steep)
+    {
+        // if the line is steep, we're going to reflect it over y=x so we can treat it
+        // like a non-steep line and always iterate over "x". Then we'll have to untranspose it
+        // with x=y when actually writing to the image.
+        // We can also use the fact that the slope is less than 1 to our advantage.
+        std::swap(x0, y0);
+        std::swap(x1, y1);
+    }
+
+    // Make it always left-to-right
+    if (x0 > x1)
+    {
+        std::swap(x0, x1);
+        std::swap(y0, y1);
+    }
+
+    int dx = x1 - x0;
+    int dy = y1 - y0;
+
+    /*  less efficient approach since you have to do floating point stuff
+    // derror (Delta Error) is how much error accumulates with each iteration of x
+    // error is really just how much y changes as x changes (abs slope), I'm just calling it "error"
+    // to be consistent with the tutorial
+    // float derror = std::abs(dy / (float)dx);
+    */
+    // instead of doing error = dy/dx, let's do new_error = 2 * dy = 2 * dx * old_error
+    int dxderror2 = std::abs(dy) * 2;
+    // error is how much cumulative error has accumulated
+    int error = 0;
+    int y_increment = (y1 > y0) ? 1 : -1;
+
+    int y = y0;
+    // This could be a single loop with an if statement, but branching inside
+    if (is_steep)
+    {
+        for (int x = x0; x <= x1; x++)
+        {
+            image.set(y, x, color);
+
+            error += dxderror2;
+            if (error > dx)
+            {
+                // if the cumulative error is over 0.5, we want to move y up/down to the next pixel
+                y += y_increment;
+                error -= dx * 2;
+            }
+        }
+    }
+    else
+    {
+        for (int x = x0; x <= x1; x++)
+        {
+            image.set(x, y, color);
+            error += dxderror2;
+            if (error > dx)
+            {
+                // if the cumulative error is over 0.5, we want to move y up/down to the next pixel
+                y += y_increment;
+                error -= dx * 2;
+            }
+        }
+    }
+}
+
+/*
+void triangle_linesweep(Vec2i p0, Vec2i p1, Vec2i p2, TGAImage &image, TGAColor color)
+{
+    draw_line(p0.x, p0.y, p1.x, p1.y, image, color);
+    draw_line(p1.x, p1.y, p2.x, p2.y, image, color);
+    draw_line(p2.x, p2.y, p0.x, p0.y, image, color);
+
+    // First, sort p0, p1, p2 so that they are in order of increasing y
+    // p0 is the "lowest", p2 is the "highest"
+    if (p0.y > p1.y)
+    {
+        std::swap(p0, p1);
+    }
+    if (p1.y > p2.y)
+    {
+        std::swap(p1, p2);
+    }
+    if (p0.y > p1.y)
+    {
+        std::swap(p1, p2);
+    }
+
+    // Render the bottom half of the triangle
+    for (int y = p0.y; y < p1.y; y++)
+    {
+        // First, figure out where along the (p0, p1) edge we are
+        int dy_01 = (p1.y - p0.y);
+        float p01_t = dy_01 == 0 ? 1.0 : (y - p0.y) / (float)(p1.y - p0.y);
+        float p01_x = (p1.x - p0.x) * p01_t + p0.x;
+
+        // Same for (p0, p2) edge
+        int dy_02 = (p2.y - p0.y);
+        float p02_t = dy_02 == 0 ? 1.0 : (y - p0.y) / (float)(p2.y - p0.y);
+        float p02_x = (p2.x - p0.x) * p02_t + p0.x;
+
+        // Left boundary is the min of these 2 x's, right is the max
+        int left_boundary = std::min(p01_x, p02_x);
+        int right_boundary = std::max(p01_x, p02_x);
+        draw_line(left_boundary, y, right_boundary, y, image, color);
+    }
+
+    // Render the top half
+    for (int y = p1.y; y <= p2.y; y++)
+    {
+        // First, figure out where along the (p1, p2) edge we are
+        int dy_12 = (p2.y - p1.y);
+        float p12_t = dy_12 == 0 ? 1.0 : (y - p1.y) / (float)(p2.y - p1.y);
+        float p12_x = (p2.x - p1.x) * p12_t + p1.x;
+
+        // Same for (p0, p2) edge
+        int dy_02 = (p2.y - p0.y);
+        float p02_t = dy_02 == 0 ? 1.0 : (y - p0.y) / (float)(p2.y - p0.y);
+        float p02_x = (p2.x - p0.x) * p02_t + p0.x;
+
+        // Left boundary is the min of these 2 x's, right is the max
+        int left_boundary = std::min(p12_x, p02_x);
+        int right_boundary = std::max(p12_x, p02_x);
+        draw_line(left_boundary, y, right_boundary, y, image, color);
+    }
+}
+*/
+
+Mat4 Mat4::viewport(int x, int y, int w, int h)
+{
+    /*
+
+    Viewport matrix:
+    | w/2 0  0   x+w/2 |
+    | 0  h/2 0   y+h/2 |
+    | 0  0  1/2 1/2   |
+    | 0  0  0   1     |
+
+    z goes from [-1, 1] to the [0, 1] depth range (see rasterizer.h)
+
+    */
+    Mat4 m;
+    m.m[0][3] = x + w / 2.0f;
+    m.m[1][3] = y + h / 2.0f;
+    m.m[2][3] = 0.5f;
+
+    m.m[0][0] = w / 2.0f;
+    m.m[1][1] = h / 2.0f;
+    m.m[2][2] = 0.5f;
+    return m;
+}
+
+Mat4 Mat4::lookat(Vec3f eye, Vec3f center, Vec3f up)
+{
+    // rotates `eye - center` onto +z and moves `center` to the origin
+    Vec3f z = eye - center;
+    z.normalize();
+    Vec3f x = up ^ z;
+    if (x.norm() <= 1e-6f * up.norm())
+    {
+        // looking straight along `up`, any other up will do (e.g. a light overhead)
+        x = (std::abs(z.x) < 0.9f ? Vec3f(1, 0, 0) : Vec3f(0, 0, 1)) ^ z;
+    }
+    x.normalize();
+    Vec3f y = z ^ x;
+    y.normalize();
+    Mat4 rotation, translation;
+    for (int i = 0; i < 3; i++)
+    {
+        rotation.m[0][i] = x.raw[i];
+        rotation.m[1][i] = y.raw[i];
+        rotation.m[2][i] = z.raw[i];
+        translation.m[i][3] = -center.raw[i];
+    }
+    return rotation * translation;
+}
+
+Matrix viewport(int x, int y, int w, int h)
+{
+    return Mat4::viewport(x, y, w, h).to_matrix();
+}
+
+Matrix lookat(Vec3f eye, Vec3f center, Vec3f up)
+{
+    return Mat4::lookat(eye, center, up).to_matrix();
+}
@@ -0,0 +1,626 @@
+#ifndef __RASTERIZER_H__
+#define __RASTERIZER_H__
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "abuffer.h"
+#include "arena.h"
+#include "geometry.h"
+#include "stats.h"
+#include "tgaimage.h"
+
+// 4x4 matrix copied out of a Matrix, so transforming a vertex doesn't allocate
+struct Mat4
+{
+  float m[4][4];
+
+  Mat4()
+  {
+    for (int i = 0; i < 4; i++)
+      for (int j = 0; j < 4; j++)
+        m[i][j] = i == j ? 1.0f : 0.0f;
+  }
+
+  Mat4(Matrix M)
+  {
+    for (int i = 0; i < 4; i++)
+      for (int j = 0; j < 4; j++)
+        m[i][j] = M[i][j];
+  }
+
+  inline Mat4 operator*(const Mat4 &B) const
+  {
+    Mat4 result;
+    for (int i = 0; i < 4; i++)
+      for (int j = 0; j < 4; j++)
+      {
+        result.m[i][j] = 0.0f;
+        for (int k = 0; k < 4; k++)
+          result.m[i][j] += m[i][k] * B.m[k][j];
+      }
+    return result;
+  }
+
+  Matrix to_matrix() const
+  {
+    Matrix M(4, 4);
+    for (int i = 0; i < 4; i++)
+      for (int j = 0; j < 4; j++)
+        M[i][j] = m[i][j];
+    return M;
+  }
+
+  // Same as the viewport() and lookat() below, without any heap allocated Matrix
+  static Mat4 viewport(int x, int y, int w, int h);
+  static Mat4 lookat(Vec3f eye, Vec3f center, Vec3f up);
+
+  // (x, y, z) / w of M * (v, 1)
+  inline Vec3f project(const Vec3f &v) const
+  {
+    float x = m[0][0] * v.x + m[0][1] * v.y + m[0][2] * v.z + m[0][3];
+    float y = m[1][0] * v.x + m[1][1] * v.y + m[1][2] * v.z + m[1][3];
+    float z = m[2][0] * v.x + m[2][1] * v.y + m[2][2] * v.z + m[2][3];
+    float w = m[3][0] * v.x + m[3][1] * v.y + m[3][2] * v.z + m[3][3];
+    return Vec3f(x / w, y / w, z / w);
+  }
+
+  // Same, and 1 / w in rhw, for interpolating varyings with perspective
+  inline Vec3f project(const Vec3f &v, float &rhw) const
+  {
+    float x = m[0][0] * v.x + m[0][1] * v.y + m[0][2] * v.z + m[0][3];
+    float y = m[1][0] * v.x + m[1][1] * v.y + m[1][2] * v.z + m[1][3];
+    float z = m[2][0] * v.x + m[2][1] * v.y + m[2][2] * v.z + m[2][3];
+    float w = m[3][0] * v.x + m[3][1] * v.y + m[3][2] * v.z + m[3][3];
+    rhw = 1.0f / w;
+    return Vec3f(x / w, y / w, z / w);
+  }
+};
+
+/*
+
+Depth. viewport() maps NDC z in [-1, 1] to screen z in [0, 1], and the projection
+puts the near plane at 1 and the far plane at 0 (reversed-Z: a float has most of its
+precision near 0, which makes up for perspective squeezing everything far away
+together). Every format is cleared to 0, a fragment passes if it's greater than
+what's there, and anything outside [0, 1] is clipped.
+
+The zbuffer's element type picks the format, so triangle() and friends get
+specialized for each one:
+
+  float     reversed-Z float, 4 bytes
+  uint32_t  24 bit unorm in a 32 bit word, 4 bytes (same precision near and far)
+  uint16_t  16 bit unorm, 2 bytes, half the bandwidth of the others
+
+*/
+enum DepthFormat
+{
+  DEPTH_FLOAT,
+  DEPTH_UNORM24,
+  DEPTH_UNORM16
+};
+
+template <class T>
+struct DepthTraits;
+
+template <>
+struct DepthTraits<float>
+{
+  static inline float encode(float z) { return z; }
+  static inline float decode(float d) { return d; }
+};
+
+template <>
+struct DepthTraits<uint32_t>
+{
+  static inline uint32_t encode(float z) { return (uint32_t)(z * 16777215.0f + 0.5f); }
+  static inline float decode(uint32_t d) { return d / 16777215.0f; }
+};
+
+template <>
+struct DepthTraits<uint16_t>
+{
+  static inline uint16_t encode(float z) { return (uint16_t)(z * 65535.0f + 0.5f); }
+  static inline float decode(uint16_t d) { return d / 65535.0f; }
+};
+
+// Bytes per pixel of each format
+inline int depth_format_size(DepthFormat format)
+{
+  return format == DEPTH_UNORM16 ? 2 : 4;
+}
+
+Matrix vector_to_matrix(Vec3f v);
+Vec3f matrix_to_vector(Matrix m);
+void draw_line(int x0, int y0, int x1, int y1, TGAImage &image, TGAColor color);
+Matrix viewport(int x, int y, int w, int h);
+Matrix lookat(Vec3f eye, Vec3f center, Vec3f up);
+
+/*
+
+Shaders are plain classes passed to draw() as a template parameter, so every call
+below is resolved (and inlined) at compile time and the rasterizer gets instantiated
+once per shader. No virtual calls and no branching on the shading model per pixel.
+
+A shader provides:
+
+  static const int nvaryings;                                      // floats interpolated across the triangle
+  bool face(int iface);                                            // false skips (culls) the face
+  Vec3f vertex(int iface, int nthvert, float *varying, float &rhw); // screen coords, fills in `varying` and 1/w
+  bool fragment(const float *varying, TGAColor &color);            // false discards the pixel
+  Vec3f position(int iface, int nthvert);                          // screen coords only (for draw_depth)
+
+Only nvaryings floats are interpolated, so a shader that doesn't need e.g. normals
+doesn't pay for them. draw() runs vertex() over every face before it rasterizes any
+of them, so anything per face that fragment() needs has to go through the varyings
+rather than be left in the shader by face().
+
+*/
+
+// varyings arrays can't be zero sized
+template <class Shader>
+struct VaryingCount
+{
+  static const int size = Shader::nvaryings > 0 ? Shader::nvaryings : 1;
+};
+
+/*
+
+A triangle on screen. Everything a pixel needs is linear across the screen, so once
+per triangle each of them becomes a plane, value = at_p0 + dx * (x - p0.x) + dy * (y - p0.y):
+z, and for the shading passes 1/w and the varyings over w (VaryingPlanes). Which
+pixels are inside is decided by three edge functions (all >= 0 inside the triangle,
+one per side), in integers on the corners snapped to 1/256 of a pixel, so they're
+exact: two triangles that share an edge compute the very same values for it, with
+opposite signs. A pixel right on an edge (or a corner) then goes to just one of the
+triangles: the one to the right of the edge, or on the +y side of a horizontal one
+(the usual top-left rule, with y going down the buffer). Otherwise both would draw
+it, which the zbuffer hides but the A-buffer blends twice.
+
+The edges and z are evaluated at the start of a row and stepped along it to the first
+pixel inside the triangle, where the varyings are evaluated; from there every pixel
+only adds the x steps, and the row ends with the first pixel past the triangle (it's
+convex, so the pixels of a row that are inside are all next to each other).
+
+Rows are evaluated from scratch instead of being stepped down from the top of the
+triangle, so a pixel gets the same values whichever band of rows it's drawn in: a band
+or a strip comes out exactly like the whole image, and the z-prepass and the shading
+pass agree on z.
+
+*/
+struct TriangleSetup
+{
+  static const int subpixel_bits = 8;
+  // Corners further off screen than this (in pixels) would overflow the edge functions,
+  // such triangles are dropped
+  static constexpr float max_coord = 1 << 21;
+
+  int xmin, xmax, ymin, ymax; // bounding box, clipped to rows [y0, y1) and the image width
+  float ox, oy;               // p0, snapped
+  float inv_area;
+  float edge_dx[3], edge_dy[3]; // of the planes
+  float z0, z_dx, z_dy;
+  // edge i at pixel (x, y) is cover_dx[i] * x + cover_dy[i] * y + cover_c[i], minus one
+  // on edges the triangle doesn't own so >= 0 is inside
+  int64_t cover_dx[3], cover_dy[3], cover_c[3];
+
+  // Returns false for triangles that are degenerate or entirely outside
+  inline bool init(const Vec3f *pts, int width, int y0, int y1)
+  {
+    const Vec3f &p0 = pts[0], &p1 = pts[1], &p2 = pts[2];
+    // also false for NaN
+    if (!(std::abs(p0.x) <= max_coord && std::abs(p0.y) <= max_coord && std::abs(p1.x) <= max_coord &&
+          std::abs(p1.y) <= max_coord && std::abs(p2.x) <= max_coord && std::abs(p2.y) <= max_coord))
+    {
+      return false;
+    }
+    const int one = 1 << subpixel_bits;
+    int64_t fx[3] = {snap(p0.x * one), snap(p1.x * one), snap(p2.x * one)};
+    int64_t fy[3] = {snap(p0.y * one), snap(p1.y * one), snap(p2.y * one)};
+    // the pixels (at integer coordinates) between the snapped corners
+    xmin = (int)std::max((int64_t)0, (std::min(fx[0], std::min(fx[1], fx[2])) + one - 1) >> subpixel_bits);
+    ymin = (int)std::max((int64_t)y0, (std::min(fy[0], std::min(fy[1], fy[2])) + one - 1) >> subpixel_bits);
+    xmax = (int)std::min((int64_t)width - 1, std::max(fx[0], std::max(fx[1], fx[2])) >> subpixel_bits);
+    ymax = (int)std::min((int64_t)y1 - 1, std::max(fy[0], std::max(fy[1], fy[2])) >> subpixel_bits);
+    if (xmin > xmax || ymin > ymax)
+    {
+      return false;
+    }
+    // twice the signed area
+    int64_t area = (fx[2] - fx[0]) * (fy[1] - fy[0]) - (fx[1] - fx[0]) * (fy[2] - fy[0]);
+    if (area > -(int64_t)one * one && area < (int64_t)one * one)
+    {
+      // degenerate triangle
+      return false;
+    }
+    // edge i is the side across from corner i, flipped so it's positive at that corner
+    int64_t sign = area < 0 ? 1 : -1;
+    set_edge(0, 1, 2, fx, fy, sign);
+    set_edge(1, 2, 0, fx, fy, sign);
+    set_edge(2, 0, 1, fx, fy, sign);
+    ox = (float)fx[0] / one;
+    oy = (float)fy[0] / one;
+    inv_area = (float)one * one / (float)(area * -sign);
+    z0 = p0.z;
+    plane(p0.z, p1.z, p2.z, z_dx, z_dy);
+    return true;
+  }
+
+  // Edge i, from corner a to corner b (snapped)
+  inline void set_edge(int i, int a, int b, const int64_t *fx, const int64_t *fy, int64_t sign)
+  {
+    const int one = 1 << subpixel_bits;
+    int64_t A = sign * (fy[a] - fy[b]), B = sign * (fx[b] - fx[a]);
+    // the triangle owns the edge if it's on the edge's +x side, or +y for a
+    // horizontal one; the triangle on the other side has -A, -B and doesn't
+    // (no short circuit, it's a coin toss that would mispredict half the time)
+    int owned = (A > 0) | ((A == 0) & (B > 0));
+    cover_dx[i] = A * one;
+    cover_dy[i] = B * one;
+    cover_c[i] = -(A * fx[a] + B * fy[a]) - !owned;
+    edge_dx[i] = (float)A / one;
+    edge_dy[i] = (float)B / one;
+  }
+
+  // v rounded to the nearest integer, halves away from 0. std::lround() is a call into
+  // libm, which shows with lots of small triangles.
+  static inline int64_t snap(float v)
+  {
+    return (int64_t)(v + std::copysign(0.5f, v));
+  }
+
+  // The steps of something that's f0, f1, f2 at the corners
+  inline void plane(float f0, float f1, float f2, float &dx, float &dy) const
+  {
+    dx = (f0 * edge_dx[0] + f1 * edge_dx[1] + f2 * edge_dx[2]) * inv_area;
+    dy = (f0 * edge_dy[0] + f1 * edge_dy[1] + f2 * edge_dy[2]) * inv_area;
+  }
+
+  // The first pixel of row y inside the triangle, xmax + 1 if there's none, with the
+  // edge functions and z there
+  inline int row(int y, int64_t edge[3], float &z) const
+  {
+    for (int i = 0; i < 3; i++)
+    {
+      edge[i] = cover_dx[i] * xmin + cover_dy[i] * y + cover_c[i];
+    }
+    z = z0 + z_dx * (xmin - ox) + z_dy * (y - oy);
+    int x = xmin;
+    for (; x <= xmax && !inside(edge); x++)
+    {
+      step(edge, z);
+    }
+    return x;
+  }
+
+  // ...and one pixel to the right
+  inline void step(int64_t edge[3], float &z) const
+  {
+    edge[0] += cover_dx[0];
+    edge[1] += cover_dx[1];
+    edge[2] += cover_dx[2];
+    z += z_dx;
+  }
+
+  static inline bool inside(const int64_t edge[3])
+  {
+    return (edge[0] | edge[1] | edge[2]) >= 0;
+  }
+};
+
+/*
+
+Varyings with perspective. Screen z is z/w, which is linear across the screen, but
+the varyings aren't: interpolating them like z warps the texture on any face that
+isn't parallel to the screen. What is linear is every varying divided by w, and 1/w
+itself, so they're planes like z and get stepped along a row with it. A shaded pixel
+takes a single 1/(1/w) to get w back and a multiply per varying.
+
+An orthographic transform has w = 1 everywhere, and then it's the same as linear.
+
+*/
+template <int n>
+struct VaryingPlanes
+{
+  // [0] is 1/w, then the varyings over w: at p0, and their steps
+  float origin[n + 1], dx[n + 1], dy[n + 1];
+
+  VaryingPlanes(const TriangleSetup &setup, const float *rhw, const float (*varyings)[n], int nvaryings)
+  {
+    origin[0] = rhw[0];
+    setup.plane(rhw[0], rhw[1], rhw[2], dx[0], dy[0]);
+    for (int k = 1; k <= nvaryings; k++)
+    {
+      float f0 = varyings[0][k - 1] * rhw[0], f1 = varyings[1][k - 1] * rhw[1], f2 = varyings[2][k - 1] * rhw[2];
+      origin[k] = f0;
+      setup.plane(f0, f1, f2, dx[k], dy[k]);
+    }
+  }
+
+  // At pixel (x, y), where a row starts
+  inline void row(const TriangleSetup &setup, int x, int y, float *values, int nvaryings) const
+  {
+    float px = x - setup.ox, py = y - setup.oy;
+    for (int k = 0; k <= nvaryings; k++)
+    {
+      values[k] = origin[k] + dx[k] * px + dy[k] * py;
+    }
+  }
+
+  inline void step(float *values, int nvaryings) const
+  {
+    for (int k = 0; k <= nvaryings; k++)
+    {
+      values[k] += dx[k];
+    }
+  }
+
+  // The varyings of a pixel out of its values
+  static inline void at(const float *values, float *varying, int nvaryings)
+  {
+    float w = 1.0f / values[0];
+    for (int k = 0; k < nvaryings; k++)
+    {
+      varying[k] = values[k + 1] * w;
+    }
+  }
+};
+
+// With depth_equal the zbuffer is assumed to be filled in already by a z-prepass
+// (draw_depth), so only the visible fragment of each pixel is shaded and z isn't written.
+// Only rows [y0, y1) are touched. The image and zbuffer can start at row0 of the
+// screen instead of 0 (a strip of a bigger image, see Frame::set_strip), pixels keep
+// their screen y for everything else.
+template <bool depth_equal, class Shader, class Depth>
+inline void triangle(Vec3f pts[3], const float rhw[3], float varyings[3][VaryingCount<Shader>::size], Shader &shader, Depth *zbuffer,
+                     TGAImage &image, int y0, int y1, int row0 = 0)
+{
+  int width = image.get_width();
+  TriangleSetup setup;
+  if (!setup.init(pts, width, y0, y1))
+  {
+    STATS_ADD(tris_culled, 1);
+    return;
+  }
+
+  const int n = VaryingCount<Shader>::size;
+  VaryingPlanes<n> planes(setup, rhw, varyings, Shader::nvaryings);
+  int64_t edge[3];
+  float z, values[n + 1], varying[n];
+  TGAColor color;
+  PixelCounters counters;
+  // row by row, so consecutive pixels are next to each other in the image and zbuffer
+  for (int y = setup.ymin; y <= setup.ymax; y++)
+  {
+    int x = setup.row(y, edge, z);
+    if (x > setup.xmax)
+    {
+      continue;
+    }
+    planes.row(setup, x, y, values, Shader::nvaryings);
+    for (; x <= setup.xmax && TriangleSetup::inside(edge); x++, setup.step(edge, z), planes.step(values, Shader::nvaryings))
+    {
+      counters.test();
+      int idx = x + (y - row0) * width;
+      if (z < 0 || z > 1)
+      {
+        // behind the far plane or in front of the near one
+        counters.fail();
+        continue;
+      }
+      Depth d = DepthTraits<Depth>::encode(z);
+      if (depth_equal ? zbuffer[idx] != d : zbuffer[idx] >= d)
+      {
+        counters.fail();
+        continue;
+      }
+      VaryingPlanes<n>::at(values, varying, Shader::nvaryings);
+      if (!counters.fragment(shader, varying, color))
+      {
+        continue;
+      }
+      counters.pass(idx);
+      image.set(x, y - row0, color);
+      if (!depth_equal)
+      {
+        zbuffer[idx] = d;
+      }
+    }
+  }
+  counters.flush();
+}
+
+// Transparent surfaces: every fragment in front of the zbuffer (the opaque surfaces,
+// which isn't written) goes into the A-buffer instead of the image, with `opacity`
+// times the texture's own alpha if it has one. Only rows [y0, y1) are touched, the
+// zbuffer and A-buffer start at row0 like triangle()'s.
+template <class Shader, class Depth>
+inline void transparent_triangle(Vec3f pts[3], const float rhw[3], float varyings[3][VaryingCount<Shader>::size], Shader &shader,
+                                 const Depth *zbuffer, ABuffer &abuffer, float opacity, int width, int y0, int y1, int row0 = 0)
+{
+  TriangleSetup setup;
+  if (!setup.init(pts, width, y0, y1))
+  {
+    STATS_ADD(tris_culled, 1);
+    return;
+  }
+
+  const int n = VaryingCount<Shader>::size;
+  VaryingPlanes<n> planes(setup, rhw, varyings, Shader::nvaryings);
+  int64_t edge[3];
+  float z, values[n + 1], varying[n];
+  TGAColor color;
+  PixelCounters counters;
+  for (int y = setup.ymin; y <= setup.ymax; y++)
+  {
+    int x = setup.row(y, edge, z);
+    if (x > setup.xmax)
+    {
+      continue;
+    }
+    planes.row(setup, x, y, values, Shader::nvaryings);
+    for (; x <= setup.xmax && TriangleSetup::inside(edge); x++, setup.step(edge, z), planes.step(values, Shader::nvaryings))
+    {
+      counters.test();
+      int idx = x + (y - row0) * width;
+      if (z < 0 || z > 1 || zbuffer[idx] >= DepthTraits<Depth>::encode(z))
+      {
+        counters.fail();
+        continue;
+      }
+      VaryingPlanes<n>::at(values, varying, Shader::nvaryings);
+      if (!counters.fragment(shader, varying, color))
+      {
+        continue;
+      }
+      counters.pass(idx);
+      float alpha = color.bytespp == 4 ? opacity * color.a : opacity * 255.0f;
+      abuffer.append(idx, z, color, (unsigned char)(alpha + 0.5f));
+    }
+  }
+  counters.flush();
+}
+
+// Depth only: no varyings, no color. Only rows [y0, y1) are touched, so several
+// threads can fill in different bands of the same zbuffer. It starts at row0, like
+// triangle()'s.
+template <class Depth>
+inline void depth_triangle(Vec3f pts[3], Depth *zbuffer, int width, int y0, int y1, int row0 = 0)
+{
+  TriangleSetup setup;
+  if (!setup.init(pts, width, y0, y1))
+  {
+    return;
+  }
+  int64_t edge[3];
+  float z;
+  for (int y = setup.ymin; y <= setup.ymax; y++)
+  {
+    Depth *row = zbuffer + (y - row0) * width;
+    for (int x = setup.row(y, edge, z); x <= setup.xmax && TriangleSetup::inside(edge); x++, setup.step(edge, z))
+    {
+      if (z < 0 || z > 1)
+      {
+        continue;
+      }
+      Depth d = DepthTraits<Depth>::encode(z);
+      if (row[x] < d)
+      {
+        row[x] = d;
+      }
+    }
+  }
+}
+
+// A face after vertex(): screen coords, 1/w and the varyings at each corner
+template <class Shader>
+struct ShadedTriangle
+{
+  Vec3f pts[3];
+  float rhw[3];
+  float varyings[3][VaryingCount<Shader>::size];
+};
+
+// Runs vertex() over the faces the shader doesn't cull, into `scratch`
+template <class Shader>
+ShadedTriangle<Shader> *transform_faces(Shader &shader, const int *faces, int nfaces, Arena &scratch, int &ntris)
+{
+  STATS_ADD(tris_submitted, nfaces);
+  ShadedTriangle<Shader> *tris = scratch.alloc_uninitialized<ShadedTriangle<Shader> >(nfaces);
+  ntris = 0;
+  STATS_SCOPE(STAGE_TRANSFORM);
+  for (int f = 0; f < nfaces; f++)
+  {
+    int i = faces[f];
+    if (!shader.face(i))
+    {
+      STATS_ADD(tris_culled, 1);
+      continue;
+    }
+    ShadedTriangle<Shader> &t = tris[ntris++];
+    for (int j = 0; j < 3; j++)
+    {
+      t.pts[j] = shader.vertex(i, j, t.varyings[j], t.rhw[j]);
+    }
+  }
+  return tris;
+}
+
+// Runs `shader` over faces[0, nfaces). Every face is transformed first (into
+// `scratch`), then the ones that survived are rasterized, so the two stages can be
+// timed apart. Like draw_depth, y1 < 0 means the whole height. See triangle() for row0.
+template <bool depth_equal = false, class Shader, class Depth>
+void draw(Shader &shader, const int *faces, int nfaces, Depth *zbuffer, TGAImage &image, Arena &scratch, int y0 = 0, int y1 = -1,
+          int row0 = 0)
+{
+  if (y1 < 0)
+  {
+    y1 = image.get_height();
+  }
+  int ntris;
+  ShadedTriangle<Shader> *tris = transform_faces(shader, faces, nfaces, scratch, ntris);
+  // fragment() gets its own time out of this, see PixelCounters
+  STATS_SCOPE(STAGE_RASTER);
+  for (int t = 0; t < ntris; t++)
+  {
+    triangle<depth_equal>(tris[t].pts, tris[t].rhw, tris[t].varyings, shader, zbuffer, image, y0, y1, row0);
+  }
+}
+
+// Same, into an A-buffer (see transparent_triangle)
+template <class Shader, class Depth>
+void draw_transparent(Shader &shader, const int *faces, int nfaces, const Depth *zbuffer, ABuffer &abuffer, float opacity,
+                      int width, Arena &scratch, int y0, int y1, int row0 = 0)
+{
+  int ntris;
+  ShadedTriangle<Shader> *tris = transform_faces(shader, faces, nfaces, scratch, ntris);
+  STATS_SCOPE(STAGE_RASTER);
+  for (int t = 0; t < ntris; t++)
+  {
+    transparent_triangle(tris[t].pts, tris[t].rhw, tris[t].varyings, shader, zbuffer, abuffer, opacity, width, y0, y1, row0);
+  }
+}
+
+// Same as draw(), with a scratch arena of its own
+template <bool depth_equal = false, class Shader, class Depth>
+void draw(Shader &shader, const std::vector<int> &faces, Depth *zbuffer, TGAImage &image, int y0 = 0, int y1 = -1)
+{
+  Arena scratch(faces.size() * sizeof(ShadedTriangle<Shader>) + 64);
+  draw<depth_equal>(shader, faces.data(), (int)faces.size(), zbuffer, image, scratch, y0, y1);
+}
+
+// Depth pass over faces[0, nfaces). Only needs the shader's face() and
+// position(iface, nthvert), so any shader can be used for its own z-prepass.
+// y1 < 0 means the whole height. See triangle() for row0.
+template <class Shader, class Depth>
+void draw_depth(Shader &shader, const int *faces, int nfaces, Depth *zbuffer, int width, int height, int y0 = 0, int y1 = -1,
+                int row0 = 0)
+{
+  if (y1 < 0)
+  {
+    y1 = height;
+  }
+  Vec3f pts[3];
+  for (int f = 0; f < nfaces; f++)
+  {
+    int i = faces[f];
+    if (!shader.face(i))
+    {
+      continue;
+    }
+    for (int j = 0; j < 3; j++)
+    {
+      pts[j] = shader.position(i, j);
+    }
+    depth_triangle(pts, zbuffer, width, y0, y1, row0);
+  }
+}
+
+template <class Shader, class Depth>
+void draw_depth(Shader &shader, const std::vector<int> &faces, Depth *zbuffer, int width, int height, int y0 = 0, int y1 = -1)
+{
+  draw_depth(shader, faces.data(), (int)faces.size(), zbuffer, width, height, y0, y1);
+}
+
+#endif //__RASTERIZER_H__
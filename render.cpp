@@ -0,0 +1,491 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include "render.h"
+#include "shaders.h"
+#include "stats.h"
+
+bool depth_format_from_name(const char *name, DepthFormat &format)
+{
+  if (!strcmp(name, "float"))
+    format = DEPTH_FLOAT;
+  else if (!strcmp(name, "unorm24"))
+    format = DEPTH_UNORM24;
+  else if (!strcmp(name, "unorm16"))
+    format = DEPTH_UNORM16;
+  else
+    return false;
+  return true;
+}
+
+Shading shading_from_name(const char *name)
+{
+  if (!strcmp(name, "flat"))
+    return SHADE_FLAT;
+  if (!strcmp(name, "gouraud"))
+    return SHADE_GOURAUD;
+  if (!strcmp(name, "phong"))
+    return SHADE_PHONG;
+  if (!strcmp(name, "baked"))
+    return SHADE_BAKED;
+  return SHADE_TEXTURE;
+}
+
+namespace
+{
+  Mat4 viewport_for(int width, int height, float zoom)
+  {
+    float w = width * 3.0f / 4.0f * zoom;
+    float h = height * 3.0f / 4.0f * zoom;
+    return Mat4::viewport((width - w) / 2.0f, (height - h) / 2.0f, w, h);
+  }
+
+  Mat4 projection()
+  {
+    // w = 1 - z / c is the distance from the camera over c, as before. z / w goes
+    // from 1 at the near plane to -1 at the far one, so it's linear in 1 / distance.
+    const float c = camera_z, n = camera_near, f = camera_far;
+    Mat4 P;
+    P.m[3][2] = -1.f / c;
+    P.m[2][2] = (f + n) / (c * (f - n));
+    P.m[2][3] = 2 * n * f / (c * (f - n)) - (f + n) / (f - n);
+    return P;
+  }
+
+  // the depth of every format is cleared to 0
+  void clear_depth(void *zbuffer, DepthFormat format, int npixels)
+  {
+    memset(zbuffer, 0, (size_t)npixels * depth_format_size(format));
+  }
+
+  // M's 3x3 part transposed (its inverse, up to the scale) times `dir`, normalized
+  Vec3f to_model(const Mat4 &M, const Vec3f &dir)
+  {
+    Vec3f v;
+    for (int i = 0; i < 3; i++)
+    {
+      v.raw[i] = M.m[0][i] * dir.x + M.m[1][i] * dir.y + M.m[2][i] * dir.z;
+    }
+    return v.normalize();
+  }
+
+  template <class Shader, class Depth>
+  void shade(Shader &shader, const Vec3f &view_dir, const RenderSettings &settings, ABuffer *abuffer, const int *faces, int nfaces, Depth *zbuffer, TGAImage &image, Arena &scratch, int y0, int y1, int row0)
+  {
+    shader.view_dir = view_dir;
+    shader.compressed = settings.compressed_texture;
+    shader.cull_back = !abuffer;
+    if (abuffer)
+      draw_transparent(shader, faces, nfaces, zbuffer, *abuffer, settings.opacity, image.get_width(), scratch, y0, y1, row0);
+    else if (settings.z_prepass)
+      draw<true>(shader, faces, nfaces, zbuffer, image, scratch, y0, y1, row0);
+    else
+      draw(shader, faces, nfaces, zbuffer, image, scratch, y0, y1, row0);
+  }
+}
+
+Matrix camera_viewport(int width, int height, float zoom)
+{
+  return viewport_for(width, height, zoom).to_matrix();
+}
+
+Matrix camera_projection()
+{
+  return projection().to_matrix();
+}
+
+Mat4 camera_transform(int width, int height, float zoom)
+{
+  return viewport_for(width, height, zoom) * projection();
+}
+
+Mat4 instance_transform(Vec3f position, float yaw, float scale)
+{
+  float a = yaw * 3.14159265f / 180.0f;
+  Mat4 M;
+  M.m[0][0] = std::cos(a) * scale;
+  M.m[0][2] = std::sin(a) * scale;
+  M.m[1][1] = scale;
+  M.m[2][0] = -std::sin(a) * scale;
+  M.m[2][2] = std::cos(a) * scale;
+  for (int i = 0; i < 3; i++)
+  {
+    M.m[i][3] = position.raw[i];
+  }
+  return M;
+}
+
+bool read_instances(const char *filename, std::vector<Mat4> &instances)
+{
+  std::ifstream in(filename);
+  if (!in.is_open())
+  {
+    std::cerr << "can't open file " << filename << "\n";
+    return false;
+  }
+  std::string line;
+  int line_number = 0;
+  while (std::getline(in, line))
+  {
+    line_number++;
+    std::istringstream iss(line);
+    std::string first;
+    if (!(iss >> first) || first[0] == '#')
+    {
+      continue;
+    }
+    iss.str(line);
+    iss.clear();
+    Vec3f position;
+    float yaw = 0, scale = 1;
+    if (!(iss >> position.x >> position.y >> position.z))
+    {
+      std::cerr << filename << ":" << line_number << ": bad instance: " << line << "\n";
+      return false;
+    }
+    if (iss >> yaw)
+    {
+      iss >> scale;
+    }
+    instances.push_back(instance_transform(position, yaw, scale));
+  }
+  return true;
+}
+
+Frame::Frame(Model *model, BVH *bvh, TGAImage *texture, const RenderSettings &settings, TGAImage &image, Arena &arena,
+             const Mat4 *instances, int ninstances)
+    : model_(model), bvh_(bvh), texture_(texture), settings_(settings), image_(image), arena_(arena), all_faces_(NULL), nall_faces_(0),
+      instances_(instances), ninstances_(ninstances), faces_(NULL), nfaces_(0), lods_(NULL), row0_(0), shadow_map(NULL), abuffer(NULL)
+{
+  int npixels = width() * height();
+  zbuffer = arena.alloc(npixels * depth_format_size(settings.depth_format));
+  clear_depth(zbuffer, settings.depth_format, npixels);
+  if (settings.opacity < 1)
+  {
+    int capacity = settings.oit_fragments > 0 ? settings.oit_fragments : 4 * npixels;
+    abuffer = new (arena.alloc_uninitialized<ABuffer>(1)) ABuffer(arena, width(), height(), capacity);
+    settings_.z_prepass = false;
+  }
+  transform_ = camera_transform(width(), height(), settings.zoom);
+  light_ = settings.light_dir;
+  light_.normalize();
+
+  if (settings.shadows)
+  {
+    // The shadow map is the scene's depth seen from the light (orthographic, since
+    // it's a directional light). The model fits in a sphere of radius 1 around the
+    // origin, copies of it are fitted by their bounds.
+    Vec3f center(0, 0, 0);
+    float radius = 1.0f;
+    if (instances_)
+    {
+      AABB box = scene_bounds();
+      center = (box.bmin + box.bmax) * 0.5f;
+      radius = std::max(1e-6f, (box.bmax - box.bmin).norm() * 0.5f);
+    }
+    shadow_map = arena.alloc_uninitialized<float>(npixels);
+    clear_depth(shadow_map, DEPTH_FLOAT, npixels);
+    Mat4 LightViewport = Mat4::viewport(width() / 8.0f, height() / 8.0f, width() * 3.0f / 4.0f, height() * 3.0f / 4.0f);
+    // that sphere's [-2r, 2r] along the light's z goes to [-1, 1]
+    Mat4 Ortho;
+    Ortho.m[0][0] = Ortho.m[1][1] = 1.0f / radius;
+    Ortho.m[2][2] = 0.5f / radius;
+    light_transform_ = LightViewport * Ortho * Mat4::lookat(center - light_, center, Vec3f(0, 1, 0));
+    set_model(model, bvh);
+  }
+}
+
+void Frame::set_model(Model *model, BVH *bvh)
+{
+  model_ = model;
+  bvh_ = bvh;
+  if (shadow_map && model->nfaces() > nall_faces_)
+  {
+    nall_faces_ = model->nfaces();
+    all_faces_ = arena_.alloc_uninitialized<int>(nall_faces_);
+    for (int i = 0; i < nall_faces_; i++)
+    {
+      all_faces_[i] = i;
+    }
+  }
+}
+
+void Frame::set_faces(const int *faces, int nfaces)
+{
+  faces_ = faces;
+  nfaces_ = nfaces;
+}
+
+void Frame::set_lods(LODChain *lods)
+{
+  lods_ = lods;
+}
+
+int Frame::lod_level(int i)
+{
+  if (!lods_ || faces_)
+  {
+    return 0;
+  }
+  // the chain's bounding sphere moved and scaled like the copy, then its radius in
+  // pixels at its center (instances only turn and scale uniformly, see instance_transform)
+  Mat4 M = instances_ ? instances_[i] : Mat4();
+  float scale = Vec3f(M.m[0][0], M.m[1][0], M.m[2][0]).norm();
+  Vec3f center = M.project(lods_->center());
+  float rhw;
+  Vec3f c = transform_.project(center, rhw);
+  if (rhw <= 0)
+  {
+    // behind the camera, it's culled anyway
+    return lods_->nlevels() - 1;
+  }
+  Vec3f edge = transform_.project(center + Vec3f(lods_->radius() * scale, 0, 0));
+  return lods_->select(std::abs(edge.x - c.x));
+}
+
+void Frame::set_strip(int full_height, int y0)
+{
+  // Shifting the transform instead would round a few edge pixels differently
+  transform_ = camera_transform(width(), full_height, settings_.zoom);
+  row0_ = y0;
+}
+
+AABB Frame::scene_bounds()
+{
+  AABB model_box;
+  if (bvh_)
+  {
+    model_box = bvh_->bounds();
+  }
+  else
+  {
+    for (int i = 0; i < model_->nverts(); i++)
+    {
+      model_box.grow(model_->vert(i));
+    }
+  }
+  AABB box;
+  for (int i = 0; i < ninstances(); i++)
+  {
+    Mat4 M = instances_ ? instances_[i] : Mat4();
+    for (int corner = 0; corner < 8; corner++)
+    {
+      Vec3f p((corner & 1) ? model_box.bmax.x : model_box.bmin.x,
+              (corner & 2) ? model_box.bmax.y : model_box.bmin.y,
+              (corner & 4) ? model_box.bmax.z : model_box.bmin.z);
+      box.grow(M.project(p));
+    }
+  }
+  return box;
+}
+
+Frame::Instance Frame::instance(int i)
+{
+  Instance inst;
+  int level = lod_level(i);
+  inst.model = level > 0 ? lods_->level(level) : model_;
+  inst.bvh = level > 0 ? lods_->bvh(level) : bvh_;
+  if (!instances_)
+  {
+    inst.transform = transform_;
+    inst.light_transform = light_transform_;
+    inst.light = light_;
+    inst.view = Vec3f(0, 0, -1);
+    return inst;
+  }
+  const Mat4 &M = instances_[i];
+  inst.transform = transform_ * M;
+  inst.light_transform = light_transform_ * M;
+  inst.light = to_model(M, light_);
+  inst.view = to_model(M, Vec3f(0, 0, -1));
+  return inst;
+}
+
+int Frame::visible_faces(const Instance &inst, int y0, int y1, int *faces)
+{
+  STATS_SCOPE(STAGE_CULL);
+  if (faces_)
+  {
+    std::copy(faces_, faces_ + nfaces_, faces);
+    return nfaces_;
+  }
+  if (inst.bvh)
+  {
+    // only the triangles in BVH nodes that overlap this part of the screen (comes
+    // back in leaf order, which is spatially coherent anyway). A copy that's
+    // entirely off it stops at the root.
+    Frustum frustum = Frustum::from_screen_rect(inst.transform.m, 0, y0, width(), y1);
+    return inst.bvh->cull(frustum, faces);
+  }
+  for (int i = 0; i < inst.model->nfaces(); i++)
+  {
+    faces[i] = i;
+  }
+  return inst.model->nfaces();
+}
+
+void Frame::shadow_pass(int y0, int y1)
+{
+  if (shadow_map)
+  {
+    for (int i = 0; i < ninstances(); i++)
+    {
+      // everything, the light sees the model from an arbitrary side
+      Instance inst = instance(i);
+      DepthShader depth(inst.model, inst.light_transform);
+      draw_depth(depth, all_faces_, inst.model->nfaces(), shadow_map, width(), height(), y0, y1);
+    }
+  }
+}
+
+float Frame::depth(int x, int y)
+{
+  int idx = x + y * width();
+  switch (settings_.depth_format)
+  {
+  case DEPTH_UNORM24:
+    return DepthTraits<uint32_t>::decode(((uint32_t *)zbuffer)[idx]);
+  case DEPTH_UNORM16:
+    return DepthTraits<uint16_t>::decode(((uint16_t *)zbuffer)[idx]);
+  default:
+    return ((float *)zbuffer)[idx];
+  }
+}
+
+template <class Depth>
+void Frame::depth_pass(Depth *zbuffer, int y0, int y1, Arena &scratch)
+{
+  int *faces = scratch.alloc_uninitialized<int>(model_->nfaces());
+  for (int i = 0; i < ninstances(); i++)
+  {
+    Instance inst = instance(i);
+    int nfaces = visible_faces(inst, y0, y1, faces);
+    STATS_SCOPE(STAGE_RASTER);
+    // any shader with the same face() and positions will do
+    TextureShader shader(inst.model, texture_, inst.transform, inst.light);
+    shader.view_dir = inst.view;
+    draw_depth(shader, faces, nfaces, zbuffer, width(), height(), y0, y1, row0_);
+  }
+}
+
+void Frame::depth_pass(int y0, int y1, Arena &scratch)
+{
+  if (abuffer)
+  {
+    // the zbuffer is only for opaque surfaces
+    return;
+  }
+  switch (settings_.depth_format)
+  {
+  case DEPTH_UNORM24:
+    depth_pass((uint32_t *)zbuffer, y0 + row0_, y1 + row0_, scratch);
+    break;
+  case DEPTH_UNORM16:
+    depth_pass((uint16_t *)zbuffer, y0 + row0_, y1 + row0_, scratch);
+    break;
+  default:
+    depth_pass((float *)zbuffer, y0 + row0_, y1 + row0_, scratch);
+    break;
+  }
+}
+
+template <class Depth>
+void Frame::color_pass(Depth *zbuffer, const Instance &inst, const int *faces, int nfaces, int y0, int y1, Arena &scratch)
+{
+  // one switch per pass, each case is its own specialized rasterizer
+  if (shadow_map)
+  {
+    ShadowShader shader(inst.model, texture_, inst.transform, inst.light, inst.light_transform, shadow_map, width(), height());
+    shade(shader, inst.view, settings_, abuffer, faces, nfaces, zbuffer, image_, scratch, y0, y1, row0_);
+    return;
+  }
+  switch (settings_.shading)
+  {
+  case SHADE_FLAT:
+  {
+    FlatShader shader(inst.model, texture_, inst.transform, inst.light);
+    shade(shader, inst.view, settings_, abuffer, faces, nfaces, zbuffer, image_, scratch, y0, y1, row0_);
+    break;
+  }
+  case SHADE_GOURAUD:
+  {
+    GouraudShader shader(inst.model, texture_, inst.transform, inst.light);
+    shade(shader, inst.view, settings_, abuffer, faces, nfaces, zbuffer, image_, scratch, y0, y1, row0_);
+    break;
+  }
+  case SHADE_PHONG:
+  {
+    PhongShader shader(inst.model, texture_, inst.transform, inst.light);
+    shade(shader, inst.view, settings_, abuffer, faces, nfaces, zbuffer, image_, scratch, y0, y1, row0_);
+    break;
+  }
+  case SHADE_BAKED:
+  {
+    BakedShader shader(inst.model, texture_, inst.transform, inst.light);
+    shade(shader, inst.view, settings_, abuffer, faces, nfaces, zbuffer, image_, scratch, y0, y1, row0_);
+    break;
+  }
+  default:
+  {
+    TextureShader shader(inst.model, texture_, inst.transform, inst.light);
+    shade(shader, inst.view, settings_, abuffer, faces, nfaces, zbuffer, image_, scratch, y0, y1, row0_);
+    break;
+  }
+  }
+}
+
+template <class Depth>
+void Frame::color_pass(Depth *zbuffer, int y0, int y1, Arena &scratch)
+{
+  int *faces = scratch.alloc_uninitialized<int>(model_->nfaces());
+  // every copy's transformed triangles go in the same spot, so the scratch space
+  // doesn't grow with the number of copies
+  Arena::Mark mark = scratch.mark();
+  for (int i = 0; i < ninstances(); i++)
+  {
+    Instance inst = instance(i);
+    int nfaces = visible_faces(inst, y0, y1, faces);
+    STATS_ADD(tris_submitted, inst.model->nfaces() - nfaces);
+    STATS_ADD(tris_culled, inst.model->nfaces() - nfaces);
+    color_pass(zbuffer, inst, faces, nfaces, y0, y1, scratch);
+    scratch.rewind(mark);
+  }
+}
+
+void Frame::color_pass(int y0, int y1, Arena &scratch)
+{
+  switch (settings_.depth_format)
+  {
+  case DEPTH_UNORM24:
+    color_pass((uint32_t *)zbuffer, y0 + row0_, y1 + row0_, scratch);
+    break;
+  case DEPTH_UNORM16:
+    color_pass((uint16_t *)zbuffer, y0 + row0_, y1 + row0_, scratch);
+    break;
+  default:
+    color_pass((float *)zbuffer, y0 + row0_, y1 + row0_, scratch);
+    break;
+  }
+}
+
+void Frame::render(int y0, int y1, Arena &scratch)
+{
+  if (settings_.z_prepass)
+  {
+    depth_pass(y0, y1, scratch);
+  }
+  color_pass(y0, y1, scratch);
+  resolve(y0, y1);
+}
+
+void Frame::resolve(int y0, int y1)
+{
+  if (abuffer)
+  {
+    abuffer->resolve(image_, y0, y1);
+  }
+}
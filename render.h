@@ -0,0 +1,178 @@
+#ifndef __RENDER_H__
+#define __RENDER_H__
+
+#include <vector>
+#include "abuffer.h"
+#include "arena.h"
+#include "bvh.h"
+#include "geometry.h"
+#include "model.h"
+#include "rasterizer.h"
+#include "simplify.h"
+#include "texture.h"
+#include "tgaimage.h"
+
+enum Shading
+{
+  SHADE_TEXTURE,
+  SHADE_FLAT,
+  SHADE_GOURAUD,
+  SHADE_PHONG,
+  SHADE_BAKED // the model's baked occlusion and light, see bake.h
+};
+
+// Parses "texture", "flat", "gouraud", "phong" or "baked", anything else is SHADE_TEXTURE
+Shading shading_from_name(const char *name);
+
+struct RenderSettings
+{
+  Shading shading;
+  bool z_prepass; // fill the zbuffer first so only visible pixels get shaded
+  bool shadows;   // Phong shading with a shadow map
+  Vec3f light_dir;
+  float zoom;
+  DepthFormat depth_format;
+  bool compress_texture; // sample a BC1 copy of the texture (see texture.h)
+  // that copy, set by whoever loads the texture. The TGAImage isn't touched then.
+  const CompressedTexture *compressed_texture;
+  float opacity;     // < 1 draws the model see-through, through an A-buffer (see abuffer.h)
+  int oit_fragments; // the A-buffer's pool, 0 for 4 fragments a pixel
+
+  RenderSettings() : shading(SHADE_TEXTURE), z_prepass(false), shadows(false), light_dir(0, 0, -1), zoom(1.0f), depth_format(DEPTH_FLOAT),
+                     compress_texture(false), compressed_texture(NULL), opacity(1.0f), oit_fragments(0) {}
+};
+
+// Parses "float", "unorm24" or "unorm16", returns false for anything else
+bool depth_format_from_name(const char *name, DepthFormat &format);
+
+// The camera sits at (0, 0, camera_z) looking down -z. Only what's between the
+// near and far planes (distances from the camera) is drawn.
+const float camera_z = 3.0f;
+const float camera_near = 1.0f;
+const float camera_far = 10.0f;
+
+// the model fills the middle 3/4 of the image, scaled up by `zoom`
+Matrix camera_viewport(int width, int height, float zoom);
+Matrix camera_projection();
+// Viewport * Projection
+Mat4 camera_transform(int width, int height, float zoom);
+
+// Turns the model by `yaw` degrees around y, scales it by `scale` and moves it to
+// `position`. Instances are only moved like this (no shear or non-uniform scale),
+// so lights and normals can be taken to the model's space with the transpose.
+Mat4 instance_transform(Vec3f position, float yaw, float scale);
+
+// Reads one instance per line, "x y z [yaw [scale]]", blank lines and lines starting
+// with '#' are skipped. Prints the bad line and returns false if one can't be parsed.
+bool read_instances(const char *filename, std::vector<Mat4> &instances);
+
+// One image of one model. Everything the passes share (transforms, zbuffer, shadow
+// map) is set up in the constructor, and the passes only touch rows [y0, y1) of
+// the image, zbuffer and shadow map, so a frame can be split into bands that are
+// rendered on different threads at the same time.
+//
+// The shadow map has to be finished before any color_pass(), the z-prepass
+// (depth_pass) doesn't need it.
+//
+// With `instances` the frame has `ninstances` copies of the model, copy i moved by
+// instances[i] (the array isn't copied, it has to outlive the frame). The copies
+// share the model, BVH and texture, and every pass bins all of them at once: each
+// copy is culled against the pass's rows with the BVH (a copy that's off them is
+// dropped at the root) and what's left is drawn into the same zbuffer, so nothing
+// is kept per copy and a band of rows can be rendered on its own as usual. The
+// shadow map is fitted around all of them.
+//
+// With settings.opacity < 1 the color pass puts fragments in an A-buffer instead of
+// the image (there's no z-prepass then, it would hide everything behind the front
+// layer), and resolve() blends them into the image. render() does that for its rows.
+//
+// The zbuffer and shadow map come out of `arena`, and each pass puts what it only
+// needs while it runs (culled faces, transformed triangles) in `scratch`, so with
+// arenas that are kept from one frame to the next nothing here touches the heap.
+// The arenas are only reset by their owner, after the frame is done.
+class Frame
+{
+  Model *model_;
+  BVH *bvh_;
+  TGAImage *texture_;
+  RenderSettings settings_;
+  TGAImage &image_;
+  Mat4 transform_; // Viewport * Projection
+  Vec3f light_;
+  Mat4 light_transform_;
+  Arena &arena_;
+  int *all_faces_; // 0, 1, 2... for the shadow pass
+  int nall_faces_;
+  const Mat4 *instances_; // NULL for the model as it is
+  int ninstances_;
+  const int *faces_; // set_faces()
+  int nfaces_;
+  LODChain *lods_; // set_lods()
+  int row0_;        // set_strip(), where the image starts in the frame
+
+  // What the shaders need for one copy of the model
+  struct Instance
+  {
+    Model *model; // model_, or the level of lods_ that suits the copy's size
+    BVH *bvh;
+    Mat4 transform, light_transform;
+    Vec3f light, view; // in the model's space
+  };
+  Instance instance(int i);
+  // around every copy of the model
+  AABB scene_bounds();
+  // faces of one copy that can show up in rows [y0, y1). These and the passes below
+  // take rows of the full frame, see set_strip().
+  int visible_faces(const Instance &inst, int y0, int y1, int *faces);
+  template <class Depth>
+  void depth_pass(Depth *zbuffer, int y0, int y1, Arena &scratch);
+  template <class Depth>
+  void color_pass(Depth *zbuffer, int y0, int y1, Arena &scratch);
+  template <class Depth>
+  void color_pass(Depth *zbuffer, const Instance &inst, const int *faces, int nfaces, int y0, int y1, Arena &scratch);
+
+public:
+  void *zbuffer; // settings.depth_format decides what's in it
+  float *shadow_map; // NULL unless settings.shadows, same size as the image
+  ABuffer *abuffer;  // NULL unless settings.opacity < 1
+
+  Frame(Model *model, BVH *bvh, TGAImage *texture, const RenderSettings &settings, TGAImage &image, Arena &arena,
+        const Mat4 *instances = NULL, int ninstances = 0);
+
+  int width() { return image_.get_width(); }
+  int height() { return image_.get_height(); }
+  bool has_shadows() { return shadow_map != NULL; }
+  int ninstances() { return instances_ ? ninstances_ : 1; }
+  // Swaps in another model, e.g. the next chunk of a streamed mesh. Whatever has
+  // been drawn so far stays in the image, zbuffer and shadow map. Not while a pass
+  // is running.
+  void set_model(Model *model, BVH *bvh);
+  // Only these faces are drawn from now on, instead of the ones the BVH finds. They're
+  // the model's, so this turns off set_lods().
+  void set_faces(const int *faces, int nfaces);
+  // Draws every copy of the model with the level of `lods` that suits its size on
+  // screen (LODChain::select) instead. The model has to be lods->level(0), and the
+  // other levels are culled with the chain's BVHs if it has them (build_bvhs()).
+  void set_lods(LODChain *lods);
+  // Which level of the chain copy i is drawn with, 0 without one
+  int lod_level(int i);
+  // The image is rows [y0, y0 + height()) of a full_height one (as wide), for
+  // rendering a big image a strip at a time. Everything is projected as in the full
+  // image and only the rows written are moved up, so the strips put together are the
+  // same as the full render, to the byte. The passes still take rows of the image.
+  // Not with shadows, the shadow map is only as big as the image.
+  void set_strip(int full_height, int y0);
+  // zbuffer value of a pixel in [0, 1], 0 where nothing's been drawn
+  float depth(int x, int y);
+
+  void shadow_pass(int y0, int y1);
+  void depth_pass(int y0, int y1, Arena &scratch);
+  void color_pass(int y0, int y1, Arena &scratch);
+  // Blends the A-buffer into rows [y0, y1) of the image, once every color_pass() that
+  // draws on them is done. Nothing without one.
+  void resolve(int y0, int y1);
+  // depth_pass() if there's a z-prepass, then color_pass() and resolve()
+  void render(int y0, int y1, Arena &scratch);
+};
+
+#endif //__RENDER_H__
@@ -0,0 +1,341 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "batch.h"
+#include "server.h"
+
+namespace
+{
+  // how many of the latest renders the latency percentiles are over
+  const size_t latency_window = 4096;
+
+  typedef std::chrono::steady_clock Clock;
+
+  bool write_all(int fd, const char *data, size_t size)
+  {
+    while (size > 0)
+    {
+      ssize_t n = write(fd, data, size);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        return false;
+      data += n;
+      size -= n;
+    }
+    return true;
+  }
+
+  // A socket client, or stdin and stdout
+  struct Connection
+  {
+    int in, out;
+    std::mutex mutex; // one reply at a time, the jobs finish on different workers
+    std::string buffer;
+
+    Connection(int i, int o) : in(i), out(o) {}
+    ~Connection()
+    {
+      if (in == out)
+        close(in);
+    }
+
+    // false at the end of the input
+    bool read_line(std::string &line)
+    {
+      size_t eol;
+      while ((eol = buffer.find('\n')) == std::string::npos)
+      {
+        char chunk[4096];
+        ssize_t n = read(in, chunk, sizeof(chunk));
+        if (n < 0 && errno == EINTR)
+          continue;
+        if (n <= 0)
+        {
+          // a last line without a newline still counts
+          line.swap(buffer);
+          buffer.clear();
+          return !line.empty();
+        }
+        buffer.append(chunk, n);
+      }
+      line = buffer.substr(0, eol);
+      buffer.erase(0, eol + 1);
+      return true;
+    }
+
+    // Nothing happens if the other end has gone away
+    void send(const std::string &reply, const std::string &data = std::string())
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (write_all(out, reply.data(), reply.size()))
+        write_all(out, data.data(), data.size());
+    }
+  };
+
+  // A render on its way through the BatchRenderer
+  struct Request
+  {
+    long id;
+    int queued;
+    Clock::time_point arrived;
+    std::string output;
+    std::shared_ptr<Connection> connection;
+  };
+
+  class Server
+  {
+  public:
+    Server(int threads, size_t cache_budget)
+        : renderer_(threads, cache_budget), start_(Clock::now()), listener_(-1), requests_(0), done_(0), failed_(0), queued_(0),
+          latency_sum_(0), latency_max_(0), timed_(0), clients_(0), stopping_(false) {}
+
+    // Answers the requests from one connection until it closes. Returns true if it said quit.
+    bool serve(std::shared_ptr<Connection> connection)
+    {
+      std::string line;
+      while (connection->read_line(line))
+      {
+        std::istringstream iss(line);
+        std::string first;
+        if (!(iss >> first) || first[0] == '#')
+          continue;
+        if (first == "quit")
+          return true;
+        if (first == "stats")
+          connection->send(stats());
+        else
+          render(connection, line);
+      }
+      return false;
+    }
+
+    // Takes clients on the socket until one of them says quit
+    int listen(const char *path)
+    {
+      sockaddr_un addr;
+      memset(&addr, 0, sizeof(addr));
+      addr.sun_family = AF_UNIX;
+      if (strlen(path) >= sizeof(addr.sun_path))
+      {
+        std::cerr << "socket path too long: " << path << std::endl;
+        return 1;
+      }
+      strcpy(addr.sun_path, path);
+      // a server that died before could have left its socket behind, but
+      // anything else there is somebody's file
+      struct stat st;
+      if (lstat(path, &st) == 0)
+      {
+        if (!S_ISSOCK(st.st_mode))
+        {
+          std::cerr << "can't listen on " << path << ": it exists and isn't a socket" << std::endl;
+          return 1;
+        }
+        unlink(path);
+      }
+      listener_ = socket(AF_UNIX, SOCK_STREAM, 0);
+      if (listener_ < 0 || bind(listener_, (sockaddr *)&addr, sizeof(addr)) < 0 || ::listen(listener_, 16) < 0)
+      {
+        std::cerr << "can't listen on " << path << ": " << strerror(errno) << std::endl;
+        if (listener_ >= 0)
+          close(listener_);
+        return 1;
+      }
+      std::cerr << "listening on " << path << " with " << renderer_.threads() << " threads" << std::endl;
+
+      while (!stopping_)
+      {
+        int fd = accept(listener_, NULL, NULL);
+        if (fd < 0)
+        {
+          if (errno == EINTR || errno == ECONNABORTED)
+            continue;
+          break;
+        }
+        std::shared_ptr<Connection> connection(new Connection(fd, fd));
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          open_.insert(fd);
+          clients_++;
+        }
+        std::thread([this, connection]()
+                    { client(connection); })
+            .detach();
+      }
+
+      // the other clients get no more requests in, but still get their replies
+      std::unique_lock<std::mutex> lock(mutex_);
+      for (std::set<int>::iterator it = open_.begin(); it != open_.end(); ++it)
+      {
+        shutdown(*it, SHUT_RD);
+      }
+      clients_cv_.wait(lock, [this]()
+                       { return clients_ == 0; });
+      lock.unlock();
+      renderer_.wait();
+      close(listener_);
+      unlink(path);
+      return 0;
+    }
+
+    void wait() { renderer_.wait(); }
+
+  private:
+    BatchRenderer renderer_;
+    Clock::time_point start_;
+    int listener_;
+    std::mutex mutex_; // everything below
+    long requests_, done_, failed_;
+    int queued_; // taken and not answered yet
+    double latency_sum_, latency_max_;
+    long timed_; // renders that went into latency_sum_
+    std::deque<double> latencies_; // the last latency_window of them
+    std::set<int> open_;           // clients' sockets
+    int clients_;
+    std::condition_variable clients_cv_;
+    std::atomic<bool> stopping_;
+
+    void client(std::shared_ptr<Connection> connection)
+    {
+      if (serve(connection))
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+        // wakes up accept()
+        shutdown(listener_, SHUT_RDWR);
+      }
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        open_.erase(connection->in);
+      }
+      // the socket closes once the last of its jobs has replied
+      connection.reset();
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (--clients_ == 0)
+        clients_cv_.notify_all();
+    }
+
+    void render(std::shared_ptr<Connection> connection, const std::string &line)
+    {
+      Request request;
+      request.arrived = Clock::now();
+      request.connection = connection;
+      BatchJob job;
+      bool ok = parse_job(line, job);
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        request.id = requests_++;
+        request.queued = queued_;
+        if (ok)
+          queued_++;
+        else
+          failed_++;
+      }
+      if (!ok)
+      {
+        std::ostringstream reply;
+        reply << "{\"request\": " << request.id << ", \"ok\": false, \"error\": \"bad request\"}\n";
+        connection->send(reply.str());
+        return;
+      }
+      request.output = job.output;
+      renderer_.submit(job, [this, request](const BatchResult &result)
+                       { finish(request, result); });
+    }
+
+    // on the worker that finished the job
+    void finish(const Request &request, const BatchResult &result)
+    {
+      bool ok = result.ok;
+      const char *error = result.error;
+      std::string data;
+      if (ok && result.image)
+      {
+        std::ostringstream tga;
+        ok = result.image->write_tga(tga);
+        if (ok)
+          data = tga.str();
+        else
+          error = "can't encode output";
+      }
+      double latency = std::chrono::duration<double, std::milli>(Clock::now() - request.arrived).count();
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queued_--;
+        if (ok)
+          done_++;
+        else
+          failed_++;
+        latency_sum_ += latency;
+        timed_++;
+        latency_max_ = std::max(latency_max_, latency);
+        latencies_.push_back(latency);
+        if (latencies_.size() > latency_window)
+          latencies_.pop_front();
+      }
+
+      std::ostringstream reply;
+      reply << "{\"request\": " << request.id << ", \"output\": " << json_string(request.output) << ", \"ok\": " << (ok ? "true" : "false");
+      if (error)
+      {
+        reply << ", \"error\": " << json_string(error);
+      }
+      reply << ", \"bands\": " << result.bands << ", \"ms\": " << result.ms << ", \"latency_ms\": " << latency
+            << ", \"queued\": " << request.queued;
+      if (ok && result.image)
+      {
+        reply << ", \"bytes\": " << data.size();
+      }
+      reply << "}\n";
+      request.connection->send(reply.str(), data);
+    }
+
+    std::string stats()
+    {
+      std::ostringstream out;
+      double uptime = std::chrono::duration<double>(Clock::now() - start_).count();
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::vector<double> sorted(latencies_.begin(), latencies_.end());
+        std::sort(sorted.begin(), sorted.end());
+        out << "{\"requests\": " << requests_ << ", \"done\": " << done_ << ", \"failed\": " << failed_ << ", \"queued\": " << queued_
+            << ", \"uptime_s\": " << uptime << ", \"throughput\": " << (uptime > 0 ? done_ / uptime : 0) << ", \"latency_ms\": {\"mean\": "
+            << (timed_ ? latency_sum_ / timed_ : 0) << ", \"p50\": " << (sorted.empty() ? 0 : sorted[sorted.size() / 2])
+            << ", \"p95\": " << (sorted.empty() ? 0 : sorted[sorted.size() * 95 / 100]) << ", \"max\": " << latency_max_ << "}}\n";
+      }
+      renderer_.print_cache_stats(out);
+      return out.str();
+    }
+  };
+}
+
+int run_server(const char *socket_path, int threads, size_t cache_budget)
+{
+  // a client that hangs up before its reply shouldn't take the server with it
+  signal(SIGPIPE, SIG_IGN);
+  Server server(threads, cache_budget);
+  if (socket_path)
+  {
+    return server.listen(socket_path);
+  }
+  std::shared_ptr<Connection> connection(new Connection(STDIN_FILENO, STDOUT_FILENO));
+  server.serve(connection);
+  server.wait();
+  return 0;
+}
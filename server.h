@@ -0,0 +1,45 @@
+#ifndef __SERVER_H__
+#define __SERVER_H__
+
+#include <cstddef>
+
+/*
+
+Render server: one BatchRenderer (see batch.h) that stays up between requests, so the
+worker threads are already running and models, BVHs and textures stay in its caches
+from one request to the next instead of being loaded for every frame.
+
+Requests come one per line, on stdin (with the replies on stdout) or from any number
+of clients connected to a Unix domain socket. A request is either a manifest line
+(see batch.h), rendered like a batch job, or one of
+
+  stats   what the server has done so far, and the cache counts
+  quit    on a socket, stops the server once the jobs it has are done. On stdin it's
+          the same as the end of the input.
+
+Every render gets one JSON object per line back on the connection it came from, in
+whatever order the jobs finish:
+
+  {"request": 3, "output": "out/head.tga", "ok": true, "bands": 1, "ms": 12.5, "latency_ms": 40.1, "queued": 2}
+
+`request` counts the requests of the whole server, `ms` is the render itself,
+`latency_ms` is from the line being read to the reply, and `queued` is how many
+renders were already in the server when it came in. With output `-` nothing is
+written to disk: the reply gets a "bytes": n and the n bytes of the TGA (RLE
+compressed) follow right after its newline.
+
+`stats` replies with
+
+  {"requests": 40, "done": 38, "failed": 0, "queued": 2, "uptime_s": 3.2, "throughput": 11.9,
+   "latency_ms": {"mean": 35.2, "p50": 30.1, "p95": 80.7, "max": 95.0}}
+
+(on one line) followed by one line per cache like run_batch(). The percentiles are
+over the last few thousand renders.
+
+*/
+
+// socket_path NULL means stdin and stdout. Returns 0 once it's been told to stop, 1
+// if the socket can't be set up.
+int run_server(const char *socket_path, int threads, size_t cache_budget);
+
+#endif //__SERVER_H__
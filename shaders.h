@@ -0,0 +1,264 @@
+#ifndef __SHADERS_H__
+#define __SHADERS_H__
+
+#include <algorithm>
+#include "geometry.h"
+#include "model.h"
+#include "rasterizer.h"
+#include "texture.h"
+#include "tgaimage.h"
+
+// Things every model shader needs. Derived shaders hide face()/vertex()/fragment()
+// as needed; since draw() is instantiated with the derived type there's no virtual call.
+struct ModelShader
+{
+  Model *model;
+  TGAImage *texture;
+  Mat4 transform; // Viewport * Projection
+  Vec3f light_dir;
+  Vec3f view_dir; // where the camera looks, in the model's space (an instance can be turned)
+  const CompressedTexture *compressed; // sampled instead of `texture` if it's set
+  bool cull_back; // false when the back faces can be seen through the front ones
+
+  ModelShader(Model *m, TGAImage *tex, Mat4 t, Vec3f light) : model(m), texture(tex), transform(t), light_dir(light), view_dir(0, 0, -1), compressed(NULL), cull_back(true) {}
+
+  // back faces (facing away from the camera) are skipped
+  inline bool face(int iface)
+  {
+    return !cull_back || face_normal(iface) * view_dir >= 0;
+  }
+
+  // points into the model, since the obj faces are wound counter clockwise
+  inline Vec3f face_normal(int iface)
+  {
+    FaceIndices pos_indices = model->tri_indices(iface);
+    Vec3f v0 = model->vert(pos_indices[0]);
+    Vec3f normal = (model->vert(pos_indices[2]) - v0) ^ (model->vert(pos_indices[1]) - v0);
+    return normal.normalize();
+  }
+
+  // the normal at a corner, pointing out of the model. A face without normals (-1)
+  // gets its face normal, turned around to point out too.
+  inline Vec3f vertex_normal(int iface, int nthvert)
+  {
+    int n = model->norm_indices(iface)[nthvert];
+    return n >= 0 ? model->norm(n) : face_normal(iface) * -1.0f;
+  }
+
+  inline Vec3f position(int iface, int nthvert)
+  {
+    return transform.project(model->vert(model->tri_indices(iface)[nthvert]));
+  }
+
+  inline TGAColor sample(float u, float v)
+  {
+    if (compressed)
+    {
+      return compressed->get((int)(u * compressed->get_width()), (int)((1.0 - v) * compressed->get_height()));
+    }
+    return texture->get((int)(u * texture->get_width()), (int)((1.0 - v) * texture->get_height()));
+  }
+
+  static inline TGAColor scale(TGAColor c, float intensity)
+  {
+    intensity = std::min(1.0f, std::max(0.0f, intensity));
+    for (int i = 0; i < 3; i++)
+    {
+      c.raw[i] = (unsigned char)(c.raw[i] * intensity);
+    }
+    return c;
+  }
+};
+
+// Unlit texture, what flat_model() has always drawn
+struct TextureShader : public ModelShader
+{
+  static const int nvaryings = 2; // u, v
+
+  TextureShader(Model *m, TGAImage *tex, Mat4 t, Vec3f light) : ModelShader(m, tex, t, light) {}
+
+  inline Vec3f vertex(int iface, int nthvert, float *varying, float &rhw)
+  {
+    Vec2f uv = model->uv(model->uv_indices(iface)[nthvert]);
+    varying[0] = uv.x;
+    varying[1] = uv.y;
+    return transform.project(model->vert(model->tri_indices(iface)[nthvert]), rhw);
+  }
+
+  inline bool fragment(const float *varying, TGAColor &color)
+  {
+    color = sample(varying[0], varying[1]);
+    return true;
+  }
+};
+
+// One intensity per face, from the face normal. It's the same at all three
+// corners, so it goes through the varyings like everything else.
+struct FlatShader : public ModelShader
+{
+  static const int nvaryings = 3; // u, v, intensity
+  float intensity;
+
+  FlatShader(Model *m, TGAImage *tex, Mat4 t, Vec3f light) : ModelShader(m, tex, t, light), intensity(0) {}
+
+  inline bool face(int iface)
+  {
+    Vec3f normal = face_normal(iface);
+    intensity = normal * light_dir;
+    return !cull_back || normal * view_dir >= 0;
+  }
+
+  inline Vec3f vertex(int iface, int nthvert, float *varying, float &rhw)
+  {
+    Vec2f uv = model->uv(model->uv_indices(iface)[nthvert]);
+    varying[0] = uv.x;
+    varying[1] = uv.y;
+    varying[2] = intensity;
+    return transform.project(model->vert(model->tri_indices(iface)[nthvert]), rhw);
+  }
+
+  inline bool fragment(const float *varying, TGAColor &color)
+  {
+    color = scale(sample(varying[0], varying[1]), varying[2]);
+    return true;
+  }
+};
+
+// Lighting computed per vertex from the vertex normals, interpolated across the face
+struct GouraudShader : public ModelShader
+{
+  static const int nvaryings = 3; // u, v, intensity
+
+  GouraudShader(Model *m, TGAImage *tex, Mat4 t, Vec3f light) : ModelShader(m, tex, t, light) {}
+
+  inline Vec3f vertex(int iface, int nthvert, float *varying, float &rhw)
+  {
+    Vec2f uv = model->uv(model->uv_indices(iface)[nthvert]);
+    Vec3f n = vertex_normal(iface, nthvert);
+    varying[0] = uv.x;
+    varying[1] = uv.y;
+    // obj normals point out of the model, light_dir points into the screen
+    varying[2] = -(n.normalize() * light_dir);
+    return transform.project(model->vert(model->tri_indices(iface)[nthvert]), rhw);
+  }
+
+  inline bool fragment(const float *varying, TGAColor &color)
+  {
+    color = scale(sample(varying[0], varying[1]), varying[2]);
+    return true;
+  }
+};
+
+// The normal is interpolated and lit per pixel
+struct PhongShader : public ModelShader
+{
+  static const int nvaryings = 5; // u, v, normal
+
+  PhongShader(Model *m, TGAImage *tex, Mat4 t, Vec3f light) : ModelShader(m, tex, t, light) {}
+
+  inline Vec3f vertex(int iface, int nthvert, float *varying, float &rhw)
+  {
+    Vec2f uv = model->uv(model->uv_indices(iface)[nthvert]);
+    Vec3f n = vertex_normal(iface, nthvert);
+    varying[0] = uv.x;
+    varying[1] = uv.y;
+    varying[2] = n.x;
+    varying[3] = n.y;
+    varying[4] = n.z;
+    return transform.project(model->vert(model->tri_indices(iface)[nthvert]), rhw);
+  }
+
+  inline bool fragment(const float *varying, TGAColor &color)
+  {
+    Vec3f n(varying[2], varying[3], varying[4]);
+    float intensity = -(n.normalize() * light_dir);
+    color = scale(sample(varying[0], varying[1]), intensity);
+    return true;
+  }
+};
+
+// Lighting baked into the model's vertices (see bake.h), interpolated like Gouraud.
+// Just the occlusion if only that was baked, otherwise some ambient light (as much as
+// the occlusion lets in) plus the baked direct light. The light is baked in the model's
+// space, so it turns with an instance.
+struct BakedShader : public ModelShader
+{
+  static const int nvaryings = 3; // u, v, intensity
+  static constexpr float ambient = 0.3f;
+
+  BakedShader(Model *m, TGAImage *tex, Mat4 t, Vec3f light) : ModelShader(m, tex, t, light) {}
+
+  inline Vec3f vertex(int iface, int nthvert, float *varying, float &rhw)
+  {
+    Vec2f uv = model->uv(model->uv_indices(iface)[nthvert]);
+    int v = model->tri_indices(iface)[nthvert];
+    varying[0] = uv.x;
+    varying[1] = uv.y;
+    varying[2] = model->has_irradiance() ? ambient * model->ao(v) + (1 - ambient) * model->irradiance(v) : model->ao(v);
+    return transform.project(model->vert(v), rhw);
+  }
+
+  inline bool fragment(const float *varying, TGAColor &color)
+  {
+    color = scale(sample(varying[0], varying[1]), varying[2]);
+    return true;
+  }
+};
+
+// Positions only, for filling in a depth buffer from some other point of view
+// (e.g. a shadow map). Nothing is culled since the model is seen from an arbitrary side.
+struct DepthShader
+{
+  Model *model;
+  Mat4 transform;
+
+  DepthShader(Model *m, Mat4 t) : model(m), transform(t) {}
+
+  inline bool face(int iface) { return true; }
+
+  inline Vec3f position(int iface, int nthvert)
+  {
+    return transform.project(model->vert(model->tri_indices(iface)[nthvert]));
+  }
+};
+
+// Phong lighting, darkened where the light's depth buffer has something closer to
+// the light than this pixel
+struct ShadowShader : public PhongShader
+{
+  static const int nvaryings = 8; // u, v, normal, position in shadow map space
+  Mat4 light_transform; // model -> shadow map screen coords
+  float *shadow_map;
+  int shadow_width, shadow_height;
+
+  ShadowShader(Model *m, TGAImage *tex, Mat4 t, Vec3f light, Mat4 lt, float *map, int w, int h)
+      : PhongShader(m, tex, t, light), light_transform(lt), shadow_map(map), shadow_width(w), shadow_height(h) {}
+
+  inline Vec3f vertex(int iface, int nthvert, float *varying, float &rhw)
+  {
+    Vec3f v = model->vert(model->tri_indices(iface)[nthvert]);
+    Vec3f l = light_transform.project(v);
+    varying[5] = l.x;
+    varying[6] = l.y;
+    varying[7] = l.z;
+    return PhongShader::vertex(iface, nthvert, varying, rhw);
+  }
+
+  inline bool fragment(const float *varying, TGAColor &color)
+  {
+    PhongShader::fragment(varying, color);
+    int x = (int)varying[5], y = (int)varying[6];
+    if (x >= 0 && y >= 0 && x < shadow_width && y < shadow_height)
+    {
+      // the small bias keeps a surface from shadowing itself (shadow acne)
+      const float bias = 0.005f;
+      if (shadow_map[x + y * shadow_width] > varying[7] + bias)
+      {
+        color = scale(color, 0.3f);
+      }
+    }
+    return true;
+  }
+};
+
+#endif //__SHADERS_H__
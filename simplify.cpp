@@ -0,0 +1,490 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <iostream>
+#include <iterator>
+#include <queue>
+#include "simplify.h"
+
+namespace
+{
+  // Symmetric 4x4 matrix, only the upper triangle is stored:
+  // | a b c d |
+  // |   e f g |
+  // |     h i |
+  // |       j |
+  struct Quadric
+  {
+    double q[10];
+    double weight; // total weight of the planes, to turn the error into a mean
+    Quadric() : weight(0)
+    {
+      for (int i = 0; i < 10; i++)
+        q[i] = 0;
+    }
+    // the squared distance to the plane ax + by + cz + d = 0, times weight
+    Quadric(double a, double b, double c, double d, double weight) : weight(weight)
+    {
+      q[0] = a * a * weight;
+      q[1] = a * b * weight;
+      q[2] = a * c * weight;
+      q[3] = a * d * weight;
+      q[4] = b * b * weight;
+      q[5] = b * c * weight;
+      q[6] = b * d * weight;
+      q[7] = c * c * weight;
+      q[8] = c * d * weight;
+      q[9] = d * d * weight;
+    }
+    Quadric &operator+=(const Quadric &o)
+    {
+      for (int i = 0; i < 10; i++)
+        q[i] += o.q[i];
+      weight += o.weight;
+      return *this;
+    }
+    double error(const Vec3f &v) const
+    {
+      double x = v.x, y = v.y, z = v.z;
+      return q[0] * x * x + 2 * q[1] * x * y + 2 * q[2] * x * z + 2 * q[3] * x +
+             q[4] * y * y + 2 * q[5] * y * z + 2 * q[6] * y +
+             q[7] * z * z + 2 * q[8] * z +
+             q[9];
+    }
+  };
+
+  struct Collapse
+  {
+    double cost;
+    int from, to;
+    int stamp; // `from`'s stamp when this was computed, stale entries are skipped
+    bool operator<(const Collapse &o) const { return cost > o.cost; } // min-heap
+  };
+
+  struct Face
+  {
+    int pos[3], uv[3], norm[3];
+    bool alive;
+  };
+
+  class Simplifier
+  {
+  public:
+    std::vector<Vec3f> verts;
+    std::vector<Face> faces;
+    std::vector<Quadric> quadrics;
+    std::vector<std::vector<int> > vert_faces; // may contain dead faces, filtered lazily
+    std::vector<bool> locked;                  // uv seam / hard edge vertices can't be moved
+    std::vector<bool> removed;
+    std::vector<int> stamps;
+    std::priority_queue<Collapse> heap;
+    int alive_faces;
+
+    Simplifier(Model &model) : alive_faces(0)
+    {
+      int nv = model.nverts();
+      verts.resize(nv);
+      for (int i = 0; i < nv; i++)
+        verts[i] = model.vert(i);
+      faces.resize(model.nfaces());
+      vert_faces.resize(nv);
+      quadrics.resize(nv);
+      locked.assign(nv, false);
+      removed.assign(nv, false);
+      stamps.assign(nv, 0);
+
+      std::vector<int> vert_uv(nv, -1), vert_norm(nv, -1);
+      for (int f = 0; f < model.nfaces(); f++)
+      {
+        FaceIndices pos = model.tri_indices(f);
+        FaceIndices uv = model.uv_indices(f);
+        FaceIndices norm = model.norm_indices(f);
+        Face &face = faces[f];
+        // a face with fewer than three corners (or no uvs) is dropped
+        face.alive = pos[0] >= 0 && pos[1] >= 0 && pos[2] >= 0 && uv[0] >= 0 && uv[1] >= 0 && uv[2] >= 0;
+        if (!face.alive)
+          continue;
+        for (int j = 0; j < 3; j++)
+        {
+          face.pos[j] = pos[j];
+          face.uv[j] = uv[j];
+          face.norm[j] = norm[j];
+          vert_faces[pos[j]].push_back(f);
+          if ((vert_uv[pos[j]] >= 0 && vert_uv[pos[j]] != face.uv[j]) ||
+              (vert_norm[pos[j]] >= 0 && vert_norm[pos[j]] != face.norm[j]))
+          {
+            // uv seam or hard edge
+            locked[pos[j]] = true;
+          }
+          vert_uv[pos[j]] = face.uv[j];
+          vert_norm[pos[j]] = face.norm[j];
+        }
+        alive_faces++;
+
+        Vec3f n = (verts[face.pos[1]] - verts[face.pos[0]]) ^ (verts[face.pos[2]] - verts[face.pos[0]]);
+        float area = n.norm();
+        if (area <= 0)
+          continue;
+        n = n * (1.0f / area);
+        Quadric plane(n.x, n.y, n.z, -(n * verts[face.pos[0]]), area);
+        for (int j = 0; j < 3; j++)
+          quadrics[face.pos[j]] += plane;
+      }
+
+      // Open borders: add a plane through each border edge, perpendicular to its face,
+      // so moving along the border is free but moving off it is expensive
+      for (size_t f = 0; f < faces.size(); f++)
+      {
+        if (!faces[f].alive)
+          continue;
+        for (int j = 0; j < 3; j++)
+        {
+          int a = faces[f].pos[j], b = faces[f].pos[(j + 1) % 3];
+          if (count_faces_with_edge(a, b) != 1)
+            continue;
+          Vec3f e = verts[b] - verts[a];
+          Vec3f n = (verts[faces[f].pos[1]] - verts[faces[f].pos[0]]) ^ (verts[faces[f].pos[2]] - verts[faces[f].pos[0]]);
+          Vec3f p = e ^ n;
+          float len = p.norm();
+          if (len <= 0)
+            continue;
+          p = p * (1.0f / len);
+          Quadric border(p.x, p.y, p.z, -(p * verts[a]), 1000.0 * (e * e));
+          // the border planes only add error, they don't count towards the average
+          border.weight = 0;
+          quadrics[a] += border;
+          quadrics[b] += border;
+        }
+      }
+
+      for (int v = 0; v < nv; v++)
+        push_best_collapse(v);
+    }
+
+    int count_faces_with_edge(int a, int b)
+    {
+      int n = 0;
+      for (size_t i = 0; i < vert_faces[a].size(); i++)
+      {
+        const Face &face = faces[vert_faces[a][i]];
+        if (face.alive && (face.pos[0] == b || face.pos[1] == b || face.pos[2] == b))
+          n++;
+      }
+      return n;
+    }
+
+    // Collapsing `from` onto `to` is only valid if no remaining face flips over, and
+    // `from`'s uv/normal can be replaced by `to`'s consistently.
+    bool valid_collapse(int from, int to, int &to_uv, int &to_norm)
+    {
+      to_uv = -1;
+      to_norm = -1;
+      int shared = 0;
+      for (size_t i = 0; i < vert_faces[from].size(); i++)
+      {
+        const Face &face = faces[vert_faces[from][i]];
+        if (!face.alive)
+          continue;
+        int k = -1, self = -1;
+        for (int j = 0; j < 3; j++)
+        {
+          if (face.pos[j] == to)
+            k = j;
+          if (face.pos[j] == from)
+            self = j;
+        }
+        if (k >= 0)
+        {
+          // this face disappears, but tells us which uv `to` has on this side of the mesh
+          if ((to_uv >= 0 && to_uv != face.uv[k]) || (to_norm >= 0 && to_norm != face.norm[k]))
+            return false;
+          to_uv = face.uv[k];
+          to_norm = face.norm[k];
+          shared++;
+          continue;
+        }
+        Vec3f p[3];
+        for (int j = 0; j < 3; j++)
+          p[j] = verts[face.pos[j]];
+        Vec3f before = (p[1] - p[0]) ^ (p[2] - p[0]);
+        p[self] = verts[to];
+        Vec3f after = (p[1] - p[0]) ^ (p[2] - p[0]);
+        if (before * after <= 0)
+          return false;
+      }
+      // edges used by more than two faces are left alone
+      if (shared == 0 || shared > 2)
+        return false;
+      // Link condition: the only vertices adjacent to both ends may be the tips of the
+      // faces being removed, otherwise the collapse pinches the surface together
+      std::vector<int> from_ring, to_ring, common;
+      ring(from, from_ring);
+      ring(to, to_ring);
+      std::set_intersection(from_ring.begin(), from_ring.end(), to_ring.begin(), to_ring.end(), std::back_inserter(common));
+      return (int)common.size() == shared;
+    }
+
+    // sorted, unique neighbours of v
+    void ring(int v, std::vector<int> &out)
+    {
+      out.clear();
+      for (size_t i = 0; i < vert_faces[v].size(); i++)
+      {
+        const Face &face = faces[vert_faces[v][i]];
+        if (!face.alive)
+          continue;
+        for (int j = 0; j < 3; j++)
+        {
+          if (face.pos[j] != v)
+            out.push_back(face.pos[j]);
+        }
+      }
+      std::sort(out.begin(), out.end());
+      out.erase(std::unique(out.begin(), out.end()), out.end());
+    }
+
+    void push_best_collapse(int v)
+    {
+      stamps[v]++;
+      if (locked[v] || removed[v])
+        return;
+      double best_cost = DBL_MAX;
+      int best = -1;
+      for (size_t i = 0; i < vert_faces[v].size(); i++)
+      {
+        const Face &face = faces[vert_faces[v][i]];
+        if (!face.alive)
+          continue;
+        for (int j = 0; j < 3; j++)
+        {
+          int to = face.pos[j];
+          if (to == v)
+            continue;
+          Quadric q = quadrics[v];
+          q += quadrics[to];
+          // mean squared distance to the planes, so the cost is in model units
+          double cost = q.error(verts[to]) / std::max(q.weight, 1e-12);
+          if (cost < best_cost)
+          {
+            best_cost = cost;
+            best = to;
+          }
+        }
+      }
+      if (best >= 0)
+      {
+        Collapse c;
+        c.cost = best_cost;
+        c.from = v;
+        c.to = best;
+        c.stamp = stamps[v];
+        heap.push(c);
+      }
+    }
+
+    void run(int target_faces, float max_error)
+    {
+      while (alive_faces > target_faces && !heap.empty())
+      {
+        Collapse c = heap.top();
+        if (c.cost > (double)max_error * max_error)
+          break;
+        heap.pop();
+        if (removed[c.from] || removed[c.to] || c.stamp != stamps[c.from])
+          continue;
+        int to_uv, to_norm;
+        if (!valid_collapse(c.from, c.to, to_uv, to_norm))
+        {
+          // blocked for now, it's retried when a neighbour changes
+          continue;
+        }
+
+        removed[c.from] = true;
+        quadrics[c.to] += quadrics[c.from];
+        std::vector<int> &from_faces = vert_faces[c.from];
+        for (size_t i = 0; i < from_faces.size(); i++)
+        {
+          Face &face = faces[from_faces[i]];
+          if (!face.alive)
+            continue;
+          bool has_to = face.pos[0] == c.to || face.pos[1] == c.to || face.pos[2] == c.to;
+          if (has_to)
+          {
+            face.alive = false;
+            alive_faces--;
+            continue;
+          }
+          for (int j = 0; j < 3; j++)
+          {
+            if (face.pos[j] == c.from)
+            {
+              face.pos[j] = c.to;
+              face.uv[j] = to_uv;
+              face.norm[j] = to_norm;
+            }
+          }
+          vert_faces[c.to].push_back(from_faces[i]);
+        }
+        from_faces.clear();
+
+        // everything around `to` has a new quadric or new neighbours
+        std::vector<int> neighbours;
+        for (size_t i = 0; i < vert_faces[c.to].size(); i++)
+        {
+          const Face &face = faces[vert_faces[c.to][i]];
+          if (!face.alive)
+            continue;
+          for (int j = 0; j < 3; j++)
+            neighbours.push_back(face.pos[j]);
+        }
+        std::sort(neighbours.begin(), neighbours.end());
+        neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+        for (size_t i = 0; i < neighbours.size(); i++)
+          push_best_collapse(neighbours[i]);
+      }
+    }
+
+    Model *result(Model &model)
+    {
+      // compact, dropping everything the surviving faces don't reference
+      std::vector<int> pos_remap(verts.size(), -1);
+      std::vector<int> uv_remap, norm_remap;
+      std::vector<Vec3f> new_verts, new_norms;
+      std::vector<Vec2f> new_uvs;
+      std::vector<Triangle> tris;
+      for (size_t f = 0; f < faces.size(); f++)
+      {
+        const Face &face = faces[f];
+        if (!face.alive)
+          continue;
+        Triangle tri;
+        for (int j = 0; j < 3; j++)
+        {
+          int p = face.pos[j], t = face.uv[j], n = face.norm[j];
+          if (pos_remap[p] < 0)
+          {
+            pos_remap[p] = (int)new_verts.size();
+            new_verts.push_back(verts[p]);
+          }
+          if (t >= (int)uv_remap.size())
+            uv_remap.resize(t + 1, -1);
+          if (uv_remap[t] < 0)
+          {
+            uv_remap[t] = (int)new_uvs.size();
+            new_uvs.push_back(model.uv(t));
+          }
+          tri.pos_indices.push_back(pos_remap[p]);
+          tri.tex_indices.push_back(uv_remap[t]);
+          if (n >= 0)
+          {
+            if (n >= (int)norm_remap.size())
+              norm_remap.resize(n + 1, -1);
+            if (norm_remap[n] < 0)
+            {
+              norm_remap[n] = (int)new_norms.size();
+              new_norms.push_back(model.norm(n));
+            }
+            tri.norm_indices.push_back(norm_remap[n]);
+          }
+        }
+        tris.push_back(tri);
+      }
+      return new Model(new_verts, new_uvs, new_norms, tris);
+    }
+  };
+}
+
+Model *simplify(Model &model, int target_faces, float max_error)
+{
+  Simplifier simplifier(model);
+  simplifier.run(target_faces, max_error);
+  return simplifier.result(model);
+}
+
+LODChain::LODChain(Model &model, int min_faces, float ratio, float max_error) : levels_(), bvhs_(), center_(), radius_(0)
+{
+  Vec3f lo(FLT_MAX, FLT_MAX, FLT_MAX), hi(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+  for (int i = 0; i < model.nverts(); i++)
+  {
+    Vec3f v = model.vert(i);
+    for (int k = 0; k < 3; k++)
+    {
+      lo.raw[k] = std::min(lo.raw[k], v.raw[k]);
+      hi.raw[k] = std::max(hi.raw[k], v.raw[k]);
+    }
+  }
+  center_ = (lo + hi) * 0.5f;
+  radius_ = model.nverts() > 0 ? (hi - lo).norm() * 0.5f : 0.0f;
+
+  levels_.push_back(&model);
+  int target = (int)(model.nfaces() * ratio);
+  float level_error = max_error;
+  while (target >= min_faces)
+  {
+    // A level with `ratio` the faces is picked at about sqrt(ratio) the size on
+    // screen (see select()), so it can be off by that much more in model units for
+    // the same error in pixels
+    level_error /= std::sqrt(ratio);
+    // every level starts over from the original so the error bound holds against
+    // the real surface, not against the previous approximation
+    Model *lod = simplify(model, target, level_error * radius_);
+    if (lod->nfaces() > levels_.back()->nfaces() * 0.9f)
+    {
+      // stuck (error budget used up or everything left is locked)
+      delete lod;
+      break;
+    }
+    levels_.push_back(lod);
+    target = std::max(min_faces, (int)(lod->nfaces() * ratio));
+    if (lod->nfaces() <= min_faces)
+    {
+      break;
+    }
+  }
+}
+
+LODChain::~LODChain()
+{
+  for (size_t i = 1; i < levels_.size(); i++)
+  {
+    delete levels_[i];
+  }
+  for (size_t i = 0; i < bvhs_.size(); i++)
+  {
+    delete bvhs_[i];
+  }
+}
+
+void LODChain::build_bvhs(int threads)
+{
+  bvhs_.assign(levels_.size(), NULL);
+  for (size_t i = 1; i < levels_.size(); i++)
+  {
+    bvhs_[i] = new BVH(*levels_[i], threads);
+  }
+}
+
+size_t LODChain::memory_size()
+{
+  size_t size = sizeof(LODChain);
+  for (size_t i = 1; i < levels_.size(); i++)
+  {
+    size += levels_[i]->memory_size() + (bvh(i) ? bvh(i)->memory_size() : 0);
+  }
+  return size;
+}
+
+int LODChain::select(float projected_radius, float pixels_per_triangle)
+{
+  // about half of the faces face the camera, and those cover roughly the projected disc
+  float wanted = 2.0f * 3.14159265f * projected_radius * projected_radius / pixels_per_triangle;
+  int choice = 0;
+  for (int i = 1; i < (int)levels_.size(); i++)
+  {
+    if (levels_[i]->nfaces() >= wanted)
+    {
+      choice = i;
+    }
+  }
+  return choice;
+}
@@ -0,0 +1,51 @@
+#ifndef __SIMPLIFY_H__
+#define __SIMPLIFY_H__
+
+#include <vector>
+#include "bvh.h"
+#include "geometry.h"
+#include "model.h"
+
+// Quadric error metric simplification (Garland & Heckbert '97) using half-edge
+// collapses, so every surviving vertex keeps its original position, uv and normal.
+// Vertices on a uv seam (used with more than one uv) are never moved, so the
+// texture doesn't tear. Open borders are kept in place by extra boundary planes.
+// Returns a new mesh with at most target_faces faces, or as close as it can get
+// without moving the surface more than about max_error (RMS distance, in model units).
+Model *simplify(Model &model, int target_faces, float max_error = 1e30f);
+
+// A chain of progressively simplified versions of a model, finest first.
+// Level 0 is the model passed in (not owned), the other levels are owned by the chain.
+class LODChain
+{
+private:
+  std::vector<Model *> levels_;
+  std::vector<BVH *> bvhs_; // owned, none for level 0
+  Vec3f center_;
+  float radius_;
+
+public:
+  // Keeps halving the face count (by `ratio`) until a level would have fewer than
+  // min_faces, or simplifying further would move the surface more than max_error
+  // (relative to the bounding sphere radius). Each level gets 1/sqrt(ratio) times the
+  // error budget of the one before, since it's only used that much smaller on screen.
+  LODChain(Model &model, int min_faces = 64, float ratio = 0.5f, float max_error = 0.02f);
+  ~LODChain();
+  int nlevels() { return (int)levels_.size(); }
+  Model *level(int i) { return levels_[i]; }
+  // Builds a BVH over every level but the first (the caller has that model, and its
+  // BVH if it wants one)
+  void build_bvhs(int threads = 0);
+  // NULL for level 0 or before build_bvhs()
+  BVH *bvh(int i) { return i > 0 && i < (int)bvhs_.size() ? bvhs_[i] : NULL; }
+  size_t memory_size();
+  // bounding sphere of level 0, for estimating the screen size
+  Vec3f center() { return center_; }
+  float radius() { return radius_; }
+
+  // Picks the coarsest level that still has a triangle for every `pixels_per_triangle`
+  // pixels of the front-facing half of a bounding sphere `projected_radius` pixels wide on screen.
+  int select(float projected_radius, float pixels_per_triangle = 4.0f);
+};
+
+#endif //__SIMPLIFY_H__
@@ -0,0 +1,261 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+#include "arena.h"
+#include "sortlast.h"
+
+namespace
+{
+  // At the start of every worker's slot, then its color buffer and zbuffer
+  struct SlotHeader
+  {
+    double render_ms;
+    long long render_done; // steady_clock ticks, the same in every process
+    long long merged;
+  };
+
+  const size_t slot_align = 64;
+
+  size_t align_up(size_t n)
+  {
+    return (n + slot_align - 1) / slot_align * slot_align;
+  }
+
+  long long now()
+  {
+    return (long long)std::chrono::steady_clock::now().time_since_epoch().count();
+  }
+
+  double ticks_to_ms(long long ticks)
+  {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::duration(ticks)).count();
+  }
+
+  // Keeps the other frame's pixel wherever it's closer. Ties stay with this one, like
+  // they do for the face drawn first in one frame.
+  template <class Depth>
+  void merge(unsigned char *color, Depth *depth, const unsigned char *other_color, const Depth *other_depth,
+             int npixels, int bytespp)
+  {
+    for (int i = 0; i < npixels; i++)
+    {
+      if (other_depth[i] > depth[i])
+      {
+        depth[i] = other_depth[i];
+        memcpy(color + i * bytespp, other_color + i * bytespp, bytespp);
+      }
+    }
+  }
+
+  class SharedFrames
+  {
+    unsigned char *memory_;
+    size_t color_bytes_, depth_bytes_, slot_bytes_;
+    int nslots_;
+
+  public:
+    SharedFrames(int nslots, int npixels, int bytespp, DepthFormat format)
+        : memory_(NULL), color_bytes_(align_up((size_t)npixels * bytespp)),
+          depth_bytes_(align_up((size_t)npixels * depth_format_size(format))), nslots_(nslots)
+    {
+      slot_bytes_ = align_up(sizeof(SlotHeader)) + color_bytes_ + depth_bytes_;
+      // shared with every process forked after this
+      void *memory = mmap(NULL, size(), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+      if (memory != MAP_FAILED)
+      {
+        memory_ = (unsigned char *)memory;
+      }
+    }
+    ~SharedFrames()
+    {
+      if (memory_)
+      {
+        munmap(memory_, size());
+      }
+    }
+
+    bool ok() { return memory_ != NULL; }
+    size_t size() { return slot_bytes_ * nslots_; }
+    SlotHeader *header(int slot) { return (SlotHeader *)(memory_ + slot * slot_bytes_); }
+    unsigned char *color(int slot) { return memory_ + slot * slot_bytes_ + align_up(sizeof(SlotHeader)); }
+    void *depth(int slot) { return color(slot) + color_bytes_; }
+  };
+
+  void merge(SharedFrames &frames, int slot, int other, int npixels, int bytespp, DepthFormat format)
+  {
+    switch (format)
+    {
+    case DEPTH_UNORM24:
+      merge(frames.color(slot), (uint32_t *)frames.depth(slot), frames.color(other), (const uint32_t *)frames.depth(other), npixels, bytespp);
+      break;
+    case DEPTH_UNORM16:
+      merge(frames.color(slot), (uint16_t *)frames.depth(slot), frames.color(other), (const uint16_t *)frames.depth(other), npixels, bytespp);
+      break;
+    default:
+      merge(frames.color(slot), (float *)frames.depth(slot), frames.color(other), (const float *)frames.depth(other), npixels, bytespp);
+      break;
+    }
+  }
+
+  // false if the worker failed or died before saying anything
+  bool wait_for(int fd)
+  {
+    char status = 0;
+    ssize_t n;
+    do
+    {
+      n = read(fd, &status, 1);
+    } while (n < 0 && errno == EINTR);
+    return n == 1 && status == 1;
+  }
+
+  // What worker `slot` does in its own process: render its faces into its slot, then
+  // merge in the slots of the workers under it in the tree
+  bool run_worker(int slot, int nslots, const std::vector<int> &faces, const int *pipes, SharedFrames &frames,
+                  Model *model, BVH *bvh, TGAImage *texture, const RenderSettings &settings, int width, int height, int bytespp)
+  {
+    long long start = now();
+    int npixels = width * height;
+    size_t begin = faces.size() * slot / nslots, end = faces.size() * (slot + 1) / nslots;
+    {
+      TGAImage image(width, height, bytespp);
+      Arena arena, scratch;
+      Frame frame(model, bvh, texture, settings, image, arena);
+      frame.set_faces(faces.data() + begin, (int)(end - begin));
+      frame.shadow_pass(0, height);
+      frame.render(0, height, scratch);
+      memcpy(frames.color(slot), image.buffer(), (size_t)npixels * bytespp);
+      memcpy(frames.depth(slot), frame.zbuffer, (size_t)npixels * depth_format_size(settings.depth_format));
+    }
+    SlotHeader *header = frames.header(slot);
+    header->render_done = now();
+    header->render_ms = ticks_to_ms(header->render_done - start);
+
+    bool ok = true;
+    for (int step = 1; step < nslots && slot % (2 * step) == 0; step *= 2)
+    {
+      int other = slot + step;
+      if (other < nslots)
+      {
+        // keeps going if it failed, so whoever waits on this one doesn't hang
+        ok = wait_for(pipes[2 * other]) && ok;
+        if (ok)
+        {
+          merge(frames, slot, other, npixels, bytespp, settings.depth_format);
+        }
+      }
+    }
+    header->merged = now();
+    return ok;
+  }
+}
+
+bool sort_last_render(Model *model, BVH *bvh, TGAImage *texture, const RenderSettings &settings, TGAImage &image,
+                      int processes, SortLastStats &stats)
+{
+  int width = image.get_width(), height = image.get_height(), bytespp = image.get_bytespp();
+  processes = std::max(1, processes);
+  stats.processes = processes;
+
+  // every face on screen, in the order one frame would draw them
+  std::vector<int> faces(model->nfaces());
+  if (bvh)
+  {
+    Frustum frustum = Frustum::from_screen_rect(camera_transform(width, height, settings.zoom).m, 0, 0, width, height);
+    faces.resize(bvh->cull(frustum, faces.data()));
+  }
+  else
+  {
+    for (int i = 0; i < model->nfaces(); i++)
+    {
+      faces[i] = i;
+    }
+  }
+
+  SharedFrames frames(processes, width * height, bytespp, settings.depth_format);
+  if (!frames.ok())
+  {
+    std::cerr << "can't map " << frames.size() << " bytes of shared memory" << std::endl;
+    return false;
+  }
+  stats.shared_bytes = frames.size();
+
+  // worker i's pipe is pipes[2 * i] (read end) and pipes[2 * i + 1]
+  std::vector<int> pipes(2 * processes);
+  for (int i = 0; i < processes; i++)
+  {
+    if (pipe(&pipes[2 * i]) != 0)
+    {
+      std::cerr << "can't make a pipe: " << strerror(errno) << std::endl;
+      for (int j = 0; j < 2 * i; j++)
+      {
+        close(pipes[j]);
+      }
+      return false;
+    }
+  }
+  std::vector<pid_t> workers;
+  for (int i = 0; i < processes; i++)
+  {
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+      // only this worker writes to its pipe
+      for (int j = 0; j < processes; j++)
+      {
+        if (j != i)
+        {
+          close(pipes[2 * j + 1]);
+        }
+      }
+      char status = run_worker(i, processes, faces, pipes.data(), frames, model, bvh, texture, settings, width, height, bytespp);
+      ssize_t written = write(pipes[2 * i + 1], &status, 1);
+      // not exit(), the parent's buffers and destructors aren't this process's to run
+      _exit(written == 1 ? 0 : 1);
+    }
+    if (pid < 0)
+    {
+      // whoever waits on this worker finds its pipe closed and fails
+      std::cerr << "can't start worker " << i << ": " << strerror(errno) << std::endl;
+      break;
+    }
+    workers.push_back(pid);
+  }
+  for (int i = 0; i < processes; i++)
+  {
+    close(pipes[2 * i + 1]);
+  }
+  bool ok = (int)workers.size() == processes && wait_for(pipes[0]);
+  for (size_t i = 0; i < workers.size(); i++)
+  {
+    int status;
+    while (waitpid(workers[i], &status, 0) < 0 && errno == EINTR)
+    {
+    }
+  }
+  for (int i = 0; i < processes; i++)
+  {
+    close(pipes[2 * i]);
+  }
+  if (!ok)
+  {
+    std::cerr << "a sort-last worker failed" << std::endl;
+    return false;
+  }
+
+  memcpy(image.buffer(), frames.color(0), (size_t)width * height * bytespp);
+  long long last_render = 0;
+  for (int i = 0; i < processes; i++)
+  {
+    stats.render_ms = std::max(stats.render_ms, frames.header(i)->render_ms);
+    last_render = std::max(last_render, frames.header(i)->render_done);
+  }
+  stats.composite_ms = ticks_to_ms(frames.header(0)->merged - last_render);
+  return true;
+}
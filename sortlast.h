@@ -0,0 +1,45 @@
+#ifndef __SORTLAST_H__
+#define __SORTLAST_H__
+
+#include "bvh.h"
+#include "model.h"
+#include "render.h"
+#include "tgaimage.h"
+
+/*
+
+Sort-last rendering: the model's faces are split between worker processes (stand-ins
+for the nodes of a cluster), each of which renders a whole frame of just its own faces,
+and the frames are merged pixel by pixel, keeping whichever is closest.
+
+Every worker gets one slot of a shared memory mapping for its color buffer and zbuffer.
+The frames are merged in a tree: in round r, worker i (a multiple of 2^(r+1)) waits for
+worker i + 2^r and depth tests its frame into its own, so after log2(n) rounds worker 0
+has the whole image, and the merges of a round run at the same time. A worker says it's
+done by writing to its own pipe, and since nobody else holds that pipe open, a worker
+that dies shows up as the end of the pipe instead of a hang.
+
+The faces are dealt out in the order one process would draw them (the BVH's order if
+there is one), a contiguous run per worker, and ties are won by the lower worker, so the
+result is the same as rendering the whole model in one frame.
+
+Every worker renders the whole shadow map, since any face can shadow any other.
+
+*/
+
+struct SortLastStats
+{
+  int processes;
+  double render_ms;    // the slowest worker's frame
+  double composite_ms; // from the slowest frame being done to the image being merged
+  size_t shared_bytes; // all the workers' slots
+
+  SortLastStats() : processes(0), render_ms(0), composite_ms(0), shared_bytes(0) {}
+};
+
+// Renders `model` into `image` on `processes` worker processes. Returns false if the
+// shared memory or a worker can't be set up, or a worker fails.
+bool sort_last_render(Model *model, BVH *bvh, TGAImage *texture, const RenderSettings &settings, TGAImage &image,
+                      int processes, SortLastStats &stats);
+
+#endif //__SORTLAST_H__
@@ -0,0 +1,110 @@
+#include "stats.h"
+
+#ifdef RENDER_STATS
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+FrameStats frame_stats;
+
+static const char *stage_names[NSTAGES] = {"load", "texture", "transform", "cull", "raster", "shade", "encode"};
+
+FrameStats::FrameStats() : overdraw(NULL), width(0), height(0)
+{
+  reset();
+  // the quickest of a few tries is the clock itself, anything slower was interrupted
+  clock_ns = 1000000;
+  for (int i = 0; i < 1000; i++)
+  {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    clock_ns = std::min(clock_ns, ns);
+  }
+}
+
+void FrameStats::reset()
+{
+  for (int i = 0; i < NSTAGES; i++)
+  {
+    stage_ns[i] = 0;
+  }
+  tris_submitted = 0;
+  tris_culled = 0;
+  tris_rasterized = 0;
+  pixels_tested = 0;
+  depth_passed = 0;
+  depth_failed = 0;
+  pixels_covered = 0;
+  if (overdraw)
+  {
+    std::fill(overdraw, overdraw + width * height, 0);
+  }
+}
+
+float FrameStats::overdraw_ratio()
+{
+  return pixels_covered > 0 ? depth_passed / (float)pixels_covered : 0.0f;
+}
+
+bool FrameStats::write_json(const char *filename)
+{
+  std::ofstream out(filename);
+  if (!out.is_open())
+  {
+    std::cerr << "can't open file " << filename << "\n";
+    return false;
+  }
+  // summed over the threads, see stats.h
+  out << "{\n  \"stage_cpu_ms\": {";
+  for (int i = 0; i < NSTAGES; i++)
+  {
+    out << (i ? ", " : "") << "\"" << stage_names[i] << "\": " << stage_ns[i] / 1e6;
+  }
+  out << "},\n";
+  out << "  \"tris_submitted\": " << tris_submitted << ",\n";
+  out << "  \"tris_culled\": " << tris_culled << ",\n";
+  out << "  \"tris_rasterized\": " << tris_rasterized << ",\n";
+  out << "  \"pixels_tested\": " << pixels_tested << ",\n";
+  out << "  \"depth_passed\": " << depth_passed << ",\n";
+  out << "  \"depth_failed\": " << depth_failed << ",\n";
+  out << "  \"pixels_covered\": " << pixels_covered << ",\n";
+  out << "  \"overdraw\": " << overdraw_ratio() << "\n";
+  out << "}\n";
+  return out.good();
+}
+
+bool FrameStats::write_overdraw(const char *filename)
+{
+  if (!overdraw)
+  {
+    return false;
+  }
+  const TGAColor ramp[5] = {
+      TGAColor(0, 0, 0, 255),
+      TGAColor(0, 0, 255, 255),
+      TGAColor(0, 255, 0, 255),
+      TGAColor(255, 255, 0, 255),
+      TGAColor(255, 0, 0, 255),
+  };
+  TGAImage image(width, height, TGAImage::RGB);
+  for (int y = 0; y < height; y++)
+  {
+    for (int x = 0; x < width; x++)
+    {
+      // 0, 1, 2-3, 4-7, 8+ writes
+      int n = overdraw[x + y * width];
+      int bucket = 0;
+      while (n > 0 && bucket < 4)
+      {
+        n >>= 1;
+        bucket++;
+      }
+      image.set(x, y, ramp[bucket]);
+    }
+  }
+  image.flip_vertically();
+  return image.write_tga_file(filename);
+}
+
+#endif
@@ -0,0 +1,145 @@
+#ifndef __STATS_H__
+#define __STATS_H__
+
+// Per-frame timings and rasterizer counters. Only compiled in with RENDER_STATS
+// defined (`make STATS=1`, after a `make clean`); otherwise every hook below is an
+// empty inline function or macro, and the rasterizer loops are exactly what they'd
+// be without it.
+//
+// The stage times are CPU time: every thread adds what it spent to the same stage, so
+// with several threads they add up to more than the frame took.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include "tgaimage.h"
+
+enum Stage
+{
+  STAGE_LOAD,
+  STAGE_TEXTURE, // loaded alongside the model (on another thread), so apart from STAGE_LOAD
+  STAGE_TRANSFORM,
+  STAGE_CULL,
+  STAGE_RASTER,
+  STAGE_SHADE,
+  STAGE_ENCODE,
+  NSTAGES
+};
+
+#ifdef RENDER_STATS
+
+struct FrameStats
+{
+  std::atomic<long long> stage_ns[NSTAGES];
+
+  // counters are added once per triangle (not per pixel), so they can be atomic
+  std::atomic<long> tris_submitted; // faces handed to the pipeline
+  std::atomic<long> tris_culled;    // frustum, backface, degenerate or off screen
+  std::atomic<long> tris_rasterized;
+  std::atomic<long> pixels_tested; // inside a triangle, reached the depth test
+  std::atomic<long> depth_passed;
+  std::atomic<long> depth_failed;
+  long pixels_covered; // distinct pixels with something in them, set at the end of the frame
+
+  // optional, one counter per pixel of the frame for the overdraw heatmap
+  unsigned short *overdraw;
+  int width, height;
+  // what reading the clock twice costs, taken off a timed fragment (see PixelCounters)
+  long long clock_ns;
+
+  FrameStats();
+  void reset();
+  // depth_passed / pixels_covered
+  float overdraw_ratio();
+  // one JSON object
+  bool write_json(const char *filename);
+  // black (never written) through blue, green, yellow to red (8+ writes)
+  bool write_overdraw(const char *filename);
+};
+
+extern FrameStats frame_stats;
+
+// Adds the lifetime of the object to a stage
+class StageTimer
+{
+  Stage stage_;
+  std::chrono::steady_clock::time_point start_;
+
+public:
+  StageTimer(Stage stage) : stage_(stage), start_(std::chrono::steady_clock::now()) {}
+  ~StageTimer()
+  {
+    frame_stats.stage_ns[stage_] += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_).count();
+  }
+};
+
+// Per-triangle pixel counters, kept in registers and flushed once at the end.
+//
+// The rasterizer calls the shader's fragment() through here. Reading the clock around
+// every one would cost more than most fragments, so only every shade_sample'th one
+// (on each thread) is timed, less the clock's own cost, and counted for the ones in
+// between. That much is moved from STAGE_RASTER, which the whole loop is timed as, to
+// STAGE_SHADE.
+struct PixelCounters
+{
+  static const unsigned shade_sample = 64;
+  long tested, passed, failed;
+  long long shade_ns;
+  PixelCounters() : tested(0), passed(0), failed(0), shade_ns(0) {}
+  inline void test() { tested++; }
+  template <class Shader>
+  inline bool fragment(Shader &shader, const float *varying, TGAColor &color)
+  {
+    static thread_local unsigned calls = 0;
+    if (++calls % shade_sample)
+      return shader.fragment(varying, color);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    bool kept = shader.fragment(varying, color);
+    long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count() - frame_stats.clock_ns;
+    shade_ns += std::max(0LL, ns) * shade_sample;
+    return kept;
+  }
+  inline void pass(int idx)
+  {
+    passed++;
+    if (frame_stats.overdraw)
+      frame_stats.overdraw[idx]++;
+  }
+  inline void fail() { failed++; }
+  inline void flush()
+  {
+    frame_stats.tris_rasterized++;
+    frame_stats.pixels_tested += tested;
+    frame_stats.depth_passed += passed;
+    frame_stats.depth_failed += failed;
+    frame_stats.stage_ns[STAGE_SHADE] += shade_ns;
+    frame_stats.stage_ns[STAGE_RASTER] -= shade_ns;
+  }
+};
+
+#define STATS_CONCAT2(a, b) a##b
+#define STATS_CONCAT(a, b) STATS_CONCAT2(a, b)
+#define STATS_SCOPE(stage) StageTimer STATS_CONCAT(stage_timer_, __LINE__)(stage)
+#define STATS_ADD(counter, n) (frame_stats.counter += (n))
+
+#else
+
+struct PixelCounters
+{
+  inline void test() {}
+  template <class Shader>
+  inline bool fragment(Shader &shader, const float *varying, TGAColor &color)
+  {
+    return shader.fragment(varying, color);
+  }
+  inline void pass(int) {}
+  inline void fail() {}
+  inline void flush() {}
+};
+
+#define STATS_SCOPE(stage) ((void)0)
+#define STATS_ADD(counter, n) ((void)0)
+
+#endif
+
+#endif //__STATS_H__
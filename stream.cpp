@@ -0,0 +1,239 @@
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include "stats.h"
+#include "stream.h"
+
+namespace
+{
+  // Index of `index` in the chunk's own list, adding it the first time it's used
+  template <class T>
+  int remap(int index, const SpillArray<T> &all, std::vector<T> &local, std::unordered_map<int, int> &ids)
+  {
+    std::unordered_map<int, int>::iterator it = ids.find(index);
+    if (it != ids.end())
+    {
+      return it->second;
+    }
+    int id = (int)local.size();
+    local.push_back(all[index]);
+    ids[index] = id;
+    return id;
+  }
+
+  template <class T>
+  bool in_range(const std::vector<int> &indices, const SpillArray<T> &all)
+  {
+    for (size_t i = 0; i < indices.size(); i++)
+    {
+      if (indices[i] < 0 || indices[i] >= (int)all.size())
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Chunks handed from the reader thread to the rasterizer. push() waits while
+  // there's already one waiting, so the reader is never more than a chunk ahead.
+  class ChunkQueue
+  {
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<Model *> chunks_;
+    bool closed_;
+
+  public:
+    ChunkQueue() : closed_(false) {}
+    ~ChunkQueue()
+    {
+      for (size_t i = 0; i < chunks_.size(); i++)
+      {
+        delete chunks_[i];
+      }
+    }
+
+    void push(Model *chunk)
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this]() { return chunks_.empty(); });
+      chunks_.push_back(chunk);
+      cv_.notify_all();
+    }
+
+    // no more chunks after this
+    void close()
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      closed_ = true;
+      cv_.notify_all();
+    }
+
+    // NULL once the queue is closed and empty
+    Model *pop()
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this]() { return !chunks_.empty() || closed_; });
+      if (chunks_.empty())
+      {
+        return NULL;
+      }
+      Model *chunk = chunks_.front();
+      chunks_.pop_front();
+      cv_.notify_all();
+      return chunk;
+    }
+  };
+
+  // One pass over the file: parses it on another thread and calls draw(chunk) for
+  // every chunk on this one, parsing the next chunk in the meantime
+  template <class Draw>
+  bool for_each_chunk(const char *filename, int chunk_faces, StreamStats &stats, Draw draw)
+  {
+    ObjStream stream(filename);
+    if (!stream.is_open())
+    {
+      std::cerr << "Failed to open file " << filename << " (or a temporary file for its vertex attributes)" << std::endl;
+      return false;
+    }
+    ChunkQueue queue;
+    std::thread reader([&]()
+                       {
+                         while (true)
+                         {
+                           Model *chunk;
+                           {
+                             STATS_SCOPE(STAGE_LOAD);
+                             chunk = stream.next_chunk(chunk_faces);
+                           }
+                           if (!chunk)
+                             break;
+                           queue.push(chunk);
+                         }
+                         queue.close(); });
+    stats.chunks = 0;
+    stats.faces = 0;
+    while (Model *chunk = queue.pop())
+    {
+      std::unique_ptr<Model> owner(chunk);
+      stats.chunks++;
+      stats.faces += chunk->nfaces();
+      stats.peak_chunk_bytes = std::max(stats.peak_chunk_bytes, chunk->memory_size());
+      draw(chunk);
+    }
+    reader.join();
+    stats.attribute_bytes = stream.attribute_bytes();
+    stats.passes++;
+    return true;
+  }
+}
+
+ObjStream::ObjStream(const char *filename) : in_(filename)
+{
+}
+
+Model *ObjStream::next_chunk(int max_faces)
+{
+  std::vector<Vec3f> verts, norms;
+  std::vector<Vec2f> uvs;
+  std::vector<Triangle> tris;
+  std::unordered_map<int, int> vert_ids, uv_ids, norm_ids;
+  std::string line;
+  Vec3f v;
+  Vec2f uv;
+  Triangle tri;
+  bool spilled = true;
+  while (spilled && (int)tris.size() < max_faces && std::getline(in_, line))
+  {
+    switch (parse_obj_line(line, v, uv, tri))
+    {
+    case OBJ_VERTEX:
+      spilled = verts_.push_back(v);
+      break;
+    case OBJ_UV:
+      spilled = uvs_.push_back(uv);
+      break;
+    case OBJ_NORMAL:
+      spilled = norms_.push_back(v);
+      break;
+    case OBJ_FACE:
+      // a face without normals has no normal indices at all
+      if (tri.pos_indices.size() >= 3 && in_range(tri.pos_indices, verts_) && in_range(tri.tex_indices, uvs_) &&
+          in_range(tri.norm_indices, norms_))
+      {
+        for (size_t i = 0; i < tri.pos_indices.size(); i++)
+        {
+          tri.pos_indices[i] = remap(tri.pos_indices[i], verts_, verts, vert_ids);
+          tri.tex_indices[i] = remap(tri.tex_indices[i], uvs_, uvs, uv_ids);
+        }
+        for (size_t i = 0; i < tri.norm_indices.size(); i++)
+        {
+          tri.norm_indices[i] = remap(tri.norm_indices[i], norms_, norms, norm_ids);
+        }
+        tris.push_back(tri);
+      }
+      break;
+    default:
+      break;
+    }
+  }
+  if (!spilled)
+  {
+    std::cerr << "No room left for the vertex attributes, the rest of the file is skipped" << std::endl;
+    in_.setstate(std::ios::eofbit);
+  }
+  if (tris.empty())
+  {
+    return NULL;
+  }
+  return new Model(verts, uvs, norms, tris);
+}
+
+size_t ObjStream::attribute_bytes()
+{
+  return verts_.bytes() + uvs_.bytes() + norms_.bytes();
+}
+
+bool stream_render(const char *filename, TGAImage *texture, const RenderSettings &settings, TGAImage &image,
+                   int chunk_faces, StreamStats &stats)
+{
+  // the frame starts out with nothing in it, every chunk is swapped in when it's drawn
+  std::vector<Vec3f> no_verts;
+  std::vector<Vec2f> no_uvs;
+  std::vector<Triangle> no_tris;
+  Model empty(no_verts, no_uvs, no_verts, no_tris);
+  Arena arena, scratch;
+  Frame frame(&empty, NULL, texture, settings, image, arena);
+  int height = image.get_height();
+  bool ok = true;
+  if (settings.z_prepass || frame.has_shadows())
+  {
+    ok = for_each_chunk(filename, chunk_faces, stats, [&](Model *chunk)
+                        {
+                          frame.set_model(chunk, NULL);
+                          frame.shadow_pass(0, height);
+                          if (settings.z_prepass)
+                            frame.depth_pass(0, height, scratch);
+                          scratch.reset(); });
+  }
+  if (ok)
+  {
+    ok = for_each_chunk(filename, chunk_faces, stats, [&](Model *chunk)
+                        {
+                          frame.set_model(chunk, NULL);
+                          frame.color_pass(0, height, scratch);
+                          scratch.reset(); });
+  }
+  if (ok)
+  {
+    frame.resolve(0, height);
+  }
+  frame.set_model(&empty, NULL);
+  return ok;
+}
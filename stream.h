@@ -0,0 +1,147 @@
+#ifndef __STREAM_H__
+#define __STREAM_H__
+
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+#include "geometry.h"
+#include "model.h"
+#include "render.h"
+#include "tgaimage.h"
+
+/*
+
+Out-of-core rendering, for OBJ files too big to load as one Model.
+
+The file is read a chunk of faces at a time. Each chunk becomes a small Model of its
+own (only the positions, uvs and normals its faces use, renumbered) that's drawn into
+the frame like any other model and then thrown away, so the image and zbuffer carry
+over from one chunk to the next. A reader thread parses the next chunk while the
+current one is rasterized, and only one parsed chunk waits for the rasterizer, so at
+most three chunks are in memory at once however many faces the file has.
+
+The vertex attributes are needed for the whole file, since a face can use any vertex
+that came before it. They go into a temporary file that's mapped in (a SpillArray)
+instead of onto the heap, so the kernel can write them out and drop them when memory
+is short, and only the pages the current chunk reads have to stay in. With attributes
+all over a huge file that can still mean a lot of disk reads, but the memory it takes
+doesn't grow with the file.
+
+The z-prepass and the shadow map need every face before the first color pass, so with
+either of those the file is read twice.
+
+*/
+
+// An array that only grows, kept in a temporary file (deleted as soon as it's made)
+// that's mapped in, so its pages are the page cache's rather than the heap's. ok() is
+// false if the file couldn't be made; push_back() is false once the disk is full.
+template <class T>
+class SpillArray
+{
+  int fd_;
+  T *data_;
+  size_t size_, capacity_;
+
+  SpillArray(const SpillArray &);
+  SpillArray &operator=(const SpillArray &);
+
+  bool grow()
+  {
+    size_t capacity = capacity_ ? capacity_ * 2 : 65536 / sizeof(T);
+    if (ftruncate(fd_, (off_t)(capacity * sizeof(T))) != 0)
+    {
+      return false;
+    }
+    void *data = mmap(NULL, capacity * sizeof(T), PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (data == MAP_FAILED)
+    {
+      return false;
+    }
+    if (data_)
+    {
+      munmap(data_, capacity_ * sizeof(T));
+    }
+    data_ = (T *)data;
+    capacity_ = capacity;
+    return true;
+  }
+
+public:
+  SpillArray() : fd_(-1), data_(NULL), size_(0), capacity_(0)
+  {
+    const char *dir = getenv("TMPDIR");
+    std::string path = std::string(dir && *dir ? dir : "/tmp") + "/tinyrenderer-XXXXXX";
+    fd_ = mkstemp(&path[0]);
+    if (fd_ >= 0)
+    {
+      unlink(path.c_str());
+    }
+  }
+  ~SpillArray()
+  {
+    if (data_)
+    {
+      munmap(data_, capacity_ * sizeof(T));
+    }
+    if (fd_ >= 0)
+    {
+      close(fd_);
+    }
+  }
+
+  bool ok() { return fd_ >= 0; }
+  size_t size() const { return size_; }
+  const T &operator[](size_t i) const { return data_[i]; }
+  // the file's size, not memory
+  size_t bytes() { return capacity_ * sizeof(T); }
+
+  bool push_back(const T &value)
+  {
+    if (size_ == capacity_ && !grow())
+    {
+      return false;
+    }
+    data_[size_++] = value;
+    return true;
+  }
+};
+
+// Reads an OBJ file a chunk of faces at a time
+class ObjStream
+{
+  std::ifstream in_;
+  SpillArray<Vec3f> verts_;
+  SpillArray<Vec2f> uvs_;
+  SpillArray<Vec3f> norms_;
+
+public:
+  ObjStream(const char *filename);
+  bool is_open() { return in_.is_open() && verts_.ok() && uvs_.ok() && norms_.ok(); }
+  // The next max_faces faces (fewer at the end of the file) as a Model, NULL once
+  // there aren't any left. Faces that use a vertex the file hasn't had yet are skipped.
+  // Stops early, with an error, if there's no room left for the attributes.
+  Model *next_chunk(int max_faces);
+  // what's kept for the whole file, on disk
+  size_t attribute_bytes();
+};
+
+struct StreamStats
+{
+  int chunks;              // in each pass over the file
+  long faces;              // same
+  int passes;              // 2 with a z-prepass or shadows
+  size_t peak_chunk_bytes; // the biggest chunk's Model::memory_size()
+  size_t attribute_bytes;  // ObjStream::attribute_bytes() at the end of the file, on disk
+
+  StreamStats() : chunks(0), faces(0), passes(0), peak_chunk_bytes(0), attribute_bytes(0) {}
+};
+
+// Renders `filename` into `image` chunk_faces faces at a time. Returns false if the
+// file can't be read.
+bool stream_render(const char *filename, TGAImage *texture, const RenderSettings &settings, TGAImage &image,
+                   int chunk_faces, StreamStats &stats);
+
+#endif //__STREAM_H__
@@ -0,0 +1,108 @@
+#include <algorithm>
+#include <cmath>
+#include "arena.h"
+#include "strips.h"
+
+void bin_faces(Model &model, const Mat4 &transform, int width, int height, int strip_height, StripBins &bins)
+{
+  int nstrips = (height + strip_height - 1) / strip_height;
+  // screen position of every vertex, once
+  std::vector<Vec3f> screen(model.nverts());
+  std::vector<bool> behind(model.nverts());
+  for (int i = 0; i < model.nverts(); i++)
+  {
+    Vec3f v = model.vert(i);
+    const float(*m)[4] = transform.m;
+    behind[i] = m[3][0] * v.x + m[3][1] * v.y + m[3][2] * v.z + m[3][3] <= 0;
+    screen[i] = transform.project(v);
+  }
+  // first and last strip of every face, -1 if it's off screen
+  std::vector<int> first(model.nfaces()), last(model.nfaces());
+  bins.offsets.assign(nstrips + 1, 0);
+  for (int f = 0; f < model.nfaces(); f++)
+  {
+    FaceIndices idx = model.tri_indices(f);
+    float xmin = screen[idx[0]].x, xmax = xmin, ymin = screen[idx[0]].y, ymax = ymin;
+    bool any_behind = false;
+    for (size_t j = 0; j < idx.size(); j++)
+    {
+      const Vec3f &p = screen[idx[j]];
+      xmin = std::min(xmin, p.x);
+      xmax = std::max(xmax, p.x);
+      ymin = std::min(ymin, p.y);
+      ymax = std::max(ymax, p.y);
+      any_behind = any_behind || behind[idx[j]];
+    }
+    first[f] = last[f] = -1;
+    if (any_behind)
+    {
+      // its projection is meaningless, so it goes everywhere and the rasterizer decides
+      first[f] = 0;
+      last[f] = nstrips - 1;
+    }
+    else if (xmax >= 0 && xmin < width && ymax >= 0 && ymin < height)
+    {
+      first[f] = std::max(0, (int)std::floor(ymin)) / strip_height;
+      last[f] = std::min(height - 1, (int)std::ceil(ymax)) / strip_height;
+    }
+    for (int s = first[f]; s >= 0 && s <= last[f]; s++)
+    {
+      bins.offsets[s + 1]++;
+    }
+  }
+  for (int s = 0; s < nstrips; s++)
+  {
+    bins.offsets[s + 1] += bins.offsets[s];
+  }
+  bins.faces.resize(bins.offsets[nstrips]);
+  std::vector<int> next(bins.offsets.begin(), bins.offsets.end() - 1);
+  for (int f = 0; f < model.nfaces(); f++)
+  {
+    for (int s = first[f]; s >= 0 && s <= last[f]; s++)
+    {
+      bins.faces[next[s]++] = f;
+    }
+  }
+}
+
+bool strip_render(Model *model, TGAImage *texture, const RenderSettings &settings, int width, int height,
+                  int strip_height, const char *filename, StripStats &stats)
+{
+  strip_height = std::max(1, std::min(strip_height, height));
+  RenderSettings strip_settings = settings;
+  strip_settings.shadows = false;
+  StripBins bins;
+  bin_faces(*model, camera_transform(width, height, settings.zoom), width, height, strip_height, bins);
+  int nstrips = (int)bins.offsets.size() - 1;
+  stats.strips = nstrips;
+  stats.binned = (long)bins.faces.size();
+  stats.bin_bytes = (bins.offsets.size() + bins.faces.size()) * sizeof(int);
+  stats.strip_bytes = (size_t)width * strip_height * (TGAImage::RGB + depth_format_size(settings.depth_format));
+
+  TGAWriter writer;
+  if (!writer.open(filename, width, height, TGAImage::RGB))
+  {
+    return false;
+  }
+  Arena arena, scratch;
+  // the file starts with the top row, and the rasterizer's y goes up
+  for (int s = nstrips - 1; s >= 0; s--)
+  {
+    int y0 = s * strip_height, rows = std::min(height, y0 + strip_height) - y0;
+    TGAImage strip(width, rows, TGAImage::RGB);
+    {
+      Frame frame(model, NULL, texture, strip_settings, strip, arena);
+      frame.set_strip(height, y0);
+      frame.set_faces(bins.faces.data() + bins.offsets[s], bins.offsets[s + 1] - bins.offsets[s]);
+      frame.render(0, rows, scratch);
+    }
+    arena.reset();
+    scratch.reset();
+    strip.flip_vertically();
+    if (!writer.write_rows(strip))
+    {
+      return false;
+    }
+  }
+  return writer.close();
+}
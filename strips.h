@@ -0,0 +1,53 @@
+#ifndef __STRIPS_H__
+#define __STRIPS_H__
+
+#include <vector>
+#include "model.h"
+#include "rasterizer.h"
+#include "render.h"
+#include "tgaimage.h"
+
+/*
+
+Strip rendering, for images too big to keep whole (a 32k x 32k poster is 3 GB of
+color and 4 GB of zbuffer).
+
+The image is rendered strip_height rows at a time, top strip first, with a color
+buffer and zbuffer only as big as one strip. Every face is binned up front by the
+strips its screen bounds overlap, so a strip only looks at its own faces. Each
+finished strip goes straight to a TGAWriter, which RLE encodes it into the file in
+order, so memory goes with the width times the strip height (plus the bins, an int or
+so a face), never the whole image.
+
+No shadows: the shadow map is as big as the image it's for.
+
+*/
+
+// Faces of each strip: strip s (rows [s * strip_height, (s + 1) * strip_height),
+// counted from the bottom like the rasterizer does) has faces[offsets[s]] up to
+// faces[offsets[s + 1]]
+struct StripBins
+{
+  std::vector<int> offsets;
+  std::vector<int> faces;
+};
+
+// Bins every face that lands on the width x height screen after `transform`
+void bin_faces(Model &model, const Mat4 &transform, int width, int height, int strip_height, StripBins &bins);
+
+struct StripStats
+{
+  int strips;
+  long binned;         // faces in all the bins, a face counts once per strip it's in
+  size_t strip_bytes;  // color buffer and zbuffer of one strip
+  size_t bin_bytes;
+
+  StripStats() : strips(0), binned(0), strip_bytes(0), bin_bytes(0) {}
+};
+
+// Renders a width x height image of `model` into the tga file `filename`. Returns
+// false if the file can't be written.
+bool strip_render(Model *model, TGAImage *texture, const RenderSettings &settings, int width, int height,
+                  int strip_height, const char *filename, StripStats &stats);
+
+#endif //__STRIPS_H__
@@ -0,0 +1,273 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include "assets.h"
+#include "texture.h"
+
+namespace
+{
+  const char bc1_magic[4] = {'B', 'C', '1', 'T'};
+  const uint32_t bc1_version = 1;
+
+  std::atomic<unsigned> next_texture_id(1);
+
+  // The last blocks this thread decoded. Slots are picked by the block's position
+  // modulo 8 in both directions, so a block's neighbors never push it out.
+  struct CachedBlock
+  {
+    unsigned texture; // 0 for an empty slot
+    int block;
+    unsigned char texels[16][3];
+  };
+  const int block_cache_size = 64;
+  thread_local CachedBlock block_cache[block_cache_size];
+
+  // texels are in TGAImage's order (b, g, r)
+  inline uint16_t pack565(const float c[3])
+  {
+    int r = std::min(255, std::max(0, (int)(c[2] + 0.5f)));
+    int g = std::min(255, std::max(0, (int)(c[1] + 0.5f)));
+    int b = std::min(255, std::max(0, (int)(c[0] + 0.5f)));
+    return (uint16_t)(((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3));
+  }
+
+  inline void unpack565(uint16_t c, int out[3])
+  {
+    int r = c >> 11, g = (c >> 5) & 63, b = c & 31;
+    out[2] = (r << 3) | (r >> 2);
+    out[1] = (g << 2) | (g >> 4);
+    out[0] = (b << 3) | (b >> 2);
+  }
+
+  void palette(const BC1Block &block, int colors[4][3])
+  {
+    unpack565(block.c0, colors[0]);
+    unpack565(block.c1, colors[1]);
+    for (int k = 0; k < 3; k++)
+    {
+      if (block.c0 > block.c1)
+      {
+        colors[2][k] = (2 * colors[0][k] + colors[1][k]) / 3;
+        colors[3][k] = (colors[0][k] + 2 * colors[1][k]) / 3;
+      }
+      else
+      {
+        colors[2][k] = (colors[0][k] + colors[1][k]) / 2;
+        colors[3][k] = 0;
+      }
+    }
+  }
+
+  // Endpoints at the ends of the texels' principal axis (the direction they're most
+  // spread out along), then the closest of the 4 palette colors for each texel
+  BC1Block encode_block(const unsigned char texels[16][3])
+  {
+    float mean[3] = {0, 0, 0};
+    for (int i = 0; i < 16; i++)
+      for (int k = 0; k < 3; k++)
+        mean[k] += texels[i][k] / 16.0f;
+    float cov[3][3] = {{0}};
+    for (int i = 0; i < 16; i++)
+      for (int a = 0; a < 3; a++)
+        for (int b = 0; b < 3; b++)
+          cov[a][b] += (texels[i][a] - mean[a]) * (texels[i][b] - mean[b]);
+    // a few rounds of power iteration
+    float axis[3] = {1, 1, 1};
+    for (int it = 0; it < 4; it++)
+    {
+      float next[3];
+      for (int a = 0; a < 3; a++)
+        next[a] = cov[a][0] * axis[0] + cov[a][1] * axis[1] + cov[a][2] * axis[2];
+      float len = std::sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2]);
+      if (len < 1e-6f)
+        break;
+      for (int a = 0; a < 3; a++)
+        axis[a] = next[a] / len;
+    }
+    float tmin = 0, tmax = 0;
+    for (int i = 0; i < 16; i++)
+    {
+      float t = 0;
+      for (int k = 0; k < 3; k++)
+        t += (texels[i][k] - mean[k]) * axis[k];
+      tmin = std::min(tmin, t);
+      tmax = std::max(tmax, t);
+    }
+    float lo[3], hi[3];
+    for (int k = 0; k < 3; k++)
+    {
+      lo[k] = mean[k] + tmin * axis[k];
+      hi[k] = mean[k] + tmax * axis[k];
+    }
+    BC1Block block;
+    block.c0 = pack565(hi);
+    block.c1 = pack565(lo);
+    if (block.c0 < block.c1)
+      std::swap(block.c0, block.c1);
+    block.indices = 0;
+    if (block.c0 == block.c1)
+      return block;
+    int colors[4][3];
+    palette(block, colors);
+    for (int i = 0; i < 16; i++)
+    {
+      int best = 0, best_dist = 1 << 30;
+      for (int p = 0; p < 4; p++)
+      {
+        int dist = 0;
+        for (int k = 0; k < 3; k++)
+          dist += (texels[i][k] - colors[p][k]) * (texels[i][k] - colors[p][k]);
+        if (dist < best_dist)
+        {
+          best_dist = dist;
+          best = p;
+        }
+      }
+      block.indices |= (uint32_t)best << (2 * i);
+    }
+    return block;
+  }
+}
+
+CompressedTexture::CompressedTexture() : width_(0), height_(0), blocks_wide_(0), blocks_high_(0), blocks_(), id_(next_texture_id++)
+{
+}
+
+CompressedTexture::CompressedTexture(TGAImage &image, int threads)
+    : width_(image.get_width()), height_(image.get_height()), id_(next_texture_id++)
+{
+  blocks_wide_ = (width_ + 3) / 4;
+  blocks_high_ = (height_ + 3) / 4;
+  blocks_.resize((size_t)blocks_wide_ * blocks_high_);
+  if (threads <= 0)
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  threads = std::min(threads, std::max(1, blocks_high_));
+  std::atomic<int> next_row(0);
+  auto encode_rows = [&]()
+  {
+    for (int by = next_row++; by < blocks_high_; by = next_row++)
+    {
+      for (int bx = 0; bx < blocks_wide_; bx++)
+      {
+        // texels past the edge repeat the last row/column
+        unsigned char texels[16][3];
+        for (int j = 0; j < 4; j++)
+          for (int i = 0; i < 4; i++)
+          {
+            TGAColor c = image.get(std::min(bx * 4 + i, width_ - 1), std::min(by * 4 + j, height_ - 1));
+            for (int k = 0; k < 3; k++)
+              texels[4 * j + i][k] = c.raw[k];
+          }
+        blocks_[(size_t)by * blocks_wide_ + bx] = encode_block(texels);
+      }
+    }
+  };
+  std::vector<std::thread> workers;
+  for (int t = 1; t < threads; t++)
+    workers.push_back(std::thread(encode_rows));
+  encode_rows();
+  for (size_t t = 0; t < workers.size(); t++)
+    workers[t].join();
+}
+
+CompressedTexture *CompressedTexture::load(const std::string &path, int threads)
+{
+  long long mtime = file_mtime(path);
+  if (mtime < 0)
+  {
+    std::cerr << "can't open file " << path << "\n";
+    return NULL;
+  }
+  std::string cache = path + ".bc1";
+  CompressedTexture *texture = new CompressedTexture();
+  if (texture->read(cache, mtime))
+    return texture;
+  delete texture;
+
+  TGAImage image;
+  if (!image.read_tga_file(path.c_str()))
+    return NULL;
+  texture = new CompressedTexture(image, threads);
+  if (!texture->write(cache, mtime))
+    std::cerr << "can't write the compressed texture cache " << cache << "\n";
+  return texture;
+}
+
+const unsigned char *CompressedTexture::decoded(int block) const
+{
+  int bx = block % blocks_wide_, by = block / blocks_wide_;
+  CachedBlock &slot = block_cache[(bx & 7) | ((by & 7) << 3)];
+  if (slot.texture != id_ || slot.block != block)
+  {
+    const BC1Block &b = blocks_[block];
+    int colors[4][3];
+    palette(b, colors);
+    for (int i = 0; i < 16; i++)
+    {
+      int p = (b.indices >> (2 * i)) & 3;
+      for (int k = 0; k < 3; k++)
+        slot.texels[i][k] = (unsigned char)colors[p][k];
+    }
+    slot.texture = id_;
+    slot.block = block;
+  }
+  return &slot.texels[0][0];
+}
+
+TGAColor CompressedTexture::get(int x, int y) const
+{
+  if (x < 0 || y < 0 || x >= width_ || y >= height_)
+  {
+    return TGAColor();
+  }
+  const unsigned char *texels = decoded((y >> 2) * blocks_wide_ + (x >> 2));
+  return TGAColor(texels + 3 * (4 * (y & 3) + (x & 3)), 3);
+}
+
+size_t CompressedTexture::memory_size() const
+{
+  return sizeof(CompressedTexture) + blocks_.capacity() * sizeof(BC1Block);
+}
+
+// Layout: "BC1T", version, width, height (uint32), the source's mtime (int64), then
+// the blocks row by row
+bool CompressedTexture::write(const std::string &filename, long long source_mtime) const
+{
+  std::ofstream out(filename.c_str(), std::ios::binary);
+  if (!out.is_open())
+    return false;
+  uint32_t header[3] = {bc1_version, (uint32_t)width_, (uint32_t)height_};
+  int64_t mtime = source_mtime;
+  out.write(bc1_magic, sizeof(bc1_magic));
+  out.write((const char *)header, sizeof(header));
+  out.write((const char *)&mtime, sizeof(mtime));
+  out.write((const char *)blocks_.data(), blocks_.size() * sizeof(BC1Block));
+  return out.good();
+}
+
+bool CompressedTexture::read(const std::string &filename, long long source_mtime)
+{
+  std::ifstream in(filename.c_str(), std::ios::binary);
+  if (!in.is_open())
+    return false;
+  char magic[4];
+  uint32_t header[3];
+  int64_t mtime;
+  in.read(magic, sizeof(magic));
+  in.read((char *)header, sizeof(header));
+  in.read((char *)&mtime, sizeof(mtime));
+  // an old cache file is just ignored
+  if (!in.good() || memcmp(magic, bc1_magic, sizeof(magic)) || header[0] != bc1_version || mtime != source_mtime)
+    return false;
+  width_ = (int)header[1];
+  height_ = (int)header[2];
+  blocks_wide_ = (width_ + 3) / 4;
+  blocks_high_ = (height_ + 3) / 4;
+  blocks_.resize((size_t)blocks_wide_ * blocks_high_);
+  in.read((char *)blocks_.data(), blocks_.size() * sizeof(BC1Block));
+  return in.good();
+}
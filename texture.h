@@ -0,0 +1,53 @@
+#ifndef __TEXTURE_H__
+#define __TEXTURE_H__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "tgaimage.h"
+
+// BC1 (DXT1) block: two RGB565 endpoints and a 2 bit palette index for each of the
+// 16 texels of a 4x4 block, 8 bytes for what takes 48 in a TGAImage
+struct BC1Block
+{
+  uint16_t c0, c1;
+  uint32_t indices; // texel (i, j) of the block is bits 2 * (4 * j + i)
+};
+
+// A texture kept block compressed in memory, 6x smaller than the RGB TGAImage it
+// came from (alpha is dropped). get() decodes the whole 4x4 block a texel is in and
+// keeps it in a small cache per thread, since neighboring samples mostly land in
+// the same block.
+class CompressedTexture
+{
+  int width_, height_;
+  int blocks_wide_, blocks_high_;
+  std::vector<BC1Block> blocks_;
+  unsigned id_; // which texture a cached block came from
+
+  const unsigned char *decoded(int block) const;
+
+public:
+  // Encodes `image`, a row of blocks at a time on `threads` threads (<= 0 means
+  // all hardware threads)
+  CompressedTexture(TGAImage &image, int threads = 0);
+
+  // The texture in `path`, read from its cache file (path + ".bc1") if that's
+  // newer than it, or encoded and written to the cache file if not. NULL if the
+  // texture can't be read.
+  static CompressedTexture *load(const std::string &path, int threads = 0);
+
+  int get_width() const { return width_; }
+  int get_height() const { return height_; }
+  // Same as TGAImage::get(), in RGB
+  TGAColor get(int x, int y) const;
+  size_t memory_size() const;
+
+  bool write(const std::string &filename, long long source_mtime) const;
+
+private:
+  CompressedTexture();
+  bool read(const std::string &filename, long long source_mtime);
+};
+
+#endif //__TEXTURE_H__
@@ -146,9 +146,6 @@ bool TGAImage::load_rle_data(std::ifstream &in) {
 }
 
 bool TGAImage::write_tga_file(const char *filename, bool rle) {
-	unsigned char developer_area_ref[4] = {0, 0, 0, 0};
-	unsigned char extension_area_ref[4] = {0, 0, 0, 0};
-	unsigned char footer[18] = {'T','R','U','E','V','I','S','I','O','N','-','X','F','I','L','E','.','\0'};
 	std::ofstream out;
 	out.open (filename, std::ios::binary);
 	if (!out.is_open()) {
@@ -156,6 +153,15 @@ bool TGAImage::write_tga_file(const char *filename, bool rle) {
 		out.close();
 		return false;
 	}
+	bool ok = write_tga(out, rle);
+	out.close();
+	return ok;
+}
+
+bool TGAImage::write_tga(std::ostream &out, bool rle) {
+	unsigned char developer_area_ref[4] = {0, 0, 0, 0};
+	unsigned char extension_area_ref[4] = {0, 0, 0, 0};
+	unsigned char footer[18] = {'T','R','U','E','V','I','S','I','O','N','-','X','F','I','L','E','.','\0'};
 	TGA_Header header;
 	memset((void *)&header, 0, sizeof(header));
 	header.bitsperpixel = bytespp<<3;
@@ -165,7 +171,6 @@ bool TGAImage::write_tga_file(const char *filename, bool rle) {
 	header.imagedescriptor = 0x20; // top-left origin
 	out.write((char *)&header, sizeof(header));
 	if (!out.good()) {
-		out.close();
 		std::cerr << "can't dump the tga file\n";
 		return false;
 	}
@@ -173,77 +178,73 @@ bool TGAImage::write_tga_file(const char *filename, bool rle) {
 		out.write((char *)data, width*height*bytespp);
 		if (!out.good()) {
 			std::cerr << "can't unload raw data\n";
-			out.close();
 			return false;
 		}
 	} else {
 		if (!unload_rle_data(out)) {
-			out.close();
 			std::cerr << "can't unload rle data\n";
 			return false;
 		}
 	}
 	out.write((char *)developer_area_ref, sizeof(developer_area_ref));
+	out.write((char *)extension_area_ref, sizeof(extension_area_ref));
+	out.write((char *)footer, sizeof(footer));
 	if (!out.good()) {
 		std::cerr << "can't dump the tga file\n";
-		out.close();
 		return false;
 	}
-	out.write((char *)extension_area_ref, sizeof(extension_area_ref));
+	return true;
+}
+
+// TODO: it is not necessary to break a raw chunk for two equal pixels (for the matter of the resulting size)
+// Writes the RLE packet that starts at pixel curpix of data's npixels, returns how many
+// pixels it covers (0 if the write failed)
+static unsigned long write_rle_packet(std::ostream &out, const unsigned char *data, unsigned long curpix, unsigned long npixels, int bytespp) {
+	const unsigned char max_chunk_length = 128;
+	unsigned long chunkstart = curpix*bytespp;
+	unsigned long curbyte = curpix*bytespp;
+	unsigned char run_length = 1;
+	bool raw = true;
+	while (curpix+run_length<npixels && run_length<max_chunk_length) {
+		bool succ_eq = true;
+		for (int t=0; succ_eq && t<bytespp; t++) {
+			succ_eq = (data[curbyte+t]==data[curbyte+t+bytespp]);
+		}
+		curbyte += bytespp;
+		if (1==run_length) {
+			raw = !succ_eq;
+		}
+		if (raw && succ_eq) {
+			run_length--;
+			break;
+		}
+		if (!raw && !succ_eq) {
+			break;
+		}
+		run_length++;
+	}
+	out.put(raw?run_length-1:run_length+127);
 	if (!out.good()) {
 		std::cerr << "can't dump the tga file\n";
-		out.close();
-		return false;
+		return 0;
 	}
-	out.write((char *)footer, sizeof(footer));
+	out.write((char *)(data+chunkstart), (raw?run_length*bytespp:bytespp));
 	if (!out.good()) {
 		std::cerr << "can't dump the tga file\n";
-		out.close();
-		return false;
+		return 0;
 	}
-	out.close();
-	return true;
+	return run_length;
 }
 
-// TODO: it is not necessary to break a raw chunk for two equal pixels (for the matter of the resulting size)
-bool TGAImage::unload_rle_data(std::ofstream &out) {
-	const unsigned char max_chunk_length = 128;
+bool TGAImage::unload_rle_data(std::ostream &out) {
 	unsigned long npixels = width*height;
 	unsigned long curpix = 0;
 	while (curpix<npixels) {
-		unsigned long chunkstart = curpix*bytespp;
-		unsigned long curbyte = curpix*bytespp;
-		unsigned char run_length = 1;
-		bool raw = true;
-		while (curpix+run_length<npixels && run_length<max_chunk_length) {
-			bool succ_eq = true;
-			for (int t=0; succ_eq && t<bytespp; t++) {
-				succ_eq = (data[curbyte+t]==data[curbyte+t+bytespp]);
-			}
-			curbyte += bytespp;
-			if (1==run_length) {
-				raw = !succ_eq;
-			}
-			if (raw && succ_eq) {
-				run_length--;
-				break;
-			}
-			if (!raw && !succ_eq) {
-				break;
-			}
-			run_length++;
-		}
-		curpix += run_length;
-		out.put(raw?run_length-1:run_length+127);
-		if (!out.good()) {
-			std::cerr << "can't dump the tga file\n";
-			return false;
-		}
-		out.write((char *)(data+chunkstart), (raw?run_length*bytespp:bytespp));
-		if (!out.good()) {
-			std::cerr << "can't dump the tga file\n";
+		unsigned long run_length = write_rle_packet(out, data, curpix, npixels, bytespp);
+		if (!run_length) {
 			return false;
 		}
+		curpix += run_length;
 	}
 	return true;
 }
@@ -349,3 +350,110 @@ bool TGAImage::scale(int w, int h) {
 	height = h;
 	return true;
 }
+
+TGAWriter::TGAWriter() : width(0), height(0), bytespp(0), rle(true), rows_written(0), pending(), pending_start(0) {
+}
+
+TGAWriter::~TGAWriter() {
+	if (out.is_open()) {
+		out.close();
+	}
+}
+
+bool TGAWriter::open(const char *filename, int w, int h, int bpp, bool use_rle) {
+	if (w<=0 || h<=0 || w>65535 || h>65535) {
+		std::cerr << "a tga file can't be " << w << "x" << h << "\n";
+		return false;
+	}
+	out.open(filename, std::ios::binary);
+	if (!out.is_open()) {
+		std::cerr << "can't open file " << filename << "\n";
+		return false;
+	}
+	width = w;
+	height = h;
+	bytespp = bpp;
+	rle = use_rle;
+	rows_written = 0;
+	pending.clear();
+	pending_start = 0;
+	TGA_Header header;
+	memset((void *)&header, 0, sizeof(header));
+	header.bitsperpixel = bytespp<<3;
+	header.width  = (short)width;
+	header.height = (short)height;
+	header.datatypecode = (bytespp==TGAImage::GRAYSCALE?(rle?11:3):(rle?10:2));
+	header.imagedescriptor = 0x20; // top-left origin
+	out.write((char *)&header, sizeof(header));
+	if (!out.good()) {
+		std::cerr << "can't dump the tga file\n";
+		out.close();
+		return false;
+	}
+	return true;
+}
+
+// RLE packets look up to 128 pixels ahead, so only the ones with that many pixels
+// after them are written until the last row is in
+bool TGAWriter::encode(bool last) {
+	unsigned long npixels = (pending.size()-pending_start)/bytespp;
+	const unsigned char *data = &pending[0]+pending_start;
+	unsigned long curpix = 0;
+	while (last ? curpix<npixels : curpix+128<npixels) {
+		unsigned long run_length = write_rle_packet(out, data, curpix, npixels, bytespp);
+		if (!run_length) {
+			return false;
+		}
+		curpix += run_length;
+	}
+	pending_start += curpix*bytespp;
+	// drop what's been written once it's most of the buffer, so it doesn't keep growing
+	if (pending_start > pending.size()/2) {
+		pending.erase(pending.begin(), pending.begin()+pending_start);
+		pending_start = 0;
+	}
+	return true;
+}
+
+bool TGAWriter::write_rows(TGAImage &rows) {
+	if (!out.is_open() || rows.get_width()!=width || rows.get_bytespp()!=bytespp || rows_written+rows.get_height()>height) {
+		std::cerr << "rows don't fit the tga file\n";
+		return false;
+	}
+	unsigned long nbytes = (unsigned long)width*rows.get_height()*bytespp;
+	rows_written += rows.get_height();
+	if (!rle) {
+		out.write((char *)rows.buffer(), nbytes);
+		if (!out.good()) {
+			std::cerr << "can't unload raw data\n";
+			return false;
+		}
+		return true;
+	}
+	pending.insert(pending.end(), rows.buffer(), rows.buffer()+nbytes);
+	return encode(rows_written==height);
+}
+
+bool TGAWriter::close() {
+	unsigned char developer_area_ref[4] = {0, 0, 0, 0};
+	unsigned char extension_area_ref[4] = {0, 0, 0, 0};
+	unsigned char footer[18] = {'T','R','U','E','V','I','S','I','O','N','-','X','F','I','L','E','.','\0'};
+	if (!out.is_open()) {
+		return false;
+	}
+	if (rows_written!=height) {
+		std::cerr << "only " << rows_written << " of " << height << " rows were written\n";
+		out.close();
+		return false;
+	}
+	out.write((char *)developer_area_ref, sizeof(developer_area_ref));
+	out.write((char *)extension_area_ref, sizeof(extension_area_ref));
+	out.write((char *)footer, sizeof(footer));
+	if (!out.good()) {
+		std::cerr << "can't dump the tga file\n";
+		out.close();
+		return false;
+	}
+	out.close();
+	return true;
+}
@@ -2,6 +2,7 @@
 #define __IMAGE_H__
 
 #include <fstream>
+#include <vector>
 
 #pragma pack(push,1)
 struct TGA_Header {
@@ -68,7 +69,7 @@ protected:
 	int bytespp;
 
 	bool   load_rle_data(std::ifstream &in);
-	bool unload_rle_data(std::ofstream &out);
+	bool unload_rle_data(std::ostream &out);
 public:
 	enum Format {
 		GRAYSCALE=1, RGB=3, RGBA=4
@@ -79,6 +80,8 @@ public:
 	TGAImage(const TGAImage &img);
 	bool read_tga_file(const char *filename);
 	bool write_tga_file(const char *filename, bool rle=true);
+	// the same bytes, into any stream (e.g. to send the image somewhere)
+	bool write_tga(std::ostream &out, bool rle=true);
 	bool flip_horizontally();
 	bool flip_vertically();
 	bool scale(int w, int h);
@@ -93,4 +96,29 @@ public:
 	void clear();
 };
 
+// Writes a tga file a few rows at a time, top row first, so the whole image never has
+// to be in memory at once. The file is byte for byte what TGAImage::write_tga_file()
+// writes for the same image.
+class TGAWriter {
+	std::ofstream out;
+	int width;
+	int height;
+	int bytespp;
+	bool rle;
+	int rows_written;
+	std::vector<unsigned char> pending; // rows that aren't all RLE encoded yet
+	unsigned long pending_start;        // bytes of pending already written
+
+	bool encode(bool last);
+public:
+	TGAWriter();
+	~TGAWriter();
+	bool open(const char *filename, int w, int h, int bpp, bool rle=true);
+	// the next rows.get_height() rows of the file, in rows' memory order (top first,
+	// like a flipped TGAImage)
+	bool write_rows(TGAImage &rows);
+	// false unless every row was written
+	bool close();
+};
+
 #endif //__IMAGE_H__
\ No newline at end of file
@@ -0,0 +1,128 @@
+#include <algorithm>
+#include "threadpool.h"
+
+namespace
+{
+  // which pool (if any) the current thread works for, and its index in it
+  thread_local ThreadPool *current_pool = NULL;
+  thread_local int current_worker = -1;
+}
+
+ThreadPool::ThreadPool(int nthreads) : queued_(0), unfinished_(0), next_queue_(0), stop_(false)
+{
+  if (nthreads <= 0)
+  {
+    nthreads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  for (int i = 0; i < nthreads; i++)
+  {
+    queues_.push_back(new Queue());
+  }
+  for (int i = 0; i < nthreads; i++)
+  {
+    threads_.push_back(std::thread(&ThreadPool::worker, this, i));
+  }
+}
+
+ThreadPool::~ThreadPool()
+{
+  wait();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  work_cv_.notify_all();
+  for (size_t i = 0; i < threads_.size(); i++)
+  {
+    threads_[i].join();
+  }
+  for (size_t i = 0; i < queues_.size(); i++)
+  {
+    delete queues_[i];
+  }
+}
+
+void ThreadPool::submit(Task task)
+{
+  int q = current_pool == this ? current_worker : (int)(next_queue_++ % queues_.size());
+  unfinished_++;
+  {
+    std::lock_guard<std::mutex> lock(queues_[q]->mutex);
+    queues_[q]->tasks.push_back(task);
+  }
+  {
+    // under the lock so a worker that's about to sleep can't miss it
+    std::lock_guard<std::mutex> lock(mutex_);
+    queued_++;
+  }
+  work_cv_.notify_one();
+}
+
+void ThreadPool::wait()
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  done_cv_.wait(lock, [this]()
+                { return unfinished_ == 0; });
+}
+
+bool ThreadPool::pop(int self, Task &task)
+{
+  int n = (int)queues_.size();
+  for (int i = 0; i < n; i++)
+  {
+    // own deque first, from the back, then everyone else's from the front
+    Queue *q = queues_[(self + i) % n];
+    std::lock_guard<std::mutex> lock(q->mutex);
+    if (q->tasks.empty())
+    {
+      continue;
+    }
+    if (i == 0)
+    {
+      task = q->tasks.back();
+      q->tasks.pop_back();
+    }
+    else
+    {
+      task = q->tasks.front();
+      q->tasks.pop_front();
+    }
+    return true;
+  }
+  return false;
+}
+
+void ThreadPool::worker(int self)
+{
+  current_pool = this;
+  current_worker = self;
+  Task task;
+  while (true)
+  {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      work_cv_.wait(lock, [this]()
+                    { return queued_ > 0 || stop_; });
+      if (queued_ == 0)
+      {
+        return;
+      }
+    }
+    if (!pop(self, task))
+    {
+      // someone else got it first
+      continue;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      queued_--;
+    }
+    task();
+    task = Task();
+    if (--unfinished_ == 0)
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      done_cv_.notify_all();
+    }
+  }
+}
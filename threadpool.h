@@ -0,0 +1,52 @@
+#ifndef __THREADPOOL_H__
+#define __THREADPOOL_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing thread pool. Every worker has its own deque: tasks submitted from a
+// worker go on the back of that worker's deque and it takes its own work from the
+// back (newest first, so a job's tiles get finished before another job is started).
+// Idle workers steal from the front of the others' deques (oldest first).
+// Tasks submitted from outside the pool are dealt out round robin.
+class ThreadPool
+{
+public:
+  typedef std::function<void()> Task;
+
+  // 0 threads means one per core
+  ThreadPool(int nthreads = 0);
+  // waits for everything that's been submitted
+  ~ThreadPool();
+
+  int size() { return (int)threads_.size(); }
+  void submit(Task task);
+  // Blocks until every task has finished, including the ones that tasks submitted
+  void wait();
+
+private:
+  struct Queue
+  {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  std::vector<Queue *> queues_;
+  std::vector<std::thread> threads_;
+  std::mutex mutex_; // only for sleeping and waking up
+  std::condition_variable work_cv_, done_cv_;
+  int queued_;                  // tasks sitting in some deque, guarded by mutex_
+  std::atomic<int> unfinished_; // queued or running
+  std::atomic<unsigned> next_queue_;
+  bool stop_;
+
+  bool pop(int self, Task &task);
+  void worker(int self);
+};
+
+#endif //__THREADPOOL_H__